@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cbuf.h"
+
+/** Microbenchmark suite. Each scenario repeats one unit operation (e.g. a write followed by a read)
+ *  against a ring set up for that configuration, and reports one CSV line:
+ *
+ *    build,scenario,blob_bytes,buffer_bytes,param,ops,ops_per_sec,mb_per_sec,p50_ns,p99_ns,p999_ns
+ *
+ *  build lists the CBUF_ options the benchmark was compiled with, so results from several builds
+ *  can be concatenated. param is scenario-specific (see the comments in main). Throughput comes from an untimed run of
+ *  the operation; latency percentiles come from a second run that times each operation on its own.
+ *
+ *  Build with CBUF_ALLOW_PARTIAL to include the partial open/append/close and ingest scenarios, and with
+ *  CBUF_MIRROR to include mirrored-buffer variants. Builds with CBUF_HEADER_16 or CBUF_HEADER_VARINT
+ *  show the effective capacity gain in the fill scenario. CBUF_BLOB_INDEX builds attach an offset
+ *  index to every ring. CBUF_CRC builds show what sealing and checking every blob costs.
+ */
+
+#define BENCH_MAX_Q_LEN     (16u << 20)     //Largest ring, in bytes
+#define BENCH_BYTES         (32u << 20)     //Bytes moved per throughput run
+#define BENCH_MIN_OPS       (10000u)        //Bounds on operations per throughput run
+#define BENCH_MAX_OPS       (2000000u)
+#define BENCH_LAT_OPS       (200000u)       //Operations per latency run
+#define BENCH_MAX_BATCH     (64u)
+
+#if defined(CBUF_ALLOW_PARTIAL)
+#define BENCH_BUILD_PARTIAL "partial+"
+#else
+#define BENCH_BUILD_PARTIAL ""
+#endif
+#if defined(CBUF_POW2)
+#define BENCH_BUILD_POW2    "pow2+"
+#else
+#define BENCH_BUILD_POW2    ""
+#endif
+#if defined(CBUF_MIRROR)
+#define BENCH_BUILD_MIRROR  "mirror+"
+#else
+#define BENCH_BUILD_MIRROR  ""
+#endif
+#if defined(CBUF_HEADER_16)
+#define BENCH_BUILD_HEADER  "hdr16+"
+#elif defined(CBUF_HEADER_VARINT)
+#define BENCH_BUILD_HEADER  "varint+"
+#else
+#define BENCH_BUILD_HEADER  ""
+#endif
+#if defined(CBUF_BLOB_INDEX)
+#define BENCH_BUILD_INDEX   "index+"
+#else
+#define BENCH_BUILD_INDEX   ""
+#endif
+#if defined(CBUF_CRC)
+#define BENCH_BUILD_CRC     "crc+"
+#else
+#define BENCH_BUILD_CRC     ""
+#endif
+#define BENCH_BUILD         ("base+" BENCH_BUILD_PARTIAL BENCH_BUILD_POW2 BENCH_BUILD_MIRROR BENCH_BUILD_HEADER BENCH_BUILD_INDEX BENCH_BUILD_CRC)
+
+/** One benchmark configuration */
+typedef struct {
+    const char *name;   //Scenario name, as reported
+    uint32_t blob_len;  //Length of each blob (in bytes)
+    uint32_t buf_len;   //Length of the ring (in bytes)
+    uint32_t param;     //Scenario-specific parameter
+    bool mirrored;      //Use a mirrored ring (CBUF_MIRROR builds only)
+    uint32_t blobs;     //Blobs moved per operation, when more than one, to size the runs
+} bench_cfg_t;
+
+/** Run the unit operation of a scenario once. i counts operations within the run.
+ *  Returns the number of payload bytes moved.
+ */
+typedef uint32_t (*bench_op_t)(const bench_cfg_t *cfg, uint32_t i);
+
+static cbuf_t cbuf;
+static uint8_t mbuf[BENCH_MAX_Q_LEN];
+static uint8_t blob[BENCH_MAX_Q_LEN];
+static uint8_t out[BENCH_MAX_Q_LEN];
+static uint32_t lat[BENCH_LAT_OPS];
+static cbuf_blob_t blobs[BENCH_MAX_BATCH];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t offsets[BENCH_MAX_Q_LEN / 4];   //One per 4 bytes, the smallest blob with a 4-byte header
+#endif
+#if defined(CBUF_ALLOW_PARTIAL)
+#define BENCH_STREAM_LEN    (64u << 10)
+static uint8_t stream[BENCH_STREAM_LEN];        //Lines for the ingest scenario
+#endif
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/** Write then read one blob */
+static uint32_t op_write_read(const bench_cfg_t *cfg, uint32_t i)
+{
+    (void)i;
+    cbuf_write(&cbuf, blob, cfg->blob_len, true, NULL);
+    cbuf_read(&cbuf, out);
+    return cfg->blob_len;
+}
+
+/** Write one blob with overwrite, and read one back except param percent of the time. The ring fills
+ *  up and the writes that aren't matched by reads erase old blobs.
+ */
+static uint32_t op_overwrite(const bench_cfg_t *cfg, uint32_t i)
+{
+    cbuf_write(&cbuf, blob, cfg->blob_len, true, NULL);
+    if ((i % 100) >= cfg->param)
+    {
+        cbuf_read(&cbuf, out);
+    }
+    return cfg->blob_len;
+}
+
+/** Write one blob, then read it back with cbuf_read, preceded param percent of the time by a
+ *  cbuf_peek_len and full cbuf_peek
+ */
+static uint32_t op_peek_read(const bench_cfg_t *cfg, uint32_t i)
+{
+    cbuf_write(&cbuf, blob, cfg->blob_len, true, NULL);
+    if ((i % 100) < cfg->param)
+    {
+        uint32_t len;
+        cbuf_peek_len(&cbuf, &len);
+        cbuf_peek(&cbuf, out, &len);
+    }
+    cbuf_read(&cbuf, out);
+    return cfg->blob_len;
+}
+
+/** Write param blobs one cbuf_write at a time, then drain them with cbuf_consume */
+static uint32_t op_write_loop(const bench_cfg_t *cfg, uint32_t i)
+{
+    (void)i;
+    for (uint32_t j = 0; j < cfg->param; j++)
+    {
+        cbuf_write(&cbuf, blobs[j].data, blobs[j].len, true, NULL);
+    }
+    cbuf_consume(&cbuf, cfg->param);
+    return cfg->param * cfg->blob_len;
+}
+
+/** Write param blobs with one cbuf_write_batch, then drain them with cbuf_consume */
+static uint32_t op_write_batch(const bench_cfg_t *cfg, uint32_t i)
+{
+    (void)i;
+    cbuf_write_batch(&cbuf, blobs, cfg->param, true, NULL);
+    cbuf_consume(&cbuf, cfg->param);
+    return cfg->param * cfg->blob_len;
+}
+
+/** Write param blobs with one cbuf_write_batch, then drain them with cbuf_peek_len + cbuf_read each */
+static uint32_t op_read_loop(const bench_cfg_t *cfg, uint32_t i)
+{
+    uint32_t len;
+    uint32_t used = 0;
+    (void)i;
+    cbuf_write_batch(&cbuf, blobs, cfg->param, true, NULL);
+    while (cbuf_peek_len(&cbuf, &len))
+    {
+        cbuf_read(&cbuf, &out[used]);
+        used += len;
+    }
+    return cfg->param * cfg->blob_len;
+}
+
+/** Write param blobs with one cbuf_write_batch, then drain them with one cbuf_read_batch */
+static uint32_t op_read_batch(const bench_cfg_t *cfg, uint32_t i)
+{
+    uint32_t offsets[BENCH_MAX_BATCH];
+    uint32_t lens[BENCH_MAX_BATCH];
+    (void)i;
+    cbuf_write_batch(&cbuf, blobs, cfg->param, true, NULL);
+    cbuf_read_batch(&cbuf, out, sizeof(out), offsets, lens, cfg->param);
+    return cfg->param * cfg->blob_len;
+}
+
+/** Fill the empty ring with blobs until one no longer fits, then drain them with cbuf_consume */
+static uint32_t op_fill(const bench_cfg_t *cfg, uint32_t i)
+{
+    uint32_t n = 0;
+    (void)i;
+    while (cbuf_write(&cbuf, blob, cfg->blob_len, false, NULL))
+    {
+        n++;
+    }
+    cbuf_consume(&cbuf, n);
+    return n * cfg->blob_len;
+}
+
+/** Fill the empty ring with param 4-byte blobs, then write one blob that erases about half of them
+ *  and drain the rest
+ */
+static uint32_t op_evict(const bench_cfg_t *cfg, uint32_t i)
+{
+    (void)i;
+    for (uint32_t j = 0; j < cfg->param; j++)
+    {
+        cbuf_write(&cbuf, blob, 4, false, NULL);
+    }
+    cbuf_write(&cbuf, blob, cfg->blob_len, true, NULL);
+    cbuf_consume(&cbuf, cfg->param);
+    return 4 * cfg->param + cfg->blob_len;
+}
+
+/** Walk all blobs in the ring looking for a pattern none of them holds: param 0 matches it as a
+ *  prefix, param 1 anywhere in the body. The ring is filled on the first operation and kept.
+ */
+static uint32_t op_find(const bench_cfg_t *cfg, uint32_t i)
+{
+    static const uint8_t pattern[] = {0x5A, 0xA5, 0x5A, 0xA5};
+    cbuf_iter_t it;
+    cbuf_view_t view;
+    if (i == 0)
+    {
+        while (cbuf_write(&cbuf, blob, cfg->blob_len, false, NULL))
+        {
+            //Until full
+        }
+    }
+    cbuf_iter_begin(&cbuf, &it);
+    cbuf_iter_find(&cbuf, &it, pattern, sizeof(pattern), cfg->param == 0, &view);
+    return cbuf_count(&cbuf) * cfg->blob_len;
+}
+
+#if defined(CBUF_ALLOW_PARTIAL)
+/** Open a blob, append it in param equal pieces, close it and read it back */
+static uint32_t op_partial(const bench_cfg_t *cfg, uint32_t i)
+{
+    uint32_t piece = cfg->blob_len / cfg->param;
+    (void)i;
+    cbuf_open(&cbuf, true, NULL);
+    for (uint32_t j = 0; j < cfg->param; j++)
+    {
+        cbuf_write(&cbuf, &blob[j * piece], piece, true, NULL);
+    }
+    cbuf_close(&cbuf);
+    cbuf_read(&cbuf, out);
+    return piece * cfg->param;
+}
+
+/** Split the next param bytes of a stream of blob_len-byte lines into blobs and read them back */
+static uint32_t op_ingest(const bench_cfg_t *cfg, uint32_t i)
+{
+    uint32_t at = (i * cfg->param) % BENCH_STREAM_LEN;
+    cbuf_ingest(&cbuf, &stream[at], cfg->param, '\n', true, NULL);
+    while (cbuf_read(&cbuf, out))
+    {
+    }
+    return cfg->param;
+}
+#endif
+
+static void bench_init(const bench_cfg_t *cfg)
+{
+#if defined(CBUF_MIRROR)
+    if (cfg->mirrored)
+    {
+        cbuf_init_mirror(&cbuf, cfg->buf_len);
+    }
+    else
+#endif
+    {
+        cbuf_init(&cbuf, mbuf, cfg->buf_len);
+    }
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&cbuf, offsets, cfg->buf_len / 4);
+#endif
+}
+
+static void bench_deinit(void)
+{
+#if defined(CBUF_MIRROR)
+    cbuf_deinit_mirror(&cbuf);
+#endif
+}
+
+/** Number of blobs of blob_len bytes an empty ring of buf_len bytes holds */
+static uint32_t bench_capacity(uint32_t blob_len, uint32_t buf_len)
+{
+    uint32_t n = 0;
+    cbuf_init(&cbuf, mbuf, buf_len);
+    while (cbuf_write(&cbuf, blob, blob_len, false, NULL))
+    {
+        n++;
+    }
+    return n;
+}
+
+static void bench_run(const bench_cfg_t *cfg, bench_op_t op)
+{
+    uint32_t ops = BENCH_BYTES / cfg->blob_len / (cfg->blobs ? cfg->blobs : 1);
+    ops = (ops < BENCH_MIN_OPS) ? BENCH_MIN_OPS : (ops > BENCH_MAX_OPS) ? BENCH_MAX_OPS : ops;
+    uint64_t bytes = 0;
+
+    for (uint32_t i = 0; i < BENCH_MAX_BATCH; i++)
+    {
+        blobs[i].data = blob;
+        blobs[i].len  = cfg->blob_len;
+    }
+
+    //Throughput
+    bench_init(cfg);
+    uint64_t t0 = now_ns();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        bytes += op(cfg, i);
+    }
+    uint64_t t1 = now_ns();
+    bench_deinit();
+
+    //Latency
+    uint32_t lat_ops = (ops < BENCH_LAT_OPS) ? ops : BENCH_LAT_OPS;
+    bench_init(cfg);
+    for (uint32_t i = 0; i < lat_ops; i++)
+    {
+        uint64_t s = now_ns();
+        op(cfg, i);
+        lat[i] = (uint32_t)(now_ns() - s);
+    }
+    bench_deinit();
+    qsort(lat, lat_ops, sizeof(lat[0]), cmp_u32);
+
+    double secs = (t1 - t0) * 1e-9;
+    printf("%.*s,%s%s,%u,%u,%u,%u,%.0f,%.1f,%u,%u,%u\n", (int)strlen(BENCH_BUILD) - 1, BENCH_BUILD, cfg->name, cfg->mirrored ? "_mirror" : "",
+           cfg->blob_len, cfg->buf_len, cfg->param, ops, ops / secs, bytes / secs / 1e6,
+           lat[lat_ops / 2], lat[(uint64_t)lat_ops * 99 / 100], lat[(uint64_t)lat_ops * 999 / 1000]);
+    fflush(stdout);
+}
+
+int main(void)
+{
+    static const uint32_t blob_lens[] = {16, 256, 4096, 65536};
+    static const uint32_t buf_lens[]  = {4u << 10, 64u << 10, 1u << 20, 16u << 20};
+
+    printf("build,scenario,blob_bytes,buffer_bytes,param,ops,ops_per_sec,mb_per_sec,p50_ns,p99_ns,p999_ns\n");
+    memset(blob, 0xA5, sizeof(blob));
+
+    //Blob size x buffer size, param unused
+    for (uint32_t b = 0; b < sizeof(buf_lens) / sizeof(buf_lens[0]); b++)
+    {
+        for (uint32_t s = 0; s < sizeof(blob_lens) / sizeof(blob_lens[0]); s++)
+        {
+            if (blob_lens[s] * 4 > buf_lens[b]) continue;
+            bench_run(&(bench_cfg_t){"write_read", blob_lens[s], buf_lens[b], 0, false}, op_write_read);
+#if defined(CBUF_MIRROR)
+            bench_run(&(bench_cfg_t){"write_read", blob_lens[s], buf_lens[b], 0, true}, op_write_read);
+#endif
+        }
+    }
+
+    //Overwrite ratio: param is the percentage of writes not matched by a read
+    for (uint32_t pct = 0; pct <= 100; pct += 25)
+    {
+        bench_run(&(bench_cfg_t){"overwrite", 64, 64u << 10, pct, false}, op_overwrite);
+    }
+
+    //Peek/read mix: param is the percentage of reads preceded by a peek
+    for (uint32_t pct = 0; pct <= 100; pct += 50)
+    {
+        bench_run(&(bench_cfg_t){"peek_read", 256, 64u << 10, pct, false}, op_peek_read);
+    }
+
+    //Single vs batched calls: param is the number of blobs per batch
+    for (uint32_t len = 4; len <= 256; len *= 4)
+    {
+        bench_run(&(bench_cfg_t){"write_loop",  len, 1u << 20, BENCH_MAX_BATCH, false}, op_write_loop);
+        bench_run(&(bench_cfg_t){"write_batch", len, 1u << 20, BENCH_MAX_BATCH, false}, op_write_batch);
+        bench_run(&(bench_cfg_t){"read_loop",   len, 1u << 20, BENCH_MAX_BATCH, false}, op_read_loop);
+        bench_run(&(bench_cfg_t){"read_batch",  len, 1u << 20, BENCH_MAX_BATCH, false}, op_read_batch);
+    }
+
+    //Effective capacity of small-blob rings: param is the number of blobs a 4 KiB ring holds
+    for (uint32_t len = 2; len <= 12; len += 2)
+    {
+        uint32_t n = bench_capacity(len, 4u << 10);
+        bench_run(&(bench_cfg_t){"fill", len, 4u << 10, n, false, n}, op_fill);
+    }
+
+    //Bulk eviction of many small blobs by one large one: param is the number of small blobs
+    for (uint32_t len = 4u << 10; len <= (64u << 10); len *= 4)
+    {
+        uint32_t n = bench_capacity(4, 2 * len);
+        bench_run(&(bench_cfg_t){"evict", len, 2 * len, n, false, n}, op_evict);
+    }
+
+    //Non-destructive scan of a full ring: param is 0 for a prefix match and 1 for a match anywhere
+    for (uint32_t len = 16; len <= 1024; len *= 8)
+    {
+        bench_run(&(bench_cfg_t){"find", len, 64u << 10, 0, false, (64u << 10) / len}, op_find);
+        bench_run(&(bench_cfg_t){"find", len, 64u << 10, 1, false, (64u << 10) / len}, op_find);
+    }
+
+#if defined(CBUF_ALLOW_PARTIAL)
+    //Partial open/append/close: param is the number of appends per blob
+    for (uint32_t len = 64; len <= 4096; len *= 8)
+    {
+        for (uint32_t appends = 1; appends <= 16; appends *= 4)
+        {
+            bench_run(&(bench_cfg_t){"partial", len, 64u << 10, appends, false}, op_partial);
+        }
+    }
+
+    //Delimiter splitting of a line stream: param is the number of bytes passed per call
+    for (uint32_t len = 16; len <= 1024; len *= 4)
+    {
+        for (uint32_t at = 0; at < BENCH_STREAM_LEN; at += len)
+        {
+            memset(&stream[at], 'x', len - 1);
+            stream[at + len - 1] = '\n';
+        }
+        for (uint32_t chunk = 64; chunk <= 4096; chunk *= 8)
+        {
+            bench_run(&(bench_cfg_t){"ingest", len, 64u << 10, chunk, false, chunk / len}, op_ingest);
+        }
+    }
+#endif
+
+    return 0;
+}
@@ -1,4 +1,61 @@
 #!/bin/bash
 
+#Stop at the first build error or failing test
+set -e -o pipefail
+
 gcc -g -Werror -Wall -DCBUF_TEST test.c cbuf.c -o test
-gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL test_partial.c cbuf.c -o test_partial
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_STATS test_partial.c cbuf.c -o test_partial
+gcc -g -O2 -Werror -Wall -DCBUF_TEST -DCBUF_SPSC -DCBUF_WAIT -pthread test_spsc.c cbuf.c -o test_spsc
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_PERSIST test_persist.c cbuf.c -o test_persist
+gcc -g -O2 -Werror -Wall -DCBUF_TEST -DCBUF_MPSC -pthread test_mpsc.c cbuf.c -o test_mpsc
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_HEADER_VARINT test.c cbuf.c -o test_varint
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALIGN -DCBUF_HEADER_16 test.c cbuf.c -o test_align
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_BLOB_INDEX test.c cbuf.c -o test_index
+gcc -g -Werror -Wall -DCBUF_TEST test_batch.c cbuf.c -o test_batch
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALIGN -DCBUF_HEADER_16 test_batch.c cbuf.c -o test_batch_align
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_BLOB_INDEX -DCBUF_HEADER_VARINT -DCBUF_CRC test_batch.c cbuf.c -o test_batch_varint
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_MIRROR test_mirror.c cbuf.c -o test_mirror
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_MIRROR -DCBUF_ALLOW_PARTIAL -DCBUF_HEADER_16 test_mirror.c cbuf.c -o test_mirror16
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_HEADER_16 -DCBUF_ALIGN -DCBUF_STATS test_partial.c cbuf.c -o test_partial16
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_PERSIST -DCBUF_HEADER_VARINT test_persist.c cbuf.c -o test_persist_varint
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_PERSIST -DCBUF_CRC test_persist.c cbuf.c -o test_persist_crc
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_PERSIST -DCBUF_TIMESTAMP test_persist.c cbuf.c -o test_persist_ts
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALLOW_PARTIAL -DCBUF_PERSIST -DCBUF_READERS test_persist.c cbuf.c -o test_persist_readers
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_READERS -DCBUF_STATS test_readers.c cbuf.c -o test_readers
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_READERS -DCBUF_BLOB_INDEX -DCBUF_ALLOW_PARTIAL test_readers.c cbuf.c -o test_readers_index
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_SPILL -DCBUF_STATS test_spill.c cbuf.c -o test_spill
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_SPILL -DCBUF_BLOB_INDEX -DCBUF_HEADER_VARINT test_spill.c cbuf.c -o test_spill_index
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_SPILL -DCBUF_HEADER_16 test_spill.c cbuf.c -o test_spill16
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_SPILL -DCBUF_ALLOW_PARTIAL test_spill.c cbuf.c -o test_spill_partial
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_TIMESTAMP -DCBUF_ALLOW_PARTIAL -DCBUF_STATS test_timestamp.c cbuf.c -o test_timestamp
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_TIMESTAMP -DCBUF_BLOB_INDEX -DCBUF_HEADER_VARINT test_timestamp.c cbuf.c -o test_timestamp_index
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_POOL -DCBUF_STATS test_pool.c cbuf.c -o test_pool
+gcc -g -O2 -Werror -Wall -DCBUF_TEST -DCBUF_POOL -DCBUF_POW2 -DCBUF_HEADER_16 test_pool.c cbuf.c -o test_pool_pow2
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_CRC -DCBUF_ALLOW_PARTIAL -DCBUF_BLOB_INDEX test_crc.c cbuf.c -o test_crc
+gcc -g -O2 -msse4.2 -Werror -Wall -DCBUF_TEST -DCBUF_CRC -DCBUF_HEADER_VARINT -DCBUF_TIMESTAMP test_crc.c cbuf.c -o test_crc_sse
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_FD -DCBUF_ALLOW_PARTIAL test_fd.c cbuf.c -o test_fd
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_FD -DCBUF_SPSC -DCBUF_POW2 test_fd.c cbuf.c -o test_fd_spsc
+gcc -g -Werror -Wall -DCBUF_TEST -c cbuf.c -o cbuf_cpp.o && g++ -std=c++20 -g -Werror -Wall test_cpp.cpp cbuf_cpp.o -o test_cpp
+gcc -g -Werror -Wall -DCBUF_TEST -DCBUF_ALIGN -DCBUF_HEADER_16 -c cbuf.c -o cbuf_cpp16.o && g++ -std=c++20 -g -Werror -Wall -DCBUF_ALIGN -DCBUF_HEADER_16 test_cpp.cpp cbuf_cpp16.o -o test_cpp16
+
+gcc -O2 -Werror -Wall -DCBUF_POW2 -DCBUF_MIRROR bench.c cbuf.c -o bench
+gcc -O2 -Werror -Wall -DCBUF_ALLOW_PARTIAL bench.c cbuf.c -o bench_partial
+gcc -O2 -Werror -Wall -DCBUF_POW2 -DCBUF_HEADER_16 bench.c cbuf.c -o bench_header16
+gcc -O2 -Werror -Wall -DCBUF_POW2 -DCBUF_HEADER_VARINT bench.c cbuf.c -o bench_varint
+gcc -O2 -Werror -Wall -DCBUF_POW2 -DCBUF_BLOB_INDEX bench.c cbuf.c -o bench_index
+gcc -O2 -msse4.2 -Werror -Wall -DCBUF_POW2 -DCBUF_CRC bench.c cbuf.c -o bench_crc
+
+#Run every test program, showing its checks
+for t in test test_partial test_spsc test_persist test_mpsc test_varint test_align test_index test_batch test_batch_align \
+         test_batch_varint test_mirror test_mirror16 test_partial16 \
+         test_persist_varint test_persist_crc test_persist_ts test_persist_readers test_readers test_readers_index test_spill test_spill_index test_spill16 test_spill_partial \
+         test_timestamp test_timestamp_index test_pool test_pool_pow2 test_crc test_crc_sse test_fd test_fd_spsc \
+         test_cpp test_cpp16; do
+    echo "$t"
+    ./$t | grep -E "PASS|FAIL"
+done
+
+#"./build.sh bench" also runs the benchmarks and prints their results as CSV
+if [ "$1" == "bench" ]; then
+    ./bench && ./bench_partial | tail -n +2 && ./bench_header16 | tail -n +2 && ./bench_varint | tail -n +2 && ./bench_index | tail -n +2 && ./bench_crc | tail -n +2
+fi
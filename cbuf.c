@@ -1,419 +1,3841 @@
-#include <stdio.h>
-#include <string.h>
-#include <assert.h>
-
-#include "cbuf.h"
-
-/** Header structure placed in front of every blob */
-typedef struct
-{
-#if defined(CBUF_ALLOW_PARTIAL)
-    uint32_t len  : 31;     //Length of the blob
-    uint32_t open : 1;      //Set to 1 if this blob is currently open for sequential writes
-#else
-    uint32_t len;           //Length of the blob
-#endif
-    uint8_t data[];
-} cbuf_item_t;
-
-#if defined(CBUF_ALLOW_PARTIAL)
-#define CBUF_OPEN_FLAG  0x80000000u
-#endif
-
-/** Generalized write helper. Writes to the circular buffer at given index, and
- *  increments the index.
- */
-static void _generic_write(cbuf_t *cbuf, const void *src, uint32_t len, uint32_t *at)
-{
-    uint32_t wb = 0;             //Bytes read
-    uint8_t *s = (uint8_t*)src;  //Source pointer
-    while (wb < len)
-    {
-        cbuf->buf[*at] = *s;
-        s++;
-        *at = (*at + 1) % cbuf->len;
-        wb++;
-    }
-}
-
-/** Generalized read helper. Reads to the circular buffer at given index, and
- *  increments the index.
- */
-static void _generic_read(cbuf_t *cbuf, void* dst, uint32_t len, uint32_t *at)
-{
-    uint32_t rb = 0;             //Bytes read
-    uint8_t *d = (uint8_t*)dst;  //Destination pointer
-    while (rb < len)
-    {
-        if (d)
-        {
-            *d = cbuf->buf[*at];
-            d++;
-        }
-        *at = (*at + 1) % cbuf->len;
-        rb++;
-    }
-}
-
-/** Write data from src to the cbuf, accounting for wrap. This overwrites any data there
- *  so we have to check in advance that the room exists for the data
- *
- * Results in the write index being updated after the write
- */
-static void _write(cbuf_t *cbuf, const void *src, uint32_t len)
-{
-    _generic_write(cbuf, src, len, &cbuf->widx);
-}
-
-/** Read data from the cbuf to dst, account for wrap.
- *  Dst should be large enough to hold len bytes.
- *
- *  Results in the read index being updated after the read
- */
-static void _read(cbuf_t *cbuf, void* dst, uint32_t len)
-{
-    _generic_read(cbuf, dst, len, &cbuf->ridx);
-}
-
-/** Peek at data from the cbuf at a specific index, accounting for wrap
- *
- *  Does NOT update the read index.
- */
-static void _peek_at(cbuf_t *cbuf, void* dst, uint32_t len, uint32_t at)
-{
-    uint32_t pidx = at;
-    _generic_read(cbuf, dst, len, &pidx);
-}
-
-/** Peek at data from the cbuf to dst, account for wrap
- *  Begins read at the current read index
- *
- *  Does NOT update the read index.
- */
-static void _peek(cbuf_t *cbuf, void* dst, uint32_t len)
-{
-    uint32_t pidx = cbuf->ridx;
-    _peek_at(cbuf, dst, len, pidx);
-}
-
-
-#if defined(CBUF_ALLOW_PARTIAL)
-/** Overwrite data in the cbuf at a specific index, accounting for wrap
- *
- *  Does NOT update the write index.
- */
-static void _poke_at(cbuf_t *cbuf, const void* src, uint32_t len, uint32_t at)
-{
-    uint32_t pidx = at;
-    _generic_write(cbuf, src, len, &pidx);
-}
-#endif
-
-void cbuf_init(cbuf_t *cbuf, uint8_t *mem, uint32_t len)
-{
-    assert(cbuf != NULL);
-
-    cbuf->ridx  = 0;
-    cbuf->widx  = 0;
-    cbuf->count = 0;
-    cbuf->len   = len;
-    cbuf->buf   = mem;
-#if defined(CBUF_ALLOW_PARTIAL)
-    cbuf->open  = false;
-    cbuf->hidx  = 0;
-#endif
-}
-
-bool cbuf_write(cbuf_t *cbuf, const void *data, uint32_t data_len, bool allow_overwrite, uint32_t *count_overwrite)
-{
-    assert(cbuf != NULL);
-
-    //Count of data items overwritten during insertion
-    uint32_t overwrite = 0;
-
-    //Ensure we're not writing more than is possible
-    if ((sizeof(cbuf_item_t) + data_len) >= (cbuf->len - 1))
-    {
-        return false;
-    }
-
-    //Calculate whether writing this much data would cause an overwrite
-    bool would_overwrite = false;
-    uint32_t next_widx = (cbuf->widx + (sizeof(cbuf_item_t) + data_len)); //We will account for wrap later on
-    bool wrap = next_widx > cbuf->len; //True if we'd wrap around the buffer if we added this many to the index
-    do {
-        //These complicated logic statements are derived from listing every possible case and keeping those that result
-        //in no overwrite. I can't figure out a way to make them smaller.
-        if (    (!wrap && (cbuf->widx >= cbuf->ridx) && (next_widx > cbuf->ridx)) ||
-                (!wrap && (cbuf->widx < cbuf->ridx)  && (next_widx < cbuf->ridx)) ||
-                ( wrap && (cbuf->widx >= cbuf->ridx) && (next_widx <= (cbuf->ridx + cbuf->len)))
-           )
-        {
-            would_overwrite = false;
-        }
-        else
-        {
-            would_overwrite = true;
-            if (allow_overwrite)
-            {
-                //Dump the next read message off the queue and repeat the loop until there's no overwrite
-                if (cbuf_read(cbuf, NULL))
-                {
-                    overwrite++;
-                }
-                else
-                {
-                    //If tried to read and failed it's probably because a partial write has exceeded the buffer
-                    //size and the code won't overwrite the same open buffer being written
-                    return false;
-                }
-            }
-            else
-            {
-                //Not allowed to overwrite
-                return false;
-            }
-        }
-    } while (would_overwrite);
-
-#if defined(CBUF_ALLOW_PARTIAL)
-    //If we're open, update the length in the existing header
-    if (cbuf->open)
-    {
-        cbuf_item_t item;
-        _peek_at(cbuf, &item, sizeof(item), cbuf->hidx);
-        item.len += data_len;
-        _poke_at(cbuf, &item, sizeof(item), cbuf->hidx);
-    }
-    else
-#endif
-    {
-        //Write the new header
-        cbuf_item_t hdr = {0};
-        hdr.len = data_len;
-        _write(cbuf, &hdr, sizeof(cbuf_item_t));
-    }
-
-    //Write the body
-    _write(cbuf, data, data_len);
-
-#if defined(CBUF_ALLOW_PARTIAL)
-    //Don't increment the count if we're open already
-    if (!cbuf->open)
-#endif
-    {
-        //Increment the count
-        cbuf->count++;
-    }
-
-    //output
-    if (count_overwrite)
-    {
-        *count_overwrite = overwrite;
-    }
-
-    return true;
-}
-
-uint32_t cbuf_read(cbuf_t *cbuf, void *data)
-{
-    assert(cbuf != NULL);
-    uint32_t count = cbuf->count;
-    cbuf_item_t item;
-
-    //Check if empty
-    if ((count == 0) || (cbuf->ridx == cbuf->widx))
-    {
-        return count;
-    }
-
-    //Copy out the header
-    _read(cbuf, &item, sizeof(cbuf_item_t));
-
-    //Copy the output if there's a destination
-    //read() handles a NULL data internally
-    _read(cbuf, data, item.len);
-
-    //Decrement the count
-    cbuf->count--;
-
-    //Return the count of messages we had _before_ the read
-    return count;
-}
-
-uint32_t cbuf_peek(cbuf_t *cbuf, void *data, uint32_t *len)
-{
-    assert(cbuf != NULL);
-    assert(data != NULL);
-    assert(len  != NULL);
-    uint32_t count = cbuf->count;
-
-    //Check if empty
-    if ((count == 0) || (cbuf->ridx == cbuf->widx))
-    {
-        return count;
-    }
-
-    //Peek at the header
-    cbuf_item_t item;
-    _peek(cbuf, &item, sizeof(cbuf_item_t));
-
-    //Peek the requested data into the output buffer
-    uint32_t rlen = (*len < item.len) ? *len : item.len;
-    uint32_t pidx = (cbuf->ridx + sizeof(cbuf_item_t)) % cbuf->len;
-    _peek_at(cbuf, data, rlen, pidx);
-
-    *len = rlen;
-    return count;
-}
-
-uint32_t cbuf_peek_len(cbuf_t *cbuf, uint32_t *len)
-{
-    assert(cbuf != NULL);
-    uint32_t count = cbuf->count;
-
-    //Check if empty
-    if ((count == 0) || (cbuf->ridx == cbuf->widx))
-    {
-        return count;
-    }
-
-    //Peek at the header
-    cbuf_item_t item;
-    _peek(cbuf, &item, sizeof(cbuf_item_t));
-
-    if (len)
-    {
-        *len = item.len;
-    }
-
-    //Return the count of messages we have now
-    return count;
-}
-
-uint32_t cbuf_count(cbuf_t *cbuf)
-{
-    return cbuf->count;
-}
-
-#if defined(CBUF_ALLOW_PARTIAL)
-bool cbuf_open(cbuf_t *cbuf, bool allow_overwrite, uint32_t *count_overwrite)
-{
-    bool res = false;
-    if (!cbuf->open)
-    {
-        cbuf->hidx = cbuf->widx;
-
-        //Write the header
-        bool res = cbuf_write(cbuf, NULL, 0, allow_overwrite, count_overwrite);
-        if (res)
-        {
-            //Write succeeded. Mark the new header as "open"
-            cbuf_item_t item = {.open = 1, .len = 0};
-            _poke_at(cbuf, &item, sizeof(item), cbuf->hidx);
-
-            //Decrement the count (cbuf_write increases it)
-            //TODO: better way to do this
-            cbuf->count--;
-
-            //Now that the header is written, mark the blob as open
-            cbuf->open = true;
-        }
-        else
-        {
-            //Failed to write (likely because an overwrite would be required; close and return failure)
-            cbuf->open = false;
-        }
-    }
-
-    return res;
-}
-
-bool cbuf_close(cbuf_t *cbuf)
-{
-    if (cbuf->open)
-    {
-        //Clear the open flag from the header
-        cbuf_item_t item;
-        _peek_at(cbuf, &item, sizeof(item), cbuf->hidx);
-        item.open = 0;
-        _poke_at(cbuf, &item, sizeof(item), cbuf->hidx);
-        //Increment the count on the buffer and indicate closed
-        cbuf->count++;
-        cbuf->open = false;
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-#endif /* defined(CBUF_ALLOW_PARTIAL) */
-
-#if defined(CBUF_TEST)
-void cbuf_viz(cbuf_t *cbuf)
-{
-    assert(cbuf != NULL);
-    const uint32_t W = 120; //Width of characters to display
-    uint32_t widx = W * cbuf->widx / cbuf->len;
-    uint32_t ridx = W * cbuf->ridx / cbuf->len;
-    char v[W + 1];
-
-    //Draw the Write pointer
-    //printf("%*s%c%*s\n", widx, "", 'W', (cbuf->len - widx - 1), "");
-    printf("%*s%c (%d)\n", widx, "", 'W', cbuf->widx);
-
-    //Draw a horizontal line
-    memset(v, '-', W);
-    v[W] = '\0';
-
-    //Draw a represenation of the buffer contents on the horizontal line
-    //Make a copy of the cbuf struct so we can read it non-destructively
-    cbuf_t copy = *cbuf;
-    while (1)
-    {
-        if (copy.ridx == copy.widx) break;
-
-        //read out the data to get the start and end indices
-        cbuf_item_t item;
-        uint32_t item_idx = W * copy.ridx / copy.len;
-        _read(&copy, &item, sizeof(cbuf_item_t));
-
-#if defined(CBUF_ALLOW_PARTIAL)
-        if (item.open)
-        {
-            //Item is open and being written
-            uint32_t end_idx = W * copy.widx / copy.len;
-
-            //Draw the data on the line
-            for (uint32_t idx=item_idx; idx != end_idx; idx = (idx + 1) % W)
-            {
-                v[idx] = '*';
-            }
-            v[item_idx] = '|';
-
-            //Done reading if we're at the open blob
-            break;
-        }
-        else
-#endif
-        {
-            _read(&copy, NULL, item.len);
-            uint32_t end_idx = W * copy.ridx / copy.len;
-
-            //Draw the data on the line
-            for (uint32_t idx=item_idx; idx != end_idx; idx = (idx + 1) % W)
-            {
-                v[idx] = '=';
-            }
-            v[item_idx] = '|';
-        }
-
-        if (copy.ridx == cbuf->ridx) break;
-    }
-    printf("%s\n", v);
-
-    //Draw the read pointer
-    printf("%*s%c (%d)\n", ridx, "", 'R', cbuf->ridx);
-}
-#endif
+#if defined(CBUF_MIRROR)
+#define _GNU_SOURCE     //For memfd_create
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(CBUF_MIRROR) || defined(CBUF_PERSIST)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if (defined(CBUF_STATS) && defined(CBUF_ALLOW_PARTIAL)) || defined(CBUF_TIMESTAMP)
+#include <time.h>
+#endif
+
+#if defined(CBUF_PERSIST)
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(CBUF_FD)
+#include <errno.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(CBUF_CRC) && defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(CBUF_CRC) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#if defined(CBUF_SPILL)
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if defined(CBUF_WAIT)
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "cbuf.h"
+
+/** Header structure placed in front of every blob. With CBUF_HEADER_VARINT this is only the decoded
+ *  form; the buffer holds the varint encoding written by _hdr_encode.
+ */
+typedef struct
+{
+#if defined(CBUF_HEADER_16) && defined(CBUF_ALLOW_PARTIAL)
+    uint16_t len  : 15;     //Length of the blob
+    uint16_t open : 1;      //Set to 1 if this blob is currently open for sequential writes
+#elif defined(CBUF_HEADER_16)
+    uint16_t len;           //Length of the blob
+#elif defined(CBUF_ALLOW_PARTIAL)
+    uint32_t len  : 31;     //Length of the blob
+    uint32_t open : 1;      //Set to 1 if this blob is currently open for sequential writes
+#elif defined(CBUF_MPSC)
+    uint32_t len       : 31;    //Length of the blob
+    uint32_t committed : 1;     //Set to 1 once the writer has filled the blob
+#else
+    uint32_t len;           //Length of the blob
+#endif
+#if defined(CBUF_TIMESTAMP)
+    uint8_t ts[8];          //When the blob was completed: a uint64_t, stored unaligned
+#endif
+#if defined(CBUF_CRC)
+    uint8_t crc[4];         //CRC32C of the header bytes in front of it and the body: a uint32_t, stored unaligned
+#endif
+    uint8_t data[];
+} cbuf_item_t;
+
+#if defined(CBUF_ALLOW_PARTIAL)
+#define CBUF_OPEN_FLAG  0x80000000u
+#endif
+
+#if defined(CBUF_MPSC)
+#define CBUF_COMMITTED_FLAG 0x80000000u
+#define CBUF_MPSC_ALIGN     4u      //Blobs are padded to this, so headers never straddle the wrap
+#endif
+
+#if defined(CBUF_SPSC) && defined(CBUF_ALLOW_PARTIAL)
+#error "CBUF_SPSC does not support CBUF_ALLOW_PARTIAL"
+#endif
+
+#if defined(CBUF_HEADER_16) && defined(CBUF_HEADER_VARINT)
+#error "Only one of CBUF_HEADER_16 and CBUF_HEADER_VARINT can be defined"
+#endif
+
+#if defined(CBUF_TIMESTAMP)
+#define CBUF_TS_LEN         8u      //Bytes of the timestamp behind the length in each header
+#else
+#define CBUF_TS_LEN         0u
+#endif
+
+#if defined(CBUF_CRC)
+#define CBUF_CRC_LEN        4u      //Bytes of the CRC at the end of each header
+#else
+#define CBUF_CRC_LEN        0u
+#endif
+
+#if defined(CBUF_HEADER_VARINT)
+#define CBUF_VARINT_MAX     5u      //Bytes in the longest varint: 7 bits of the value per byte
+#define CBUF_HEADER_MAX     (CBUF_VARINT_MAX + CBUF_TS_LEN + CBUF_CRC_LEN)
+#else
+#define CBUF_HEADER_MAX     sizeof(cbuf_item_t)
+#endif
+
+#if defined(CBUF_ALIGN) && defined(CBUF_HEADER_VARINT)
+#error "CBUF_ALIGN does not support CBUF_HEADER_VARINT"
+#endif
+
+#if defined(CBUF_MPSC) && (defined(CBUF_HEADER_16) || defined(CBUF_HEADER_VARINT))
+#error "CBUF_MPSC does not support CBUF_HEADER_16 or CBUF_HEADER_VARINT"
+#endif
+
+#if defined(CBUF_MPSC) && (defined(CBUF_SPSC) || defined(CBUF_ALLOW_PARTIAL) || defined(CBUF_PERSIST) || defined(CBUF_STATS))
+#error "CBUF_MPSC does not support CBUF_SPSC, CBUF_ALLOW_PARTIAL, CBUF_PERSIST or CBUF_STATS"
+#endif
+
+#if defined(CBUF_SPILL) && defined(CBUF_ATOMIC)
+#error "CBUF_SPILL does not support CBUF_SPSC or CBUF_MPSC"
+#endif
+
+#if defined(CBUF_READERS) && defined(CBUF_ATOMIC)
+#error "CBUF_READERS does not support CBUF_SPSC or CBUF_MPSC"
+#endif
+
+#if defined(CBUF_POOL) && defined(CBUF_ATOMIC)
+#error "CBUF_POOL does not support CBUF_SPSC or CBUF_MPSC"
+#endif
+
+#if defined(CBUF_TIMESTAMP) && defined(CBUF_ATOMIC)
+#error "CBUF_TIMESTAMP does not support CBUF_SPSC or CBUF_MPSC"
+#endif
+
+#if defined(CBUF_CRC) && (defined(CBUF_ATOMIC) || defined(CBUF_READERS))
+#error "CBUF_CRC does not support CBUF_SPSC, CBUF_MPSC or CBUF_READERS"
+#endif
+
+#if defined(CBUF_FD) && defined(CBUF_MPSC)
+#error "CBUF_FD does not support CBUF_MPSC"
+#endif
+
+#if defined(CBUF_BLOB_INDEX) && defined(CBUF_ATOMIC)
+#error "CBUF_BLOB_INDEX does not support CBUF_SPSC or CBUF_MPSC"
+#endif
+
+#if defined(CBUF_WAIT) && !defined(CBUF_ATOMIC)
+#error "CBUF_WAIT needs CBUF_SPSC or CBUF_MPSC"
+#endif
+
+#if defined(CBUF_ATOMIC)
+//Indices shared between the writer and reader are published with release and observed with acquire.
+//Each side reads the index it owns with relaxed ordering.
+#define _load(obj)          atomic_load_explicit(&(obj), memory_order_acquire)
+#define _load_own(obj)      atomic_load_explicit(&(obj), memory_order_relaxed)
+#define _store(obj, val)    atomic_store_explicit(&(obj), (val), memory_order_release)
+#define _inc(obj)           atomic_fetch_add_explicit(&(obj), 1, memory_order_release)
+#define _dec(obj)           atomic_fetch_sub_explicit(&(obj), 1, memory_order_release)
+#define _add(obj, n)        atomic_fetch_add_explicit(&(obj), (n), memory_order_release)
+#else
+#define _load(obj)          (obj)
+#define _load_own(obj)      (obj)
+#define _store(obj, val)    ((obj) = (val))
+#define _inc(obj)           ((obj)++)
+#define _dec(obj)           ((obj)--)
+#define _add(obj, n)        ((obj) += (n))
+#endif
+
+#if defined(CBUF_STATS)
+//Statistics updates compile away entirely when CBUF_STATS is not defined
+#define _STAT(stmt)         do { stmt; } while (0)
+#else
+#define _STAT(stmt)         do { } while (0)
+#endif
+
+/** Wrap an index that has been advanced past the end of the buffer. The index may be at most
+ *  one buffer length past the end, which every caller guarantees since no blob may be larger
+ *  than the buffer itself.
+ */
+static inline uint32_t _wrap(const cbuf_t *cbuf, uint32_t idx)
+{
+#if defined(CBUF_POW2)
+    return idx & (cbuf->len - 1);
+#else
+    return (idx >= cbuf->len) ? (idx - cbuf->len) : idx;
+#endif
+}
+
+/** Split a transfer of len bytes starting at index at into the contiguous segment up to the
+ *  wrap point and the remainder from the start of the buffer.
+ *  Returns the length of the first segment; the second is len minus that.
+ *  With a mirrored buffer there is never a second segment.
+ */
+static inline uint32_t _first_segment(const cbuf_t *cbuf, uint32_t len, uint32_t at)
+{
+#if defined(CBUF_MIRROR)
+    //The mapping repeats right after the end, so the whole transfer is one segment
+    if (cbuf->mirror)
+    {
+        return len;
+    }
+#endif
+    uint32_t room = cbuf->len - at;     //Bytes before the wrap point
+    return (len < room) ? len : room;
+}
+
+/** Generalized write helper. Writes to the circular buffer at given index, and
+ *  increments the index.
+ */
+static void _generic_write(cbuf_t *cbuf, const void *src, uint32_t len, uint32_t *at)
+{
+    const uint8_t *s = (const uint8_t*)src;  //Source pointer
+    uint32_t first = _first_segment(cbuf, len, *at);
+
+    //At most two bulk copies: up to the wrap point, then from the start of the buffer
+    if (first)
+    {
+        memcpy(&cbuf->buf[*at], s, first);
+    }
+    if (len - first)
+    {
+        memcpy(cbuf->buf, s + first, len - first);
+    }
+    *at = _wrap(cbuf, *at + len);
+}
+
+/** Generalized read helper. Reads to the circular buffer at given index, and
+ *  increments the index.
+ */
+static void _generic_read(cbuf_t *cbuf, void* dst, uint32_t len, uint32_t *at)
+{
+    uint8_t *d = (uint8_t*)dst;  //Destination pointer
+    if (d)
+    {
+        uint32_t first = _first_segment(cbuf, len, *at);
+
+        //At most two bulk copies: up to the wrap point, then from the start of the buffer
+        if (first)
+        {
+            memcpy(d, &cbuf->buf[*at], first);
+        }
+        if (len - first)
+        {
+            memcpy(d + first, cbuf->buf, len - first);
+        }
+    }
+    *at = _wrap(cbuf, *at + len);
+}
+
+/** Peek at data from the cbuf at a specific index, accounting for wrap
+ *
+ *  Does NOT update the read index.
+ */
+static void _peek_at(cbuf_t *cbuf, void* dst, uint32_t len, uint32_t at)
+{
+    uint32_t pidx = at;
+    _generic_read(cbuf, dst, len, &pidx);
+}
+
+#if defined(CBUF_HEADER_VARINT)
+/** The value a varint header encodes: the length, with the open flag in the low bit under
+ *  CBUF_ALLOW_PARTIAL so that short blobs still fit in one byte
+ */
+static inline uint32_t _hdr_value(const cbuf_item_t *item)
+{
+#if defined(CBUF_ALLOW_PARTIAL)
+    return ((uint32_t)item->len << 1) | item->open;
+#else
+    return item->len;
+#endif
+}
+#endif
+
+/** Bytes in the header of a closed blob with a body of len bytes */
+static inline uint32_t _hdr_size(uint32_t len)
+{
+#if defined(CBUF_HEADER_VARINT)
+    cbuf_item_t item = {0};
+    item.len = len;
+    uint32_t v = _hdr_value(&item);
+    uint32_t size = 1 + CBUF_TS_LEN + CBUF_CRC_LEN;
+    while (v >= 0x80)
+    {
+        v >>= 7;
+        size++;
+    }
+    return size;
+#else
+    (void)len;
+    return sizeof(cbuf_item_t);
+#endif
+}
+
+/** Encode a header into size bytes at dst. size is at least _hdr_size(item->len); a varint is
+ *  padded out to it with empty continuation bytes.
+ */
+static inline void _hdr_encode(uint8_t *dst, const cbuf_item_t *item, uint32_t size)
+{
+#if defined(CBUF_HEADER_VARINT)
+    uint32_t v = _hdr_value(item);
+    size -= CBUF_TS_LEN + CBUF_CRC_LEN;
+    for (uint32_t i = 0; i < size - 1; i++)
+    {
+        dst[i] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    dst[size - 1] = (uint8_t)v;
+#if defined(CBUF_TIMESTAMP)
+    memcpy(&dst[size], item->ts, CBUF_TS_LEN);
+#endif
+#if defined(CBUF_CRC)
+    memcpy(&dst[size + CBUF_TS_LEN], item->crc, CBUF_CRC_LEN);
+#endif
+#else
+    (void)size;
+    memcpy(dst, item, sizeof(cbuf_item_t));
+#endif
+}
+
+/** Write a header of size bytes to the circular buffer at given index, and increments the index */
+static inline void _hdr_write(cbuf_t *cbuf, const cbuf_item_t *item, uint32_t size, uint32_t *at)
+{
+    uint8_t enc[CBUF_HEADER_MAX];
+    _hdr_encode(enc, item, size);
+    _generic_write(cbuf, enc, size, at);
+}
+
+/** Read the header at given index from the circular buffer, and increments the index past it.
+ *  Returns the size of the header, in bytes.
+ */
+static uint32_t _hdr_read(cbuf_t *cbuf, cbuf_item_t *item, uint32_t *at)
+{
+#if defined(CBUF_HEADER_VARINT)
+    //Decode a byte at a time so the header can straddle the wrap point. A corrupt header stops at
+    //the longest valid length rather than running on.
+    uint32_t v = 0;
+    uint32_t size = 0;
+    uint8_t b;
+    do {
+        b = cbuf->buf[*at];
+        *at = _wrap(cbuf, *at + 1);
+        v |= (uint32_t)(b & 0x7F) << (7 * size);
+        size++;
+    } while ((b & 0x80) && (size < CBUF_VARINT_MAX));
+
+    *item = (cbuf_item_t){0};
+#if defined(CBUF_ALLOW_PARTIAL)
+    item->len  = v >> 1;
+    item->open = v & 1;
+#else
+    item->len  = v;
+#endif
+#if defined(CBUF_TIMESTAMP)
+    _generic_read(cbuf, item->ts, CBUF_TS_LEN, at);
+#endif
+#if defined(CBUF_CRC)
+    _generic_read(cbuf, item->crc, CBUF_CRC_LEN, at);
+#endif
+    return size + CBUF_TS_LEN + CBUF_CRC_LEN;
+#else
+    _generic_read(cbuf, item, sizeof(cbuf_item_t), at);
+    return sizeof(cbuf_item_t);
+#endif
+}
+
+/** Check whether the head of the buffer has moved away from index at since the caller started
+ *  reading the blob there. With CBUF_SPSC the writer may evict that blob and reuse its space at
+ *  any time, so anything copied out of it must be discarded if this returns true.
+ */
+static inline bool _head_moved(cbuf_t *cbuf, uint32_t at)
+{
+#if defined(CBUF_SPSC)
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&cbuf->ridx, memory_order_relaxed) != at;
+#else
+    (void)cbuf;
+    (void)at;
+    return false;
+#endif
+}
+
+/** Alignment of blob bodies in buffer memory. Headers sit right in front of their body. */
+static inline uint32_t _align(const cbuf_t *cbuf)
+{
+#if defined(CBUF_ALIGN)
+    return cbuf->align;
+#elif defined(CBUF_MPSC)
+    (void)cbuf;
+    return CBUF_MPSC_ALIGN;
+#else
+    (void)cbuf;
+    return 1;
+#endif
+}
+
+/** Index of the first header in an empty buffer, such that the body behind it is aligned */
+static inline uint32_t _origin(const cbuf_t *cbuf)
+{
+    return (0u - (uint32_t)sizeof(cbuf_item_t)) & (_align(cbuf) - 1);
+}
+
+/** Bytes of padding that follow a blob body of len bytes, so that the next body is aligned too */
+static inline uint32_t _pad(const cbuf_t *cbuf, uint32_t len)
+{
+    return (0u - (len + (uint32_t)sizeof(cbuf_item_t))) & (_align(cbuf) - 1);
+}
+
+/** Bytes a blob with a body of len bytes takes up in the buffer, header and padding included */
+static inline uint32_t _blob_size(const cbuf_t *cbuf, uint32_t len)
+{
+    return _hdr_size(len) + len + _pad(cbuf, len);
+}
+
+/** Check whether the blob whose header is at index at is complete and can be read. With
+ *  CBUF_MPSC a writer may have claimed the space but not committed it yet.
+ */
+static inline bool _ready(cbuf_t *cbuf, uint32_t at)
+{
+#if defined(CBUF_MPSC)
+    return atomic_load_explicit((_Atomic uint32_t*)&cbuf->buf[at], memory_order_acquire) & CBUF_COMMITTED_FLAG;
+#else
+    (void)cbuf;
+    (void)at;
+    return true;
+#endif
+}
+
+#if defined(CBUF_WAIT)
+/** Wake every thread sleeping on the futex at addr */
+static void _futex_wake(_Atomic uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/** Sleep while the futex at addr still holds val, until woken or until the CLOCK_MONOTONIC
+ *  deadline passes. A NULL deadline waits forever.
+ */
+static void _futex_wait(_Atomic uint32_t *addr, uint32_t val, const struct timespec *deadline)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_BITSET, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+#endif
+
+/** Wake anything waiting for the buffer to become readable, now that blobs have been published.
+ *  was_empty is whether the count was zero before they were counted; nothing can be waiting
+ *  otherwise, so there is nothing to do.
+ */
+static inline void _signal_readable(cbuf_t *cbuf, bool was_empty)
+{
+#if defined(CBUF_WAIT)
+    if (was_empty)
+    {
+        //Pairs with the fence in cbuf_wait_readable: either it sees the count, or we see it waiting
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&cbuf->rwait, memory_order_relaxed))
+        {
+            _futex_wake(&cbuf->count);
+        }
+        if (cbuf->efd >= 0)
+        {
+            uint64_t one = 1;
+            (void)!write(cbuf->efd, &one, sizeof(one));
+        }
+    }
+#else
+    (void)cbuf;
+    (void)was_empty;
+#endif
+}
+
+/** Wake any writer waiting for space, now that the head has moved */
+static inline void _signal_writable(cbuf_t *cbuf)
+{
+#if defined(CBUF_WAIT)
+    //Pairs with the fence in cbuf_wait_writable: either it sees the head, or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&cbuf->wwait, memory_order_relaxed))
+    {
+        _futex_wake(&cbuf->ridx);
+    }
+#else
+    (void)cbuf;
+#endif
+}
+
+#if defined(CBUF_BLOB_INDEX)
+/** Slot of the offset index that holds the nth queued blob, for n up to the number of slots */
+static inline uint32_t _slot(const cbuf_t *cbuf, uint32_t n)
+{
+    uint32_t slot = cbuf->ohead + n;
+    return (slot >= cbuf->slots) ? (slot - cbuf->slots) : slot;
+}
+
+/** Index of the header of the nth queued blob. n may be the count, which gives the index the next
+ *  completed blob will start at: that of the open blob, or otherwise the write index.
+ */
+static inline uint32_t _offset(const cbuf_t *cbuf, uint32_t n)
+{
+    if (n < cbuf->count)
+    {
+        return cbuf->offsets[_slot(cbuf, n)];
+    }
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        return cbuf->hidx;
+    }
+#endif
+    return cbuf->widx;
+}
+#endif
+
+#if defined(CBUF_BLOB_INDEX) && defined(CBUF_STATS)
+/** Payload bytes of the n oldest blobs. The index doesn't hold lengths, so this walks their
+ *  headers; only the statistics need it.
+ */
+static uint64_t _index_bytes(cbuf_t *cbuf, uint32_t n)
+{
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        cbuf_item_t item;
+        uint32_t idx = _offset(cbuf, i);
+        _hdr_read(cbuf, &item, &idx);
+        bytes += item.len;
+    }
+    return bytes;
+}
+#endif
+
+/** Record in the offset index that the nth blob after the counted ones starts at index at.
+ *  Completed blobs are recorded before they are counted.
+ */
+static inline void _index_set(cbuf_t *cbuf, uint32_t n, uint32_t at)
+{
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets)
+    {
+        cbuf->offsets[_slot(cbuf, cbuf->count + n)] = at;
+    }
+#else
+    (void)cbuf;
+    (void)n;
+    (void)at;
+#endif
+}
+
+#if defined(CBUF_READERS)
+/** Account for the n oldest blobs leaving the buffer. Readers that were past them keep their place;
+ *  readers that hadn't read them all lose the rest and move up to the new head.
+ */
+static void _release_readers(cbuf_t *cbuf, uint32_t n)
+{
+    for (uint32_t i = 0; i < cbuf->nreaders; i++)
+    {
+        cbuf_reader_t *r = &cbuf->readers[i];
+        if (r->ahead >= n)
+        {
+            r->ahead -= n;
+        }
+        else
+        {
+            r->lost += n - r->ahead;
+            r->ahead = 0;
+        }
+    }
+}
+#endif
+
+/** Move the head of the buffer from index from to index to, removing the n blobs in between.
+ *
+ *  Returns false, removing nothing, if the head moved away from from in the meantime.
+ */
+static bool _advance(cbuf_t *cbuf, uint32_t from, uint32_t to, uint32_t n)
+{
+#if defined(CBUF_MPSC)
+    //Writers rely on unclaimed space reading as zero, so that a header they haven't written yet
+    //never looks committed. Clear it before handing it back.
+    uint32_t len = (to >= from) ? (to - from) : (cbuf->len - from + to);
+    uint32_t first = _first_segment(cbuf, len, from);
+    memset(&cbuf->buf[from], 0, first);
+    memset(cbuf->buf, 0, len - first);
+#endif
+#if defined(CBUF_ATOMIC)
+    if (!atomic_compare_exchange_strong_explicit(&cbuf->ridx, &from, to, memory_order_acq_rel, memory_order_relaxed))
+    {
+        return false;
+    }
+    //Order the head update before any reuse of the space by the writer (which may be us),
+    //so a concurrent reader of the old head sees it move before the data changes
+    atomic_thread_fence(memory_order_release);
+    atomic_fetch_sub_explicit(&cbuf->count, n, memory_order_release);
+    _signal_writable(cbuf);
+#else
+    (void)from;
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets)
+    {
+        cbuf->ohead = _slot(cbuf, n);
+    }
+#endif
+    cbuf->ridx = to;
+    cbuf->count -= n;
+#if defined(CBUF_CRC)
+    cbuf->checked = false;
+#endif
+#if defined(CBUF_READERS)
+    _release_readers(cbuf, n);
+#endif
+#endif
+#if defined(CBUF_FD)
+    //Whatever cbuf_write_to_fd sent part of is gone, even if a new blob later starts at its index
+    if (n)
+    {
+        _store(cbuf->sent, 0);
+    }
+#endif
+    return true;
+}
+
+/** Remove the blob at index at from the head of the buffer, copying its body to dst if dst is
+ *  not NULL. The length of the blob is returned in *len.
+ *
+ *  Returns false, removing nothing, if the head moved away from at in the meantime. The
+ *  contents of dst are then undefined.
+ */
+static bool _take(cbuf_t *cbuf, void *dst, uint32_t at, uint32_t *len)
+{
+    uint32_t idx = at;
+    cbuf_item_t item;
+
+    //Copy out the header, and make sure it wasn't evicted while we did so before trusting it
+    _hdr_read(cbuf, &item, &idx);
+    if (_head_moved(cbuf, at))
+    {
+        return false;
+    }
+
+    //Copy the output if there's a destination
+    //_generic_read() handles a NULL dst internally
+    _generic_read(cbuf, dst, item.len, &idx);
+    idx = _wrap(cbuf, idx + _pad(cbuf, item.len));
+    *len = item.len;
+
+    //Publish the new head. If the writer evicted this blob while we were copying it, it already
+    //moved the head and the copy may be torn.
+    return _advance(cbuf, at, idx, 1);
+}
+
+#if (defined(CBUF_STATS) && defined(CBUF_ALLOW_PARTIAL)) || defined(CBUF_TIMESTAMP)
+static uint64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#if defined(CBUF_TIMESTAMP)
+/** Current time from the buffer's clock, re-based so it doesn't fall behind the newest blob */
+static inline uint64_t _clock_ns(cbuf_t *cbuf)
+{
+    return (cbuf->clock ? cbuf->clock() : _now_ns()) + cbuf->epoch;
+}
+#endif
+
+/** Stamp a header with the current time from the buffer's clock, as its blob is completed */
+static inline void _stamp(cbuf_t *cbuf, cbuf_item_t *item)
+{
+#if defined(CBUF_TIMESTAMP)
+    uint64_t ts = _clock_ns(cbuf);
+    memcpy(item->ts, &ts, sizeof(ts));
+#else
+    (void)cbuf;
+    (void)item;
+#endif
+}
+
+#if defined(CBUF_TIMESTAMP)
+/** Timestamp of the blob whose header is at index at */
+static inline uint64_t _ts_at(cbuf_t *cbuf, uint32_t at)
+{
+    cbuf_item_t item;
+    uint64_t ts;
+    _hdr_read(cbuf, &item, &at);
+    memcpy(&ts, item.ts, sizeof(ts));
+    return ts;
+}
+
+/** Count the oldest blobs stamped before t, and return in *at the index of the header of the first
+ *  one that isn't, or where the next blob will start if there is none. Timestamps never decrease
+ *  from the oldest blob to the newest, so with an offset index this is a binary search. Otherwise
+ *  it walks the headers, without touching the bodies.
+ */
+static uint32_t _ts_rank(cbuf_t *cbuf, uint64_t t, uint32_t *at)
+{
+    uint32_t count = cbuf->count;
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets)
+    {
+        uint32_t lo = 0;
+        uint32_t hi = count;
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (_ts_at(cbuf, _offset(cbuf, mid)) < t)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        *at = _offset(cbuf, lo);
+        return lo;
+    }
+#endif
+
+    uint32_t idx = cbuf->ridx;
+    uint32_t n;
+    for (n = 0; (n < count) && (_ts_at(cbuf, idx) < t); n++)
+    {
+        cbuf_item_t item;
+        _hdr_read(cbuf, &item, &idx);
+        idx = _wrap(cbuf, idx + item.len + _pad(cbuf, item.len));
+    }
+    *at = idx;
+    return n;
+}
+
+/** Pick the epoch so that the clock, as it reads now, doesn't stamp behind the newest blob. Needed
+ *  whenever the clock changes under blobs that are already stamped: a new clock function, or a file
+ *  reopened after a reboot, when the monotonic clock has started again from zero.
+ */
+static void _rebase(cbuf_t *cbuf)
+{
+    uint64_t newest = 0;
+    uint32_t count = cbuf->count;
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets && count)
+    {
+        newest = _ts_at(cbuf, _offset(cbuf, count - 1));
+        count = 0;
+    }
+#endif
+    uint32_t idx = cbuf->ridx;
+    for (uint32_t n = 0; n < count; n++)
+    {
+        cbuf_item_t item;
+        _hdr_read(cbuf, &item, &idx);
+        memcpy(&newest, item.ts, sizeof(newest));
+        idx = _wrap(cbuf, idx + item.len + _pad(cbuf, item.len));
+    }
+
+    cbuf->epoch = 0;
+    uint64_t now = _clock_ns(cbuf);
+    cbuf->epoch = (newest > now) ? newest - now : 0;
+}
+#endif
+
+#if defined(CBUF_CRC)
+#if !(defined(__SSE4_2__) && defined(__x86_64__)) && !defined(__ARM_FEATURE_CRC32)
+//Slicing-by-8 tables for the reflected CRC32C polynomial: _crc_table[k][b] is the CRC of byte b
+//followed by k zero bytes. Built at compile time, so threads never race to fill them. _crc_table[0][b]
+//is b shifted out 8 times, xoring in 0x82F63B78 after each 1 bit; _crc_table[k][b] for k > 0 is
+//(_crc_table[k - 1][b] >> 8) ^ _crc_table[0][_crc_table[k - 1][b] & 0xFF].
+static const uint32_t _crc_table[8][256] = {
+    {
+        0x00000000u, 0xF26B8303u, 0xE13B70F7u, 0x1350F3F4u, 0xC79A971Fu, 0x35F1141Cu, 0x26A1E7E8u, 0xD4CA64EBu,
+        0x8AD958CFu, 0x78B2DBCCu, 0x6BE22838u, 0x9989AB3Bu, 0x4D43CFD0u, 0xBF284CD3u, 0xAC78BF27u, 0x5E133C24u,
+        0x105EC76Fu, 0xE235446Cu, 0xF165B798u, 0x030E349Bu, 0xD7C45070u, 0x25AFD373u, 0x36FF2087u, 0xC494A384u,
+        0x9A879FA0u, 0x68EC1CA3u, 0x7BBCEF57u, 0x89D76C54u, 0x5D1D08BFu, 0xAF768BBCu, 0xBC267848u, 0x4E4DFB4Bu,
+        0x20BD8EDEu, 0xD2D60DDDu, 0xC186FE29u, 0x33ED7D2Au, 0xE72719C1u, 0x154C9AC2u, 0x061C6936u, 0xF477EA35u,
+        0xAA64D611u, 0x580F5512u, 0x4B5FA6E6u, 0xB93425E5u, 0x6DFE410Eu, 0x9F95C20Du, 0x8CC531F9u, 0x7EAEB2FAu,
+        0x30E349B1u, 0xC288CAB2u, 0xD1D83946u, 0x23B3BA45u, 0xF779DEAEu, 0x05125DADu, 0x1642AE59u, 0xE4292D5Au,
+        0xBA3A117Eu, 0x4851927Du, 0x5B016189u, 0xA96AE28Au, 0x7DA08661u, 0x8FCB0562u, 0x9C9BF696u, 0x6EF07595u,
+        0x417B1DBCu, 0xB3109EBFu, 0xA0406D4Bu, 0x522BEE48u, 0x86E18AA3u, 0x748A09A0u, 0x67DAFA54u, 0x95B17957u,
+        0xCBA24573u, 0x39C9C670u, 0x2A993584u, 0xD8F2B687u, 0x0C38D26Cu, 0xFE53516Fu, 0xED03A29Bu, 0x1F682198u,
+        0x5125DAD3u, 0xA34E59D0u, 0xB01EAA24u, 0x42752927u, 0x96BF4DCCu, 0x64D4CECFu, 0x77843D3Bu, 0x85EFBE38u,
+        0xDBFC821Cu, 0x2997011Fu, 0x3AC7F2EBu, 0xC8AC71E8u, 0x1C661503u, 0xEE0D9600u, 0xFD5D65F4u, 0x0F36E6F7u,
+        0x61C69362u, 0x93AD1061u, 0x80FDE395u, 0x72966096u, 0xA65C047Du, 0x5437877Eu, 0x4767748Au, 0xB50CF789u,
+        0xEB1FCBADu, 0x197448AEu, 0x0A24BB5Au, 0xF84F3859u, 0x2C855CB2u, 0xDEEEDFB1u, 0xCDBE2C45u, 0x3FD5AF46u,
+        0x7198540Du, 0x83F3D70Eu, 0x90A324FAu, 0x62C8A7F9u, 0xB602C312u, 0x44694011u, 0x5739B3E5u, 0xA55230E6u,
+        0xFB410CC2u, 0x092A8FC1u, 0x1A7A7C35u, 0xE811FF36u, 0x3CDB9BDDu, 0xCEB018DEu, 0xDDE0EB2Au, 0x2F8B6829u,
+        0x82F63B78u, 0x709DB87Bu, 0x63CD4B8Fu, 0x91A6C88Cu, 0x456CAC67u, 0xB7072F64u, 0xA457DC90u, 0x563C5F93u,
+        0x082F63B7u, 0xFA44E0B4u, 0xE9141340u, 0x1B7F9043u, 0xCFB5F4A8u, 0x3DDE77ABu, 0x2E8E845Fu, 0xDCE5075Cu,
+        0x92A8FC17u, 0x60C37F14u, 0x73938CE0u, 0x81F80FE3u, 0x55326B08u, 0xA759E80Bu, 0xB4091BFFu, 0x466298FCu,
+        0x1871A4D8u, 0xEA1A27DBu, 0xF94AD42Fu, 0x0B21572Cu, 0xDFEB33C7u, 0x2D80B0C4u, 0x3ED04330u, 0xCCBBC033u,
+        0xA24BB5A6u, 0x502036A5u, 0x4370C551u, 0xB11B4652u, 0x65D122B9u, 0x97BAA1BAu, 0x84EA524Eu, 0x7681D14Du,
+        0x2892ED69u, 0xDAF96E6Au, 0xC9A99D9Eu, 0x3BC21E9Du, 0xEF087A76u, 0x1D63F975u, 0x0E330A81u, 0xFC588982u,
+        0xB21572C9u, 0x407EF1CAu, 0x532E023Eu, 0xA145813Du, 0x758FE5D6u, 0x87E466D5u, 0x94B49521u, 0x66DF1622u,
+        0x38CC2A06u, 0xCAA7A905u, 0xD9F75AF1u, 0x2B9CD9F2u, 0xFF56BD19u, 0x0D3D3E1Au, 0x1E6DCDEEu, 0xEC064EEDu,
+        0xC38D26C4u, 0x31E6A5C7u, 0x22B65633u, 0xD0DDD530u, 0x0417B1DBu, 0xF67C32D8u, 0xE52CC12Cu, 0x1747422Fu,
+        0x49547E0Bu, 0xBB3FFD08u, 0xA86F0EFCu, 0x5A048DFFu, 0x8ECEE914u, 0x7CA56A17u, 0x6FF599E3u, 0x9D9E1AE0u,
+        0xD3D3E1ABu, 0x21B862A8u, 0x32E8915Cu, 0xC083125Fu, 0x144976B4u, 0xE622F5B7u, 0xF5720643u, 0x07198540u,
+        0x590AB964u, 0xAB613A67u, 0xB831C993u, 0x4A5A4A90u, 0x9E902E7Bu, 0x6CFBAD78u, 0x7FAB5E8Cu, 0x8DC0DD8Fu,
+        0xE330A81Au, 0x115B2B19u, 0x020BD8EDu, 0xF0605BEEu, 0x24AA3F05u, 0xD6C1BC06u, 0xC5914FF2u, 0x37FACCF1u,
+        0x69E9F0D5u, 0x9B8273D6u, 0x88D28022u, 0x7AB90321u, 0xAE7367CAu, 0x5C18E4C9u, 0x4F48173Du, 0xBD23943Eu,
+        0xF36E6F75u, 0x0105EC76u, 0x12551F82u, 0xE03E9C81u, 0x34F4F86Au, 0xC69F7B69u, 0xD5CF889Du, 0x27A40B9Eu,
+        0x79B737BAu, 0x8BDCB4B9u, 0x988C474Du, 0x6AE7C44Eu, 0xBE2DA0A5u, 0x4C4623A6u, 0x5F16D052u, 0xAD7D5351u
+    },
+    {
+        0x00000000u, 0x13A29877u, 0x274530EEu, 0x34E7A899u, 0x4E8A61DCu, 0x5D28F9ABu, 0x69CF5132u, 0x7A6DC945u,
+        0x9D14C3B8u, 0x8EB65BCFu, 0xBA51F356u, 0xA9F36B21u, 0xD39EA264u, 0xC03C3A13u, 0xF4DB928Au, 0xE7790AFDu,
+        0x3FC5F181u, 0x2C6769F6u, 0x1880C16Fu, 0x0B225918u, 0x714F905Du, 0x62ED082Au, 0x560AA0B3u, 0x45A838C4u,
+        0xA2D13239u, 0xB173AA4Eu, 0x859402D7u, 0x96369AA0u, 0xEC5B53E5u, 0xFFF9CB92u, 0xCB1E630Bu, 0xD8BCFB7Cu,
+        0x7F8BE302u, 0x6C297B75u, 0x58CED3ECu, 0x4B6C4B9Bu, 0x310182DEu, 0x22A31AA9u, 0x1644B230u, 0x05E62A47u,
+        0xE29F20BAu, 0xF13DB8CDu, 0xC5DA1054u, 0xD6788823u, 0xAC154166u, 0xBFB7D911u, 0x8B507188u, 0x98F2E9FFu,
+        0x404E1283u, 0x53EC8AF4u, 0x670B226Du, 0x74A9BA1Au, 0x0EC4735Fu, 0x1D66EB28u, 0x298143B1u, 0x3A23DBC6u,
+        0xDD5AD13Bu, 0xCEF8494Cu, 0xFA1FE1D5u, 0xE9BD79A2u, 0x93D0B0E7u, 0x80722890u, 0xB4958009u, 0xA737187Eu,
+        0xFF17C604u, 0xECB55E73u, 0xD852F6EAu, 0xCBF06E9Du, 0xB19DA7D8u, 0xA23F3FAFu, 0x96D89736u, 0x857A0F41u,
+        0x620305BCu, 0x71A19DCBu, 0x45463552u, 0x56E4AD25u, 0x2C896460u, 0x3F2BFC17u, 0x0BCC548Eu, 0x186ECCF9u,
+        0xC0D23785u, 0xD370AFF2u, 0xE797076Bu, 0xF4359F1Cu, 0x8E585659u, 0x9DFACE2Eu, 0xA91D66B7u, 0xBABFFEC0u,
+        0x5DC6F43Du, 0x4E646C4Au, 0x7A83C4D3u, 0x69215CA4u, 0x134C95E1u, 0x00EE0D96u, 0x3409A50Fu, 0x27AB3D78u,
+        0x809C2506u, 0x933EBD71u, 0xA7D915E8u, 0xB47B8D9Fu, 0xCE1644DAu, 0xDDB4DCADu, 0xE9537434u, 0xFAF1EC43u,
+        0x1D88E6BEu, 0x0E2A7EC9u, 0x3ACDD650u, 0x296F4E27u, 0x53028762u, 0x40A01F15u, 0x7447B78Cu, 0x67E52FFBu,
+        0xBF59D487u, 0xACFB4CF0u, 0x981CE469u, 0x8BBE7C1Eu, 0xF1D3B55Bu, 0xE2712D2Cu, 0xD69685B5u, 0xC5341DC2u,
+        0x224D173Fu, 0x31EF8F48u, 0x050827D1u, 0x16AABFA6u, 0x6CC776E3u, 0x7F65EE94u, 0x4B82460Du, 0x5820DE7Au,
+        0xFBC3FAF9u, 0xE861628Eu, 0xDC86CA17u, 0xCF245260u, 0xB5499B25u, 0xA6EB0352u, 0x920CABCBu, 0x81AE33BCu,
+        0x66D73941u, 0x7575A136u, 0x419209AFu, 0x523091D8u, 0x285D589Du, 0x3BFFC0EAu, 0x0F186873u, 0x1CBAF004u,
+        0xC4060B78u, 0xD7A4930Fu, 0xE3433B96u, 0xF0E1A3E1u, 0x8A8C6AA4u, 0x992EF2D3u, 0xADC95A4Au, 0xBE6BC23Du,
+        0x5912C8C0u, 0x4AB050B7u, 0x7E57F82Eu, 0x6DF56059u, 0x1798A91Cu, 0x043A316Bu, 0x30DD99F2u, 0x237F0185u,
+        0x844819FBu, 0x97EA818Cu, 0xA30D2915u, 0xB0AFB162u, 0xCAC27827u, 0xD960E050u, 0xED8748C9u, 0xFE25D0BEu,
+        0x195CDA43u, 0x0AFE4234u, 0x3E19EAADu, 0x2DBB72DAu, 0x57D6BB9Fu, 0x447423E8u, 0x70938B71u, 0x63311306u,
+        0xBB8DE87Au, 0xA82F700Du, 0x9CC8D894u, 0x8F6A40E3u, 0xF50789A6u, 0xE6A511D1u, 0xD242B948u, 0xC1E0213Fu,
+        0x26992BC2u, 0x353BB3B5u, 0x01DC1B2Cu, 0x127E835Bu, 0x68134A1Eu, 0x7BB1D269u, 0x4F567AF0u, 0x5CF4E287u,
+        0x04D43CFDu, 0x1776A48Au, 0x23910C13u, 0x30339464u, 0x4A5E5D21u, 0x59FCC556u, 0x6D1B6DCFu, 0x7EB9F5B8u,
+        0x99C0FF45u, 0x8A626732u, 0xBE85CFABu, 0xAD2757DCu, 0xD74A9E99u, 0xC4E806EEu, 0xF00FAE77u, 0xE3AD3600u,
+        0x3B11CD7Cu, 0x28B3550Bu, 0x1C54FD92u, 0x0FF665E5u, 0x759BACA0u, 0x663934D7u, 0x52DE9C4Eu, 0x417C0439u,
+        0xA6050EC4u, 0xB5A796B3u, 0x81403E2Au, 0x92E2A65Du, 0xE88F6F18u, 0xFB2DF76Fu, 0xCFCA5FF6u, 0xDC68C781u,
+        0x7B5FDFFFu, 0x68FD4788u, 0x5C1AEF11u, 0x4FB87766u, 0x35D5BE23u, 0x26772654u, 0x12908ECDu, 0x013216BAu,
+        0xE64B1C47u, 0xF5E98430u, 0xC10E2CA9u, 0xD2ACB4DEu, 0xA8C17D9Bu, 0xBB63E5ECu, 0x8F844D75u, 0x9C26D502u,
+        0x449A2E7Eu, 0x5738B609u, 0x63DF1E90u, 0x707D86E7u, 0x0A104FA2u, 0x19B2D7D5u, 0x2D557F4Cu, 0x3EF7E73Bu,
+        0xD98EEDC6u, 0xCA2C75B1u, 0xFECBDD28u, 0xED69455Fu, 0x97048C1Au, 0x84A6146Du, 0xB041BCF4u, 0xA3E32483u
+    },
+    {
+        0x00000000u, 0xA541927Eu, 0x4F6F520Du, 0xEA2EC073u, 0x9EDEA41Au, 0x3B9F3664u, 0xD1B1F617u, 0x74F06469u,
+        0x38513EC5u, 0x9D10ACBBu, 0x773E6CC8u, 0xD27FFEB6u, 0xA68F9ADFu, 0x03CE08A1u, 0xE9E0C8D2u, 0x4CA15AACu,
+        0x70A27D8Au, 0xD5E3EFF4u, 0x3FCD2F87u, 0x9A8CBDF9u, 0xEE7CD990u, 0x4B3D4BEEu, 0xA1138B9Du, 0x045219E3u,
+        0x48F3434Fu, 0xEDB2D131u, 0x079C1142u, 0xA2DD833Cu, 0xD62DE755u, 0x736C752Bu, 0x9942B558u, 0x3C032726u,
+        0xE144FB14u, 0x4405696Au, 0xAE2BA919u, 0x0B6A3B67u, 0x7F9A5F0Eu, 0xDADBCD70u, 0x30F50D03u, 0x95B49F7Du,
+        0xD915C5D1u, 0x7C5457AFu, 0x967A97DCu, 0x333B05A2u, 0x47CB61CBu, 0xE28AF3B5u, 0x08A433C6u, 0xADE5A1B8u,
+        0x91E6869Eu, 0x34A714E0u, 0xDE89D493u, 0x7BC846EDu, 0x0F382284u, 0xAA79B0FAu, 0x40577089u, 0xE516E2F7u,
+        0xA9B7B85Bu, 0x0CF62A25u, 0xE6D8EA56u, 0x43997828u, 0x37691C41u, 0x92288E3Fu, 0x78064E4Cu, 0xDD47DC32u,
+        0xC76580D9u, 0x622412A7u, 0x880AD2D4u, 0x2D4B40AAu, 0x59BB24C3u, 0xFCFAB6BDu, 0x16D476CEu, 0xB395E4B0u,
+        0xFF34BE1Cu, 0x5A752C62u, 0xB05BEC11u, 0x151A7E6Fu, 0x61EA1A06u, 0xC4AB8878u, 0x2E85480Bu, 0x8BC4DA75u,
+        0xB7C7FD53u, 0x12866F2Du, 0xF8A8AF5Eu, 0x5DE93D20u, 0x29195949u, 0x8C58CB37u, 0x66760B44u, 0xC337993Au,
+        0x8F96C396u, 0x2AD751E8u, 0xC0F9919Bu, 0x65B803E5u, 0x1148678Cu, 0xB409F5F2u, 0x5E273581u, 0xFB66A7FFu,
+        0x26217BCDu, 0x8360E9B3u, 0x694E29C0u, 0xCC0FBBBEu, 0xB8FFDFD7u, 0x1DBE4DA9u, 0xF7908DDAu, 0x52D11FA4u,
+        0x1E704508u, 0xBB31D776u, 0x511F1705u, 0xF45E857Bu, 0x80AEE112u, 0x25EF736Cu, 0xCFC1B31Fu, 0x6A802161u,
+        0x56830647u, 0xF3C29439u, 0x19EC544Au, 0xBCADC634u, 0xC85DA25Du, 0x6D1C3023u, 0x8732F050u, 0x2273622Eu,
+        0x6ED23882u, 0xCB93AAFCu, 0x21BD6A8Fu, 0x84FCF8F1u, 0xF00C9C98u, 0x554D0EE6u, 0xBF63CE95u, 0x1A225CEBu,
+        0x8B277743u, 0x2E66E53Du, 0xC448254Eu, 0x6109B730u, 0x15F9D359u, 0xB0B84127u, 0x5A968154u, 0xFFD7132Au,
+        0xB3764986u, 0x1637DBF8u, 0xFC191B8Bu, 0x595889F5u, 0x2DA8ED9Cu, 0x88E97FE2u, 0x62C7BF91u, 0xC7862DEFu,
+        0xFB850AC9u, 0x5EC498B7u, 0xB4EA58C4u, 0x11ABCABAu, 0x655BAED3u, 0xC01A3CADu, 0x2A34FCDEu, 0x8F756EA0u,
+        0xC3D4340Cu, 0x6695A672u, 0x8CBB6601u, 0x29FAF47Fu, 0x5D0A9016u, 0xF84B0268u, 0x1265C21Bu, 0xB7245065u,
+        0x6A638C57u, 0xCF221E29u, 0x250CDE5Au, 0x804D4C24u, 0xF4BD284Du, 0x51FCBA33u, 0xBBD27A40u, 0x1E93E83Eu,
+        0x5232B292u, 0xF77320ECu, 0x1D5DE09Fu, 0xB81C72E1u, 0xCCEC1688u, 0x69AD84F6u, 0x83834485u, 0x26C2D6FBu,
+        0x1AC1F1DDu, 0xBF8063A3u, 0x55AEA3D0u, 0xF0EF31AEu, 0x841F55C7u, 0x215EC7B9u, 0xCB7007CAu, 0x6E3195B4u,
+        0x2290CF18u, 0x87D15D66u, 0x6DFF9D15u, 0xC8BE0F6Bu, 0xBC4E6B02u, 0x190FF97Cu, 0xF321390Fu, 0x5660AB71u,
+        0x4C42F79Au, 0xE90365E4u, 0x032DA597u, 0xA66C37E9u, 0xD29C5380u, 0x77DDC1FEu, 0x9DF3018Du, 0x38B293F3u,
+        0x7413C95Fu, 0xD1525B21u, 0x3B7C9B52u, 0x9E3D092Cu, 0xEACD6D45u, 0x4F8CFF3Bu, 0xA5A23F48u, 0x00E3AD36u,
+        0x3CE08A10u, 0x99A1186Eu, 0x738FD81Du, 0xD6CE4A63u, 0xA23E2E0Au, 0x077FBC74u, 0xED517C07u, 0x4810EE79u,
+        0x04B1B4D5u, 0xA1F026ABu, 0x4BDEE6D8u, 0xEE9F74A6u, 0x9A6F10CFu, 0x3F2E82B1u, 0xD50042C2u, 0x7041D0BCu,
+        0xAD060C8Eu, 0x08479EF0u, 0xE2695E83u, 0x4728CCFDu, 0x33D8A894u, 0x96993AEAu, 0x7CB7FA99u, 0xD9F668E7u,
+        0x9557324Bu, 0x3016A035u, 0xDA386046u, 0x7F79F238u, 0x0B899651u, 0xAEC8042Fu, 0x44E6C45Cu, 0xE1A75622u,
+        0xDDA47104u, 0x78E5E37Au, 0x92CB2309u, 0x378AB177u, 0x437AD51Eu, 0xE63B4760u, 0x0C158713u, 0xA954156Du,
+        0xE5F54FC1u, 0x40B4DDBFu, 0xAA9A1DCCu, 0x0FDB8FB2u, 0x7B2BEBDBu, 0xDE6A79A5u, 0x3444B9D6u, 0x91052BA8u
+    },
+    {
+        0x00000000u, 0xDD45AAB8u, 0xBF672381u, 0x62228939u, 0x7B2231F3u, 0xA6679B4Bu, 0xC4451272u, 0x1900B8CAu,
+        0xF64463E6u, 0x2B01C95Eu, 0x49234067u, 0x9466EADFu, 0x8D665215u, 0x5023F8ADu, 0x32017194u, 0xEF44DB2Cu,
+        0xE964B13Du, 0x34211B85u, 0x560392BCu, 0x8B463804u, 0x924680CEu, 0x4F032A76u, 0x2D21A34Fu, 0xF06409F7u,
+        0x1F20D2DBu, 0xC2657863u, 0xA047F15Au, 0x7D025BE2u, 0x6402E328u, 0xB9474990u, 0xDB65C0A9u, 0x06206A11u,
+        0xD725148Bu, 0x0A60BE33u, 0x6842370Au, 0xB5079DB2u, 0xAC072578u, 0x71428FC0u, 0x136006F9u, 0xCE25AC41u,
+        0x2161776Du, 0xFC24DDD5u, 0x9E0654ECu, 0x4343FE54u, 0x5A43469Eu, 0x8706EC26u, 0xE524651Fu, 0x3861CFA7u,
+        0x3E41A5B6u, 0xE3040F0Eu, 0x81268637u, 0x5C632C8Fu, 0x45639445u, 0x98263EFDu, 0xFA04B7C4u, 0x27411D7Cu,
+        0xC805C650u, 0x15406CE8u, 0x7762E5D1u, 0xAA274F69u, 0xB327F7A3u, 0x6E625D1Bu, 0x0C40D422u, 0xD1057E9Au,
+        0xABA65FE7u, 0x76E3F55Fu, 0x14C17C66u, 0xC984D6DEu, 0xD0846E14u, 0x0DC1C4ACu, 0x6FE34D95u, 0xB2A6E72Du,
+        0x5DE23C01u, 0x80A796B9u, 0xE2851F80u, 0x3FC0B538u, 0x26C00DF2u, 0xFB85A74Au, 0x99A72E73u, 0x44E284CBu,
+        0x42C2EEDAu, 0x9F874462u, 0xFDA5CD5Bu, 0x20E067E3u, 0x39E0DF29u, 0xE4A57591u, 0x8687FCA8u, 0x5BC25610u,
+        0xB4868D3Cu, 0x69C32784u, 0x0BE1AEBDu, 0xD6A40405u, 0xCFA4BCCFu, 0x12E11677u, 0x70C39F4Eu, 0xAD8635F6u,
+        0x7C834B6Cu, 0xA1C6E1D4u, 0xC3E468EDu, 0x1EA1C255u, 0x07A17A9Fu, 0xDAE4D027u, 0xB8C6591Eu, 0x6583F3A6u,
+        0x8AC7288Au, 0x57828232u, 0x35A00B0Bu, 0xE8E5A1B3u, 0xF1E51979u, 0x2CA0B3C1u, 0x4E823AF8u, 0x93C79040u,
+        0x95E7FA51u, 0x48A250E9u, 0x2A80D9D0u, 0xF7C57368u, 0xEEC5CBA2u, 0x3380611Au, 0x51A2E823u, 0x8CE7429Bu,
+        0x63A399B7u, 0xBEE6330Fu, 0xDCC4BA36u, 0x0181108Eu, 0x1881A844u, 0xC5C402FCu, 0xA7E68BC5u, 0x7AA3217Du,
+        0x52A0C93Fu, 0x8FE56387u, 0xEDC7EABEu, 0x30824006u, 0x2982F8CCu, 0xF4C75274u, 0x96E5DB4Du, 0x4BA071F5u,
+        0xA4E4AAD9u, 0x79A10061u, 0x1B838958u, 0xC6C623E0u, 0xDFC69B2Au, 0x02833192u, 0x60A1B8ABu, 0xBDE41213u,
+        0xBBC47802u, 0x6681D2BAu, 0x04A35B83u, 0xD9E6F13Bu, 0xC0E649F1u, 0x1DA3E349u, 0x7F816A70u, 0xA2C4C0C8u,
+        0x4D801BE4u, 0x90C5B15Cu, 0xF2E73865u, 0x2FA292DDu, 0x36A22A17u, 0xEBE780AFu, 0x89C50996u, 0x5480A32Eu,
+        0x8585DDB4u, 0x58C0770Cu, 0x3AE2FE35u, 0xE7A7548Du, 0xFEA7EC47u, 0x23E246FFu, 0x41C0CFC6u, 0x9C85657Eu,
+        0x73C1BE52u, 0xAE8414EAu, 0xCCA69DD3u, 0x11E3376Bu, 0x08E38FA1u, 0xD5A62519u, 0xB784AC20u, 0x6AC10698u,
+        0x6CE16C89u, 0xB1A4C631u, 0xD3864F08u, 0x0EC3E5B0u, 0x17C35D7Au, 0xCA86F7C2u, 0xA8A47EFBu, 0x75E1D443u,
+        0x9AA50F6Fu, 0x47E0A5D7u, 0x25C22CEEu, 0xF8878656u, 0xE1873E9Cu, 0x3CC29424u, 0x5EE01D1Du, 0x83A5B7A5u,
+        0xF90696D8u, 0x24433C60u, 0x4661B559u, 0x9B241FE1u, 0x8224A72Bu, 0x5F610D93u, 0x3D4384AAu, 0xE0062E12u,
+        0x0F42F53Eu, 0xD2075F86u, 0xB025D6BFu, 0x6D607C07u, 0x7460C4CDu, 0xA9256E75u, 0xCB07E74Cu, 0x16424DF4u,
+        0x106227E5u, 0xCD278D5Du, 0xAF050464u, 0x7240AEDCu, 0x6B401616u, 0xB605BCAEu, 0xD4273597u, 0x09629F2Fu,
+        0xE6264403u, 0x3B63EEBBu, 0x59416782u, 0x8404CD3Au, 0x9D0475F0u, 0x4041DF48u, 0x22635671u, 0xFF26FCC9u,
+        0x2E238253u, 0xF36628EBu, 0x9144A1D2u, 0x4C010B6Au, 0x5501B3A0u, 0x88441918u, 0xEA669021u, 0x37233A99u,
+        0xD867E1B5u, 0x05224B0Du, 0x6700C234u, 0xBA45688Cu, 0xA345D046u, 0x7E007AFEu, 0x1C22F3C7u, 0xC167597Fu,
+        0xC747336Eu, 0x1A0299D6u, 0x782010EFu, 0xA565BA57u, 0xBC65029Du, 0x6120A825u, 0x0302211Cu, 0xDE478BA4u,
+        0x31035088u, 0xEC46FA30u, 0x8E647309u, 0x5321D9B1u, 0x4A21617Bu, 0x9764CBC3u, 0xF54642FAu, 0x2803E842u
+    },
+    {
+        0x00000000u, 0x38116FACu, 0x7022DF58u, 0x4833B0F4u, 0xE045BEB0u, 0xD854D11Cu, 0x906761E8u, 0xA8760E44u,
+        0xC5670B91u, 0xFD76643Du, 0xB545D4C9u, 0x8D54BB65u, 0x2522B521u, 0x1D33DA8Du, 0x55006A79u, 0x6D1105D5u,
+        0x8F2261D3u, 0xB7330E7Fu, 0xFF00BE8Bu, 0xC711D127u, 0x6F67DF63u, 0x5776B0CFu, 0x1F45003Bu, 0x27546F97u,
+        0x4A456A42u, 0x725405EEu, 0x3A67B51Au, 0x0276DAB6u, 0xAA00D4F2u, 0x9211BB5Eu, 0xDA220BAAu, 0xE2336406u,
+        0x1BA8B557u, 0x23B9DAFBu, 0x6B8A6A0Fu, 0x539B05A3u, 0xFBED0BE7u, 0xC3FC644Bu, 0x8BCFD4BFu, 0xB3DEBB13u,
+        0xDECFBEC6u, 0xE6DED16Au, 0xAEED619Eu, 0x96FC0E32u, 0x3E8A0076u, 0x069B6FDAu, 0x4EA8DF2Eu, 0x76B9B082u,
+        0x948AD484u, 0xAC9BBB28u, 0xE4A80BDCu, 0xDCB96470u, 0x74CF6A34u, 0x4CDE0598u, 0x04EDB56Cu, 0x3CFCDAC0u,
+        0x51EDDF15u, 0x69FCB0B9u, 0x21CF004Du, 0x19DE6FE1u, 0xB1A861A5u, 0x89B90E09u, 0xC18ABEFDu, 0xF99BD151u,
+        0x37516AAEu, 0x0F400502u, 0x4773B5F6u, 0x7F62DA5Au, 0xD714D41Eu, 0xEF05BBB2u, 0xA7360B46u, 0x9F2764EAu,
+        0xF236613Fu, 0xCA270E93u, 0x8214BE67u, 0xBA05D1CBu, 0x1273DF8Fu, 0x2A62B023u, 0x625100D7u, 0x5A406F7Bu,
+        0xB8730B7Du, 0x806264D1u, 0xC851D425u, 0xF040BB89u, 0x5836B5CDu, 0x6027DA61u, 0x28146A95u, 0x10050539u,
+        0x7D1400ECu, 0x45056F40u, 0x0D36DFB4u, 0x3527B018u, 0x9D51BE5Cu, 0xA540D1F0u, 0xED736104u, 0xD5620EA8u,
+        0x2CF9DFF9u, 0x14E8B055u, 0x5CDB00A1u, 0x64CA6F0Du, 0xCCBC6149u, 0xF4AD0EE5u, 0xBC9EBE11u, 0x848FD1BDu,
+        0xE99ED468u, 0xD18FBBC4u, 0x99BC0B30u, 0xA1AD649Cu, 0x09DB6AD8u, 0x31CA0574u, 0x79F9B580u, 0x41E8DA2Cu,
+        0xA3DBBE2Au, 0x9BCAD186u, 0xD3F96172u, 0xEBE80EDEu, 0x439E009Au, 0x7B8F6F36u, 0x33BCDFC2u, 0x0BADB06Eu,
+        0x66BCB5BBu, 0x5EADDA17u, 0x169E6AE3u, 0x2E8F054Fu, 0x86F90B0Bu, 0xBEE864A7u, 0xF6DBD453u, 0xCECABBFFu,
+        0x6EA2D55Cu, 0x56B3BAF0u, 0x1E800A04u, 0x269165A8u, 0x8EE76BECu, 0xB6F60440u, 0xFEC5B4B4u, 0xC6D4DB18u,
+        0xABC5DECDu, 0x93D4B161u, 0xDBE70195u, 0xE3F66E39u, 0x4B80607Du, 0x73910FD1u, 0x3BA2BF25u, 0x03B3D089u,
+        0xE180B48Fu, 0xD991DB23u, 0x91A26BD7u, 0xA9B3047Bu, 0x01C50A3Fu, 0x39D46593u, 0x71E7D567u, 0x49F6BACBu,
+        0x24E7BF1Eu, 0x1CF6D0B2u, 0x54C56046u, 0x6CD40FEAu, 0xC4A201AEu, 0xFCB36E02u, 0xB480DEF6u, 0x8C91B15Au,
+        0x750A600Bu, 0x4D1B0FA7u, 0x0528BF53u, 0x3D39D0FFu, 0x954FDEBBu, 0xAD5EB117u, 0xE56D01E3u, 0xDD7C6E4Fu,
+        0xB06D6B9Au, 0x887C0436u, 0xC04FB4C2u, 0xF85EDB6Eu, 0x5028D52Au, 0x6839BA86u, 0x200A0A72u, 0x181B65DEu,
+        0xFA2801D8u, 0xC2396E74u, 0x8A0ADE80u, 0xB21BB12Cu, 0x1A6DBF68u, 0x227CD0C4u, 0x6A4F6030u, 0x525E0F9Cu,
+        0x3F4F0A49u, 0x075E65E5u, 0x4F6DD511u, 0x777CBABDu, 0xDF0AB4F9u, 0xE71BDB55u, 0xAF286BA1u, 0x9739040Du,
+        0x59F3BFF2u, 0x61E2D05Eu, 0x29D160AAu, 0x11C00F06u, 0xB9B60142u, 0x81A76EEEu, 0xC994DE1Au, 0xF185B1B6u,
+        0x9C94B463u, 0xA485DBCFu, 0xECB66B3Bu, 0xD4A70497u, 0x7CD10AD3u, 0x44C0657Fu, 0x0CF3D58Bu, 0x34E2BA27u,
+        0xD6D1DE21u, 0xEEC0B18Du, 0xA6F30179u, 0x9EE26ED5u, 0x36946091u, 0x0E850F3Du, 0x46B6BFC9u, 0x7EA7D065u,
+        0x13B6D5B0u, 0x2BA7BA1Cu, 0x63940AE8u, 0x5B856544u, 0xF3F36B00u, 0xCBE204ACu, 0x83D1B458u, 0xBBC0DBF4u,
+        0x425B0AA5u, 0x7A4A6509u, 0x3279D5FDu, 0x0A68BA51u, 0xA21EB415u, 0x9A0FDBB9u, 0xD23C6B4Du, 0xEA2D04E1u,
+        0x873C0134u, 0xBF2D6E98u, 0xF71EDE6Cu, 0xCF0FB1C0u, 0x6779BF84u, 0x5F68D028u, 0x175B60DCu, 0x2F4A0F70u,
+        0xCD796B76u, 0xF56804DAu, 0xBD5BB42Eu, 0x854ADB82u, 0x2D3CD5C6u, 0x152DBA6Au, 0x5D1E0A9Eu, 0x650F6532u,
+        0x081E60E7u, 0x300F0F4Bu, 0x783CBFBFu, 0x402DD013u, 0xE85BDE57u, 0xD04AB1FBu, 0x9879010Fu, 0xA0686EA3u
+    },
+    {
+        0x00000000u, 0xEF306B19u, 0xDB8CA0C3u, 0x34BCCBDAu, 0xB2F53777u, 0x5DC55C6Eu, 0x697997B4u, 0x8649FCADu,
+        0x6006181Fu, 0x8F367306u, 0xBB8AB8DCu, 0x54BAD3C5u, 0xD2F32F68u, 0x3DC34471u, 0x097F8FABu, 0xE64FE4B2u,
+        0xC00C303Eu, 0x2F3C5B27u, 0x1B8090FDu, 0xF4B0FBE4u, 0x72F90749u, 0x9DC96C50u, 0xA975A78Au, 0x4645CC93u,
+        0xA00A2821u, 0x4F3A4338u, 0x7B8688E2u, 0x94B6E3FBu, 0x12FF1F56u, 0xFDCF744Fu, 0xC973BF95u, 0x2643D48Cu,
+        0x85F4168Du, 0x6AC47D94u, 0x5E78B64Eu, 0xB148DD57u, 0x370121FAu, 0xD8314AE3u, 0xEC8D8139u, 0x03BDEA20u,
+        0xE5F20E92u, 0x0AC2658Bu, 0x3E7EAE51u, 0xD14EC548u, 0x570739E5u, 0xB83752FCu, 0x8C8B9926u, 0x63BBF23Fu,
+        0x45F826B3u, 0xAAC84DAAu, 0x9E748670u, 0x7144ED69u, 0xF70D11C4u, 0x183D7ADDu, 0x2C81B107u, 0xC3B1DA1Eu,
+        0x25FE3EACu, 0xCACE55B5u, 0xFE729E6Fu, 0x1142F576u, 0x970B09DBu, 0x783B62C2u, 0x4C87A918u, 0xA3B7C201u,
+        0x0E045BEBu, 0xE13430F2u, 0xD588FB28u, 0x3AB89031u, 0xBCF16C9Cu, 0x53C10785u, 0x677DCC5Fu, 0x884DA746u,
+        0x6E0243F4u, 0x813228EDu, 0xB58EE337u, 0x5ABE882Eu, 0xDCF77483u, 0x33C71F9Au, 0x077BD440u, 0xE84BBF59u,
+        0xCE086BD5u, 0x213800CCu, 0x1584CB16u, 0xFAB4A00Fu, 0x7CFD5CA2u, 0x93CD37BBu, 0xA771FC61u, 0x48419778u,
+        0xAE0E73CAu, 0x413E18D3u, 0x7582D309u, 0x9AB2B810u, 0x1CFB44BDu, 0xF3CB2FA4u, 0xC777E47Eu, 0x28478F67u,
+        0x8BF04D66u, 0x64C0267Fu, 0x507CEDA5u, 0xBF4C86BCu, 0x39057A11u, 0xD6351108u, 0xE289DAD2u, 0x0DB9B1CBu,
+        0xEBF65579u, 0x04C63E60u, 0x307AF5BAu, 0xDF4A9EA3u, 0x5903620Eu, 0xB6330917u, 0x828FC2CDu, 0x6DBFA9D4u,
+        0x4BFC7D58u, 0xA4CC1641u, 0x9070DD9Bu, 0x7F40B682u, 0xF9094A2Fu, 0x16392136u, 0x2285EAECu, 0xCDB581F5u,
+        0x2BFA6547u, 0xC4CA0E5Eu, 0xF076C584u, 0x1F46AE9Du, 0x990F5230u, 0x763F3929u, 0x4283F2F3u, 0xADB399EAu,
+        0x1C08B7D6u, 0xF338DCCFu, 0xC7841715u, 0x28B47C0Cu, 0xAEFD80A1u, 0x41CDEBB8u, 0x75712062u, 0x9A414B7Bu,
+        0x7C0EAFC9u, 0x933EC4D0u, 0xA7820F0Au, 0x48B26413u, 0xCEFB98BEu, 0x21CBF3A7u, 0x1577387Du, 0xFA475364u,
+        0xDC0487E8u, 0x3334ECF1u, 0x0788272Bu, 0xE8B84C32u, 0x6EF1B09Fu, 0x81C1DB86u, 0xB57D105Cu, 0x5A4D7B45u,
+        0xBC029FF7u, 0x5332F4EEu, 0x678E3F34u, 0x88BE542Du, 0x0EF7A880u, 0xE1C7C399u, 0xD57B0843u, 0x3A4B635Au,
+        0x99FCA15Bu, 0x76CCCA42u, 0x42700198u, 0xAD406A81u, 0x2B09962Cu, 0xC439FD35u, 0xF08536EFu, 0x1FB55DF6u,
+        0xF9FAB944u, 0x16CAD25Du, 0x22761987u, 0xCD46729Eu, 0x4B0F8E33u, 0xA43FE52Au, 0x90832EF0u, 0x7FB345E9u,
+        0x59F09165u, 0xB6C0FA7Cu, 0x827C31A6u, 0x6D4C5ABFu, 0xEB05A612u, 0x0435CD0Bu, 0x308906D1u, 0xDFB96DC8u,
+        0x39F6897Au, 0xD6C6E263u, 0xE27A29B9u, 0x0D4A42A0u, 0x8B03BE0Du, 0x6433D514u, 0x508F1ECEu, 0xBFBF75D7u,
+        0x120CEC3Du, 0xFD3C8724u, 0xC9804CFEu, 0x26B027E7u, 0xA0F9DB4Au, 0x4FC9B053u, 0x7B757B89u, 0x94451090u,
+        0x720AF422u, 0x9D3A9F3Bu, 0xA98654E1u, 0x46B63FF8u, 0xC0FFC355u, 0x2FCFA84Cu, 0x1B736396u, 0xF443088Fu,
+        0xD200DC03u, 0x3D30B71Au, 0x098C7CC0u, 0xE6BC17D9u, 0x60F5EB74u, 0x8FC5806Du, 0xBB794BB7u, 0x544920AEu,
+        0xB206C41Cu, 0x5D36AF05u, 0x698A64DFu, 0x86BA0FC6u, 0x00F3F36Bu, 0xEFC39872u, 0xDB7F53A8u, 0x344F38B1u,
+        0x97F8FAB0u, 0x78C891A9u, 0x4C745A73u, 0xA344316Au, 0x250DCDC7u, 0xCA3DA6DEu, 0xFE816D04u, 0x11B1061Du,
+        0xF7FEE2AFu, 0x18CE89B6u, 0x2C72426Cu, 0xC3422975u, 0x450BD5D8u, 0xAA3BBEC1u, 0x9E87751Bu, 0x71B71E02u,
+        0x57F4CA8Eu, 0xB8C4A197u, 0x8C786A4Du, 0x63480154u, 0xE501FDF9u, 0x0A3196E0u, 0x3E8D5D3Au, 0xD1BD3623u,
+        0x37F2D291u, 0xD8C2B988u, 0xEC7E7252u, 0x034E194Bu, 0x8507E5E6u, 0x6A378EFFu, 0x5E8B4525u, 0xB1BB2E3Cu
+    },
+    {
+        0x00000000u, 0x68032CC8u, 0xD0065990u, 0xB8057558u, 0xA5E0C5D1u, 0xCDE3E919u, 0x75E69C41u, 0x1DE5B089u,
+        0x4E2DFD53u, 0x262ED19Bu, 0x9E2BA4C3u, 0xF628880Bu, 0xEBCD3882u, 0x83CE144Au, 0x3BCB6112u, 0x53C84DDAu,
+        0x9C5BFAA6u, 0xF458D66Eu, 0x4C5DA336u, 0x245E8FFEu, 0x39BB3F77u, 0x51B813BFu, 0xE9BD66E7u, 0x81BE4A2Fu,
+        0xD27607F5u, 0xBA752B3Du, 0x02705E65u, 0x6A7372ADu, 0x7796C224u, 0x1F95EEECu, 0xA7909BB4u, 0xCF93B77Cu,
+        0x3D5B83BDu, 0x5558AF75u, 0xED5DDA2Du, 0x855EF6E5u, 0x98BB466Cu, 0xF0B86AA4u, 0x48BD1FFCu, 0x20BE3334u,
+        0x73767EEEu, 0x1B755226u, 0xA370277Eu, 0xCB730BB6u, 0xD696BB3Fu, 0xBE9597F7u, 0x0690E2AFu, 0x6E93CE67u,
+        0xA100791Bu, 0xC90355D3u, 0x7106208Bu, 0x19050C43u, 0x04E0BCCAu, 0x6CE39002u, 0xD4E6E55Au, 0xBCE5C992u,
+        0xEF2D8448u, 0x872EA880u, 0x3F2BDDD8u, 0x5728F110u, 0x4ACD4199u, 0x22CE6D51u, 0x9ACB1809u, 0xF2C834C1u,
+        0x7AB7077Au, 0x12B42BB2u, 0xAAB15EEAu, 0xC2B27222u, 0xDF57C2ABu, 0xB754EE63u, 0x0F519B3Bu, 0x6752B7F3u,
+        0x349AFA29u, 0x5C99D6E1u, 0xE49CA3B9u, 0x8C9F8F71u, 0x917A3FF8u, 0xF9791330u, 0x417C6668u, 0x297F4AA0u,
+        0xE6ECFDDCu, 0x8EEFD114u, 0x36EAA44Cu, 0x5EE98884u, 0x430C380Du, 0x2B0F14C5u, 0x930A619Du, 0xFB094D55u,
+        0xA8C1008Fu, 0xC0C22C47u, 0x78C7591Fu, 0x10C475D7u, 0x0D21C55Eu, 0x6522E996u, 0xDD279CCEu, 0xB524B006u,
+        0x47EC84C7u, 0x2FEFA80Fu, 0x97EADD57u, 0xFFE9F19Fu, 0xE20C4116u, 0x8A0F6DDEu, 0x320A1886u, 0x5A09344Eu,
+        0x09C17994u, 0x61C2555Cu, 0xD9C72004u, 0xB1C40CCCu, 0xAC21BC45u, 0xC422908Du, 0x7C27E5D5u, 0x1424C91Du,
+        0xDBB77E61u, 0xB3B452A9u, 0x0BB127F1u, 0x63B20B39u, 0x7E57BBB0u, 0x16549778u, 0xAE51E220u, 0xC652CEE8u,
+        0x959A8332u, 0xFD99AFFAu, 0x459CDAA2u, 0x2D9FF66Au, 0x307A46E3u, 0x58796A2Bu, 0xE07C1F73u, 0x887F33BBu,
+        0xF56E0EF4u, 0x9D6D223Cu, 0x25685764u, 0x4D6B7BACu, 0x508ECB25u, 0x388DE7EDu, 0x808892B5u, 0xE88BBE7Du,
+        0xBB43F3A7u, 0xD340DF6Fu, 0x6B45AA37u, 0x034686FFu, 0x1EA33676u, 0x76A01ABEu, 0xCEA56FE6u, 0xA6A6432Eu,
+        0x6935F452u, 0x0136D89Au, 0xB933ADC2u, 0xD130810Au, 0xCCD53183u, 0xA4D61D4Bu, 0x1CD36813u, 0x74D044DBu,
+        0x27180901u, 0x4F1B25C9u, 0xF71E5091u, 0x9F1D7C59u, 0x82F8CCD0u, 0xEAFBE018u, 0x52FE9540u, 0x3AFDB988u,
+        0xC8358D49u, 0xA036A181u, 0x1833D4D9u, 0x7030F811u, 0x6DD54898u, 0x05D66450u, 0xBDD31108u, 0xD5D03DC0u,
+        0x8618701Au, 0xEE1B5CD2u, 0x561E298Au, 0x3E1D0542u, 0x23F8B5CBu, 0x4BFB9903u, 0xF3FEEC5Bu, 0x9BFDC093u,
+        0x546E77EFu, 0x3C6D5B27u, 0x84682E7Fu, 0xEC6B02B7u, 0xF18EB23Eu, 0x998D9EF6u, 0x2188EBAEu, 0x498BC766u,
+        0x1A438ABCu, 0x7240A674u, 0xCA45D32Cu, 0xA246FFE4u, 0xBFA34F6Du, 0xD7A063A5u, 0x6FA516FDu, 0x07A63A35u,
+        0x8FD9098Eu, 0xE7DA2546u, 0x5FDF501Eu, 0x37DC7CD6u, 0x2A39CC5Fu, 0x423AE097u, 0xFA3F95CFu, 0x923CB907u,
+        0xC1F4F4DDu, 0xA9F7D815u, 0x11F2AD4Du, 0x79F18185u, 0x6414310Cu, 0x0C171DC4u, 0xB412689Cu, 0xDC114454u,
+        0x1382F328u, 0x7B81DFE0u, 0xC384AAB8u, 0xAB878670u, 0xB66236F9u, 0xDE611A31u, 0x66646F69u, 0x0E6743A1u,
+        0x5DAF0E7Bu, 0x35AC22B3u, 0x8DA957EBu, 0xE5AA7B23u, 0xF84FCBAAu, 0x904CE762u, 0x2849923Au, 0x404ABEF2u,
+        0xB2828A33u, 0xDA81A6FBu, 0x6284D3A3u, 0x0A87FF6Bu, 0x17624FE2u, 0x7F61632Au, 0xC7641672u, 0xAF673ABAu,
+        0xFCAF7760u, 0x94AC5BA8u, 0x2CA92EF0u, 0x44AA0238u, 0x594FB2B1u, 0x314C9E79u, 0x8949EB21u, 0xE14AC7E9u,
+        0x2ED97095u, 0x46DA5C5Du, 0xFEDF2905u, 0x96DC05CDu, 0x8B39B544u, 0xE33A998Cu, 0x5B3FECD4u, 0x333CC01Cu,
+        0x60F48DC6u, 0x08F7A10Eu, 0xB0F2D456u, 0xD8F1F89Eu, 0xC5144817u, 0xAD1764DFu, 0x15121187u, 0x7D113D4Fu
+    },
+    {
+        0x00000000u, 0x493C7D27u, 0x9278FA4Eu, 0xDB448769u, 0x211D826Du, 0x6821FF4Au, 0xB3657823u, 0xFA590504u,
+        0x423B04DAu, 0x0B0779FDu, 0xD043FE94u, 0x997F83B3u, 0x632686B7u, 0x2A1AFB90u, 0xF15E7CF9u, 0xB86201DEu,
+        0x847609B4u, 0xCD4A7493u, 0x160EF3FAu, 0x5F328EDDu, 0xA56B8BD9u, 0xEC57F6FEu, 0x37137197u, 0x7E2F0CB0u,
+        0xC64D0D6Eu, 0x8F717049u, 0x5435F720u, 0x1D098A07u, 0xE7508F03u, 0xAE6CF224u, 0x7528754Du, 0x3C14086Au,
+        0x0D006599u, 0x443C18BEu, 0x9F789FD7u, 0xD644E2F0u, 0x2C1DE7F4u, 0x65219AD3u, 0xBE651DBAu, 0xF759609Du,
+        0x4F3B6143u, 0x06071C64u, 0xDD439B0Du, 0x947FE62Au, 0x6E26E32Eu, 0x271A9E09u, 0xFC5E1960u, 0xB5626447u,
+        0x89766C2Du, 0xC04A110Au, 0x1B0E9663u, 0x5232EB44u, 0xA86BEE40u, 0xE1579367u, 0x3A13140Eu, 0x732F6929u,
+        0xCB4D68F7u, 0x827115D0u, 0x593592B9u, 0x1009EF9Eu, 0xEA50EA9Au, 0xA36C97BDu, 0x782810D4u, 0x31146DF3u,
+        0x1A00CB32u, 0x533CB615u, 0x8878317Cu, 0xC1444C5Bu, 0x3B1D495Fu, 0x72213478u, 0xA965B311u, 0xE059CE36u,
+        0x583BCFE8u, 0x1107B2CFu, 0xCA4335A6u, 0x837F4881u, 0x79264D85u, 0x301A30A2u, 0xEB5EB7CBu, 0xA262CAECu,
+        0x9E76C286u, 0xD74ABFA1u, 0x0C0E38C8u, 0x453245EFu, 0xBF6B40EBu, 0xF6573DCCu, 0x2D13BAA5u, 0x642FC782u,
+        0xDC4DC65Cu, 0x9571BB7Bu, 0x4E353C12u, 0x07094135u, 0xFD504431u, 0xB46C3916u, 0x6F28BE7Fu, 0x2614C358u,
+        0x1700AEABu, 0x5E3CD38Cu, 0x857854E5u, 0xCC4429C2u, 0x361D2CC6u, 0x7F2151E1u, 0xA465D688u, 0xED59ABAFu,
+        0x553BAA71u, 0x1C07D756u, 0xC743503Fu, 0x8E7F2D18u, 0x7426281Cu, 0x3D1A553Bu, 0xE65ED252u, 0xAF62AF75u,
+        0x9376A71Fu, 0xDA4ADA38u, 0x010E5D51u, 0x48322076u, 0xB26B2572u, 0xFB575855u, 0x2013DF3Cu, 0x692FA21Bu,
+        0xD14DA3C5u, 0x9871DEE2u, 0x4335598Bu, 0x0A0924ACu, 0xF05021A8u, 0xB96C5C8Fu, 0x6228DBE6u, 0x2B14A6C1u,
+        0x34019664u, 0x7D3DEB43u, 0xA6796C2Au, 0xEF45110Du, 0x151C1409u, 0x5C20692Eu, 0x8764EE47u, 0xCE589360u,
+        0x763A92BEu, 0x3F06EF99u, 0xE44268F0u, 0xAD7E15D7u, 0x572710D3u, 0x1E1B6DF4u, 0xC55FEA9Du, 0x8C6397BAu,
+        0xB0779FD0u, 0xF94BE2F7u, 0x220F659Eu, 0x6B3318B9u, 0x916A1DBDu, 0xD856609Au, 0x0312E7F3u, 0x4A2E9AD4u,
+        0xF24C9B0Au, 0xBB70E62Du, 0x60346144u, 0x29081C63u, 0xD3511967u, 0x9A6D6440u, 0x4129E329u, 0x08159E0Eu,
+        0x3901F3FDu, 0x703D8EDAu, 0xAB7909B3u, 0xE2457494u, 0x181C7190u, 0x51200CB7u, 0x8A648BDEu, 0xC358F6F9u,
+        0x7B3AF727u, 0x32068A00u, 0xE9420D69u, 0xA07E704Eu, 0x5A27754Au, 0x131B086Du, 0xC85F8F04u, 0x8163F223u,
+        0xBD77FA49u, 0xF44B876Eu, 0x2F0F0007u, 0x66337D20u, 0x9C6A7824u, 0xD5560503u, 0x0E12826Au, 0x472EFF4Du,
+        0xFF4CFE93u, 0xB67083B4u, 0x6D3404DDu, 0x240879FAu, 0xDE517CFEu, 0x976D01D9u, 0x4C2986B0u, 0x0515FB97u,
+        0x2E015D56u, 0x673D2071u, 0xBC79A718u, 0xF545DA3Fu, 0x0F1CDF3Bu, 0x4620A21Cu, 0x9D642575u, 0xD4585852u,
+        0x6C3A598Cu, 0x250624ABu, 0xFE42A3C2u, 0xB77EDEE5u, 0x4D27DBE1u, 0x041BA6C6u, 0xDF5F21AFu, 0x96635C88u,
+        0xAA7754E2u, 0xE34B29C5u, 0x380FAEACu, 0x7133D38Bu, 0x8B6AD68Fu, 0xC256ABA8u, 0x19122CC1u, 0x502E51E6u,
+        0xE84C5038u, 0xA1702D1Fu, 0x7A34AA76u, 0x3308D751u, 0xC951D255u, 0x806DAF72u, 0x5B29281Bu, 0x1215553Cu,
+        0x230138CFu, 0x6A3D45E8u, 0xB179C281u, 0xF845BFA6u, 0x021CBAA2u, 0x4B20C785u, 0x906440ECu, 0xD9583DCBu,
+        0x613A3C15u, 0x28064132u, 0xF342C65Bu, 0xBA7EBB7Cu, 0x4027BE78u, 0x091BC35Fu, 0xD25F4436u, 0x9B633911u,
+        0xA777317Bu, 0xEE4B4C5Cu, 0x350FCB35u, 0x7C33B612u, 0x866AB316u, 0xCF56CE31u, 0x14124958u, 0x5D2E347Fu,
+        0xE54C35A1u, 0xAC704886u, 0x7734CFEFu, 0x3E08B2C8u, 0xC451B7CCu, 0x8D6DCAEBu, 0x56294D82u, 0x1F1530A5u
+    }
+};
+#endif
+
+uint32_t cbuf_crc32c(uint32_t crc, const void *data, uint32_t len)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    uint32_t c = ~crc;
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    //8 bytes per crc32 instruction, after the bytes up to an 8-byte boundary
+    while (len && ((uintptr_t)p & 7))
+    {
+        c = _mm_crc32_u8(c, *p++);
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = (uint32_t)_mm_crc32_u64(c, v);
+    }
+    while (len--)
+    {
+        c = _mm_crc32_u8(c, *p++);
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    while (len && ((uintptr_t)p & 7))
+    {
+        c = __crc32cb(c, *p++);
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = __crc32cd(c, v);
+    }
+    while (len--)
+    {
+        c = __crc32cb(c, *p++);
+    }
+#else
+    //8 table lookups per 8 bytes. The bytes are assembled by hand so it works on either endianness.
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint32_t lo = c ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+        c = _crc_table[7][lo & 0xFF] ^ _crc_table[6][(lo >> 8) & 0xFF] ^
+            _crc_table[5][(lo >> 16) & 0xFF] ^ _crc_table[4][lo >> 24] ^
+            _crc_table[3][hi & 0xFF] ^ _crc_table[2][(hi >> 8) & 0xFF] ^
+            _crc_table[1][(hi >> 16) & 0xFF] ^ _crc_table[0][hi >> 24];
+    }
+    while (len--)
+    {
+        c = (c >> 8) ^ _crc_table[0][(c ^ *p++) & 0xFF];
+    }
+#endif
+    return ~c;
+}
+
+/** CRC32C of the blob whose header of hsize bytes is at index at: the header bytes in front of the
+ *  CRC, then the body of len bytes, read in place
+ */
+static uint32_t _blob_crc(cbuf_t *cbuf, uint32_t at, uint32_t hsize, uint32_t len)
+{
+    uint8_t enc[CBUF_HEADER_MAX];
+    _peek_at(cbuf, enc, hsize - CBUF_CRC_LEN, at);
+    uint32_t crc = cbuf_crc32c(0, enc, hsize - CBUF_CRC_LEN);
+
+    at = _wrap(cbuf, at + hsize);
+    uint32_t first = _first_segment(cbuf, len, at);
+    crc = cbuf_crc32c(crc, &cbuf->buf[at], first);
+    return cbuf_crc32c(crc, cbuf->buf, len - first);
+}
+
+/** Check the complete blob whose header is at index at: that it ends within the data in the buffer,
+ *  so a damaged length can't send a reader off into the free space, and that its CRC matches
+ */
+static bool _valid_at(cbuf_t *cbuf, uint32_t at)
+{
+    uint32_t end = cbuf->widx;
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        end = cbuf->hidx;
+    }
+#endif
+    uint32_t used = (end >= at) ? (end - at) : (cbuf->len - at + end);
+
+    cbuf_item_t item;
+    uint32_t idx = at;
+    uint32_t hsize = _hdr_read(cbuf, &item, &idx);
+    if ((hsize + (uint64_t)item.len + _pad(cbuf, item.len)) > used)
+    {
+        return false;
+    }
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (item.open)
+    {
+        return false;
+    }
+#endif
+
+    uint32_t crc;
+    memcpy(&crc, item.crc, sizeof(crc));
+    return crc == _blob_crc(cbuf, at, hsize, item.len);
+}
+#endif
+
+/** Fill in the CRC of the complete blob whose header is at index at, now that its header and body
+ *  are in place
+ */
+static inline void _seal(cbuf_t *cbuf, uint32_t at)
+{
+#if defined(CBUF_CRC)
+    cbuf_item_t item;
+    uint32_t idx = at;
+    uint32_t hsize = _hdr_read(cbuf, &item, &idx);
+    uint32_t crc = _blob_crc(cbuf, at, hsize, item.len);
+    idx = _wrap(cbuf, at + hsize - CBUF_CRC_LEN);
+    _generic_write(cbuf, &crc, CBUF_CRC_LEN, &idx);
+#else
+    (void)cbuf;
+    (void)at;
+#endif
+}
+
+/** Check that the oldest blob is intact before handing it out. The result is kept until the head
+ *  moves, so peeking at a blob and then reading it checks it once.
+ */
+static inline bool _intact(cbuf_t *cbuf)
+{
+#if defined(CBUF_CRC)
+    if (!cbuf->checked)
+    {
+        cbuf->checked = _valid_at(cbuf, cbuf->ridx);
+    }
+    return cbuf->checked;
+#else
+    (void)cbuf;
+    return true;
+#endif
+}
+
+#if defined(CBUF_STATS)
+/** Count a completed blob of len bytes in the size histogram */
+static inline void _stat_blob(cbuf_t *cbuf, uint32_t len)
+{
+    uint32_t bucket = (len == 0) ? 0 : (32 - __builtin_clz(len));
+    bucket = (bucket < CBUF_STATS_BUCKETS) ? bucket : (CBUF_STATS_BUCKETS - 1);
+    cbuf->stats.blobs_written++;
+    cbuf->stats.size_hist[bucket]++;
+}
+
+/** Count bytes written, and track the most bytes ever in use once the write index reaches widx */
+static inline void _stat_bytes(cbuf_t *cbuf, uint32_t len, uint32_t widx)
+{
+    uint32_t ridx = _load(cbuf->ridx);
+    uint32_t used = (widx >= ridx) ? (widx - ridx) : (cbuf->len - ridx + widx);
+    cbuf->stats.bytes_written += len;
+    if (used > cbuf->stats.high_water)
+    {
+        cbuf->stats.high_water = used;
+    }
+}
+#endif
+
+void cbuf_init(cbuf_t *cbuf, uint8_t *mem, uint32_t len)
+{
+    assert(cbuf != NULL);
+#if defined(CBUF_POW2)
+    assert((len != 0) && ((len & (len - 1)) == 0));
+#endif
+
+    _store(cbuf->ridx,  0);
+    _store(cbuf->widx,  0);
+    _store(cbuf->count, 0);
+    cbuf->len   = len;
+    cbuf->buf   = mem;
+    cbuf->reserved = CBUF_NO_RESERVATION;
+#if defined(CBUF_BLOB_INDEX)
+    cbuf->offsets = NULL;
+    cbuf->slots   = 0;
+    cbuf->ohead   = 0;
+#endif
+#if defined(CBUF_ALIGN) && defined(CBUF_MPSC)
+    cbuf->align = CBUF_MPSC_ALIGN;
+#elif defined(CBUF_ALIGN)
+    cbuf->align = 1;
+#endif
+#if defined(CBUF_MPSC)
+    //Headers are stored atomically, so they must be aligned and never straddle the wrap point.
+    //Unclaimed space must read as zero so no header looks committed before its writer sets it.
+    assert((len % CBUF_MPSC_ALIGN) == 0);
+    assert(((uintptr_t)mem % CBUF_MPSC_ALIGN) == 0);
+    memset(mem, 0, len);
+#endif
+#if defined(CBUF_MIRROR)
+    cbuf->mirror = false;
+#endif
+#if defined(CBUF_ALLOW_PARTIAL)
+    cbuf->open  = false;
+    cbuf->hidx  = 0;
+#endif
+#if defined(CBUF_READERS)
+    cbuf->readers  = NULL;
+    cbuf->nreaders = 0;
+#endif
+#if defined(CBUF_SPILL)
+    memset(&cbuf->spill, 0, sizeof(cbuf->spill));
+    cbuf->spill.fd = -1;
+#endif
+#if defined(CBUF_FD)
+    cbuf->sidx  = 0;
+    _store(cbuf->sent, 0);
+#endif
+#if defined(CBUF_TIMESTAMP)
+    cbuf->clock = NULL;
+    cbuf->epoch = 0;
+#endif
+#if defined(CBUF_CRC)
+    cbuf->checked = false;
+#endif
+#if defined(CBUF_STATS)
+    memset(&cbuf->stats, 0, sizeof(cbuf->stats));
+#endif
+#if defined(CBUF_WAIT)
+    atomic_store(&cbuf->rwait, 0);
+    atomic_store(&cbuf->wwait, 0);
+    cbuf->efd = -1;
+#endif
+}
+
+#if defined(CBUF_ALIGN)
+bool cbuf_set_align(cbuf_t *cbuf, uint32_t align)
+{
+    assert(cbuf != NULL);
+
+    //Headers must stay aligned for CBUF_MPSC, and the alignment has to survive index wrapping
+    if ((align == 0) || ((align & (align - 1)) != 0) || (align < _align(cbuf)) ||
+        ((cbuf->len % align) != 0) || (((uintptr_t)cbuf->buf % align) != 0))
+    {
+        return false;
+    }
+
+    //Only an empty buffer can move its indices
+    if ((_load(cbuf->count) != 0) || (_load(cbuf->ridx) != _load(cbuf->widx)) ||
+        (cbuf->reserved != CBUF_NO_RESERVATION))
+    {
+        return false;
+    }
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        return false;
+    }
+#endif
+
+    cbuf->align = align;
+    _store(cbuf->ridx, _origin(cbuf));
+    _store(cbuf->widx, _origin(cbuf));
+    return true;
+}
+#endif
+
+#if defined(CBUF_BLOB_INDEX)
+bool cbuf_init_index(cbuf_t *cbuf, uint32_t *offsets, uint32_t slots)
+{
+    assert(cbuf != NULL);
+    assert((offsets != NULL) || (slots == 0));
+
+    if (cbuf->count > slots)
+    {
+        return false;
+    }
+
+    //Record the blobs already in the buffer by walking their headers
+    uint32_t idx = cbuf->ridx;
+    for (uint32_t i = 0; i < cbuf->count; i++)
+    {
+        cbuf_item_t item;
+        offsets[i] = idx;
+        _hdr_read(cbuf, &item, &idx);
+        idx = _wrap(cbuf, idx + item.len + _pad(cbuf, item.len));
+    }
+
+    cbuf->offsets = slots ? offsets : NULL;
+    cbuf->slots   = slots;
+    cbuf->ohead   = 0;
+    return true;
+}
+#endif
+
+#if defined(CBUF_READERS)
+bool cbuf_init_readers(cbuf_t *cbuf, cbuf_reader_t *readers, uint32_t n)
+{
+    assert(cbuf != NULL);
+    assert((readers != NULL) || (n == 0));
+
+    //Every reader starts at the head, with all the queued blobs still to read
+    for (uint32_t i = 0; i < n; i++)
+    {
+        readers[i].ridx  = cbuf->ridx;
+        readers[i].ahead = 0;
+        readers[i].lost  = 0;
+    }
+    cbuf->readers  = n ? readers : NULL;
+    cbuf->nreaders = n;
+    return true;
+}
+#endif
+
+#if defined(CBUF_MIRROR)
+bool cbuf_init_mirror(cbuf_t *cbuf, uint32_t len)
+{
+    assert(cbuf != NULL);
+
+    //Both mappings must be whole pages, so round the length up
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)len + page - 1) / page * page;
+    if ((size == 0) || (size > UINT32_MAX))
+    {
+        return false;
+    }
+
+    int fd = memfd_create("cbuf", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    //Reserve twice the address space, then map the same pages into both halves
+    uint8_t *mem = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    if ((mmap(mem,        size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+        (mmap(mem + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+        munmap(mem, 2 * size);
+        close(fd);
+        return false;
+    }
+
+    //The mappings keep the memory alive
+    close(fd);
+
+    cbuf_init(cbuf, mem, (uint32_t)size);
+    cbuf->mirror = true;
+    return true;
+}
+
+void cbuf_deinit_mirror(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+
+    if (cbuf->mirror)
+    {
+        munmap(cbuf->buf, 2 * (size_t)cbuf->len);
+        cbuf->buf    = NULL;
+        cbuf->mirror = false;
+    }
+}
+#endif
+
+#if defined(CBUF_PERSIST)
+#define CBUF_FILE_MAGIC     0x46554243u     //"CBUF"
+#define CBUF_FILE_DATA      4096u           //Offset of the buffer memory in the file
+
+/** Layout of the start of a file-backed buffer. The buffer memory follows at CBUF_FILE_DATA. */
+typedef struct {
+    uint32_t magic;     //CBUF_FILE_MAGIC
+    uint32_t meta_size; //sizeof(cbuf_t) in the build that created the file
+    uint32_t len;       //Length of the buffer memory (in bytes)
+    uint32_t clean;     //True if the file was closed with cbuf_close_file
+    cbuf_t   cbuf;      //The circular buffer itself
+} cbuf_file_t;
+
+_Static_assert(sizeof(cbuf_file_t) <= CBUF_FILE_DATA, "cbuf_t doesn't fit in the file header");
+
+bool cbuf_recover(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    uint32_t ridx  = _load_own(cbuf->ridx);
+    uint32_t widx  = _load_own(cbuf->widx);
+    uint32_t count = 0;
+    bool intact = true;
+
+    //Nothing in flight survives a restart
+    cbuf->reserved = CBUF_NO_RESERVATION;
+#if defined(CBUF_FD)
+    _store(cbuf->sent, 0);
+#endif
+#if defined(CBUF_CRC)
+    cbuf->checked = false;
+#endif
+#if defined(CBUF_ALLOW_PARTIAL)
+    cbuf->open = false;
+    cbuf->hidx = 0;
+#endif
+
+    //Indices outside the buffer mean nothing can be trusted
+    if ((ridx >= cbuf->len) || (widx >= cbuf->len))
+    {
+        _store(cbuf->ridx,  _origin(cbuf));
+        _store(cbuf->widx,  _origin(cbuf));
+        _store(cbuf->count, 0);
+        return false;
+    }
+
+    //The read index only ever lands on a header, and the write index is only updated once a blob is
+    //complete. Walk the header chain from one to the other; the count falls out of the walk, and the
+    //write index is cut back to the last blob that ends within it.
+    uint32_t idx = ridx;
+    while (idx != widx)
+    {
+        uint32_t avail = (widx > idx) ? (widx - idx) : (cbuf->len - idx + widx);
+        cbuf_item_t item;
+        uint32_t hidx = idx;
+        uint32_t hsize = _hdr_read(cbuf, &item, &hidx);
+        if (avail < hsize)
+        {
+            intact = false;
+            break;
+        }
+
+#if defined(CBUF_ALLOW_PARTIAL)
+        //An open blob is always the last one. Its header is updated before each append lands, so
+        //close it with only the bytes that made it into the buffer. Each append made room for the
+        //padding that closing it adds.
+        if (item.open)
+        {
+            uint32_t at = idx;
+            item.open = 0;
+            item.len  = avail - hsize;
+            _hdr_write(cbuf, &item, hsize, &idx);
+            _seal(cbuf, at);
+            idx = _wrap(cbuf, widx + _pad(cbuf, item.len));
+            count++;
+            intact = false;
+            break;
+        }
+#endif
+
+        if ((hsize + (uint64_t)item.len + _pad(cbuf, item.len)) > avail)
+        {
+            //Runs past the write index, so this and anything after it is garbage
+            intact = false;
+            break;
+        }
+#if defined(CBUF_CRC)
+        if (!_valid_at(cbuf, idx))
+        {
+            //Torn or damaged. Anything after it can't be trusted to follow on either.
+            intact = false;
+            break;
+        }
+#endif
+        idx = _wrap(cbuf, hidx + item.len + _pad(cbuf, item.len));
+        count++;
+    }
+
+    _store(cbuf->widx,  idx);
+    _store(cbuf->count, count);
+    return intact;
+}
+
+cbuf_t *cbuf_open_file(const char *path, uint32_t len, bool *clean)
+{
+    assert(path != NULL);
+    size_t size = CBUF_FILE_DATA + (size_t)len;
+    struct stat st;
+    bool was_clean = true;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if ((fstat(fd, &st) != 0) || (((size_t)st.st_size != size) && (ftruncate(fd, size) != 0)))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    cbuf_file_t *file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    cbuf_t *cbuf = &file->cbuf;
+    uint8_t *mem = (uint8_t*)file + CBUF_FILE_DATA;
+    if ((file->magic != CBUF_FILE_MAGIC) || (file->meta_size != sizeof(cbuf_t)) || (file->len != len))
+    {
+        //New file, or one this build can't read. Start over.
+        cbuf_init(cbuf, mem, len);
+        file->meta_size = sizeof(cbuf_t);
+        file->len       = len;
+        file->magic     = CBUF_FILE_MAGIC;
+    }
+    else
+    {
+        //The metadata is where it was left; only the mapping address has changed. The file may have
+        //been changed behind our back, so no blob counts as checked.
+        cbuf->buf = mem;
+#if defined(CBUF_CRC)
+        cbuf->checked = false;
+#endif
+#if defined(CBUF_MIRROR)
+        cbuf->mirror = false;
+#endif
+#if defined(CBUF_BLOB_INDEX)
+        //The offset index lived in the memory of the process that left the file behind
+        cbuf->offsets = NULL;
+        cbuf->slots   = 0;
+        cbuf->ohead   = 0;
+#endif
+#if defined(CBUF_READERS)
+        //So did the reader cursors
+        cbuf->readers  = NULL;
+        cbuf->nreaders = 0;
+#endif
+#if defined(CBUF_WAIT)
+        //Waiters and the eventfd belonged to the process that left the file behind
+        atomic_store(&cbuf->rwait, 0);
+        atomic_store(&cbuf->wwait, 0);
+        cbuf->efd = -1;
+#endif
+#if defined(CBUF_SPILL)
+        //So did the stage and the segment file. Its fd may now be some other file of this process.
+        memset(&cbuf->spill, 0, sizeof(cbuf->spill));
+        cbuf->spill.fd = -1;
+#endif
+        if (file->clean)
+        {
+            //Closed properly, so the indices are good. Only a reservation can be dangling.
+            cbuf->reserved = CBUF_NO_RESERVATION;
+        }
+        else
+        {
+            was_clean = cbuf_recover(cbuf);
+        }
+#if defined(CBUF_TIMESTAMP)
+        //The clock function belonged to the process that left the file behind too. The monotonic
+        //clock only runs within one boot, and after a reboot it starts behind the stamps in the
+        //file, so carry on from the newest of them.
+        cbuf->clock = NULL;
+        _rebase(cbuf);
+#endif
+    }
+
+    //Dirty until closed
+    file->clean = false;
+
+    if (clean)
+    {
+        *clean = was_clean;
+    }
+    return cbuf;
+}
+
+bool cbuf_sync_file(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    cbuf_file_t *file = (cbuf_file_t*)(cbuf->buf - CBUF_FILE_DATA);
+    return msync(file, CBUF_FILE_DATA + (size_t)cbuf->len, MS_SYNC) == 0;
+}
+
+void cbuf_close_file(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    cbuf_file_t *file = (cbuf_file_t*)(cbuf->buf - CBUF_FILE_DATA);
+    size_t size = CBUF_FILE_DATA + (size_t)cbuf->len;
+
+    //Flush the contents before marking the file clean, so clean always means consistent
+    msync(file, size, MS_SYNC);
+    file->clean = true;
+    msync(file, CBUF_FILE_DATA, MS_SYNC);
+    munmap(file, size);
+}
+#endif
+
+/** Number of bytes that can be written at widx without overwriting anything, given the read index.
+ *  One byte is always kept free so that a full buffer can't look empty.
+ */
+static inline uint32_t _free_space(const cbuf_t *cbuf, uint32_t ridx, uint32_t widx)
+{
+    return (ridx > widx) ? (ridx - widx - 1) : (cbuf->len - widx + ridx - 1);
+}
+
+#if defined(CBUF_SPILL)
+/** Copy the n oldest blobs, starting at index at, into the spill stage before they are erased.
+ *  Each is staged as a 4-byte length and its body. Blobs that don't fit are lost.
+ */
+static void _spill(cbuf_t *cbuf, uint32_t at, uint32_t n)
+{
+    cbuf_spill_t *s = &cbuf->spill;
+    if (!s->stage)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        cbuf_item_t item;
+        _hdr_read(cbuf, &item, &at);
+        //Staged blobs are prefixed with a uint32_t length whatever the header uses
+        uint32_t need = sizeof(uint32_t) + item.len;
+        if (((s->stage_len - s->staged) < need) && s->shead)
+        {
+            //Reclaim the space of blobs already replayed from the stage
+            memmove(s->stage, &s->stage[s->shead], s->staged - s->shead);
+            s->staged -= s->shead;
+            s->shead = 0;
+        }
+        if ((s->stage_len - s->staged) >= need)
+        {
+            uint32_t len = item.len;
+            memcpy(&s->stage[s->staged], &len, sizeof(len));
+            _peek_at(cbuf, &s->stage[s->staged + sizeof(len)], len, at);
+            s->staged += need;
+        }
+        else
+        {
+            s->lost++;
+        }
+        at = _wrap(cbuf, at + item.len + _pad(cbuf, item.len));
+    }
+}
+#endif
+
+#if defined(CBUF_MPSC)
+/** Claim need bytes (header and padding included) at the write index for one producer, racing
+ *  any others. The claimed space starts at *at.
+ *
+ *  Returns false if there isn't enough free space; writers never overwrite in this mode.
+ */
+static bool _claim(cbuf_t *cbuf, uint32_t need, uint32_t *at)
+{
+    if (need >= (cbuf->len - 1))
+    {
+        return false;
+    }
+
+    uint32_t widx = _load_own(cbuf->widx);
+    do {
+        //The reader zeroes space before handing it back by moving the head, so acquire the head
+        if (need > _free_space(cbuf, _load(cbuf->ridx), widx))
+        {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&cbuf->widx, &widx, _wrap(cbuf, widx + need),
+                                                    memory_order_relaxed, memory_order_relaxed));
+    *at = widx;
+    return true;
+}
+
+/** Write the header of the claimed blob at index at with its committed bit set, publishing the
+ *  body written before it to the reader
+ */
+static inline void _publish(cbuf_t *cbuf, uint32_t at, uint32_t len)
+{
+    atomic_store_explicit((_Atomic uint32_t*)&cbuf->buf[at], len | CBUF_COMMITTED_FLAG, memory_order_release);
+}
+#else
+#if defined(CBUF_BLOB_INDEX)
+/** _make_room for a buffer with an offset index. The number of oldest blobs to erase is found with
+ *  a binary search over their start offsets, and they are all erased in a single step.
+ */
+static bool _make_room_indexed(cbuf_t *cbuf, uint32_t need, uint32_t blobs, bool allow_overwrite, uint32_t *overwrite)
+{
+    uint32_t count = cbuf->count;
+    uint32_t widx = cbuf->widx;
+    if (blobs > cbuf->slots)
+    {
+        _STAT(cbuf->stats.rejected_too_large++);
+        return false;
+    }
+
+    //Erasing more blobs only ever frees more space. Find the fewest that leave room for both the
+    //bytes and the index entries. The open blob can't be erased.
+    uint32_t lo = ((count + blobs) > cbuf->slots) ? (count + blobs - cbuf->slots) : 0;
+    uint32_t hi = count;
+    if (need <= _free_space(cbuf, _offset(cbuf, lo), widx))
+    {
+        hi = lo;
+    }
+    else if (need > _free_space(cbuf, _offset(cbuf, hi), widx))
+    {
+        _STAT(cbuf->stats.rejected_no_room++);
+        return false;
+    }
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (need > _free_space(cbuf, _offset(cbuf, mid), widx))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0)
+    {
+        return true;
+    }
+    if (!allow_overwrite)
+    {
+        _STAT(cbuf->stats.rejected_no_room++);
+        return false;
+    }
+
+    _STAT(cbuf->stats.blobs_evicted += lo; cbuf->stats.bytes_evicted += _index_bytes(cbuf, lo));
+
+#if defined(CBUF_SPILL)
+    _spill(cbuf, cbuf->ridx, lo);
+#endif
+    _advance(cbuf, cbuf->ridx, _offset(cbuf, lo), lo);
+    *overwrite += lo;
+    return true;
+}
+#endif
+
+/** Make room at the write index for need bytes (header included), erasing the oldest blobs if
+ *  allowed. Erased blobs are added to *overwrite. blobs is the number of blobs that will be
+ *  completed in that room, which each take an entry in the offset index if there is one.
+ *
+ *  Returns false if the room can't be made.
+ */
+static bool _make_room(cbuf_t *cbuf, uint32_t need, uint32_t blobs, bool allow_overwrite, uint32_t *overwrite)
+{
+    //Ensure we're not writing more than is possible
+    if (need >= (cbuf->len - 1))
+    {
+        _STAT(cbuf->stats.rejected_too_large++);
+        return false;
+    }
+
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets)
+    {
+        return _make_room_indexed(cbuf, need, blobs, allow_overwrite, overwrite);
+    }
+#else
+    (void)blobs;
+#endif
+
+    //Calculate whether writing this much data would cause an overwrite
+    bool would_overwrite = false;
+    uint32_t widx = _load_own(cbuf->widx);
+    uint32_t next_widx = widx + need; //We will account for wrap later on
+    bool wrap = next_widx >= cbuf->len; //True if the index would wrap around the buffer if we added this many to it
+    do {
+        //The reader may advance the head concurrently, which only ever frees space
+        uint32_t ridx = _load(cbuf->ridx);
+
+        //These complicated logic statements are derived from listing every possible case and keeping those that result
+        //in no overwrite. I can't figure out a way to make them smaller.
+        if (    (!wrap && (widx >= ridx) && (next_widx > ridx)) ||
+                (!wrap && (widx < ridx)  && (next_widx < ridx)) ||
+                ( wrap && (widx >= ridx) && (next_widx < (ridx + cbuf->len)))
+           )
+        {
+            would_overwrite = false;
+        }
+        else
+        {
+            would_overwrite = true;
+            if (allow_overwrite)
+            {
+                //Dump the next read message off the queue and repeat the loop until there's no overwrite
+                if ((_load(cbuf->count) == 0) || (ridx == widx))
+                {
+#if defined(CBUF_SPSC)
+                    //The reader emptied the buffer since we looked; recheck the space
+                    continue;
+#else
+                    //If tried to read and failed it's probably because a partial write has exceeded the buffer
+                    //size and the code won't overwrite the same open buffer being written
+                    _STAT(cbuf->stats.rejected_no_room++);
+                    return false;
+#endif
+                }
+                if (!_intact(cbuf))
+                {
+                    //A damaged length would send the eviction off past the queued data. Leave
+                    //the blob for cbuf_resync.
+                    _STAT(cbuf->stats.rejected_no_room++);
+                    return false;
+                }
+                uint32_t len;
+#if defined(CBUF_SPILL)
+                _spill(cbuf, ridx, 1);
+#endif
+                if (_take(cbuf, NULL, ridx, &len))
+                {
+                    (*overwrite)++;
+                    _STAT(cbuf->stats.blobs_evicted++; cbuf->stats.bytes_evicted += len);
+                }
+                //Otherwise the reader consumed that blob first; recheck the space
+            }
+            else
+            {
+                //Not allowed to overwrite
+                _STAT(cbuf->stats.rejected_no_room++);
+                return false;
+            }
+        }
+    } while (would_overwrite);
+
+    return true;
+}
+#endif
+
+/** Write a data blob at the write index, or append it to the open blob. With open_blob set, the
+ *  new blob is instead marked open, with a header large enough for any length it may grow to, and
+ *  isn't counted until it is closed.
+ */
+static bool _write(cbuf_t *cbuf, const void *data, uint32_t data_len, bool open_blob, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    assert(cbuf != NULL);
+
+    //Count of data items overwritten during insertion
+    uint32_t overwrite = 0;
+
+#if defined(CBUF_MPSC)
+    (void)open_blob;
+    //Claim the space, count the blob so the count never lags a blob the reader can see, then
+    //fill in the body and commit it
+    uint32_t at;
+    (void)allow_overwrite;
+    if (!_claim(cbuf, _blob_size(cbuf, data_len), &at))
+    {
+        return false;
+    }
+    bool was_empty = (_inc(cbuf->count) == 0);
+    uint32_t widx = _wrap(cbuf, at + sizeof(cbuf_item_t));
+    _generic_write(cbuf, data, data_len, &widx);
+    _publish(cbuf, at, data_len);
+    _signal_readable(cbuf, was_empty);
+#else
+    //Can't write while a reservation is outstanding; it owns the space at the write index
+    if (cbuf->reserved != CBUF_NO_RESERVATION)
+    {
+        return false;
+    }
+
+    //The blob must stay within what its header can describe
+    cbuf_item_t hdr = {0};
+    uint32_t hsize = open_blob ? CBUF_HEADER_MAX : _hdr_size(data_len);
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        uint32_t hidx = cbuf->hidx;
+        hsize = _hdr_read(cbuf, &hdr, &hidx);
+    }
+#endif
+    if (((uint64_t)hdr.len + data_len) > CBUF_MAX_BLOB_LEN)
+    {
+        _STAT(cbuf->stats.rejected_too_large++);
+        return false;
+    }
+
+    //Make room for the padding too. An open blob isn't padded until it's closed, but the room is
+    //made now so that closing it never has to erase anything. The same goes for the offset index
+    //entry a new blob takes; appends don't need one.
+    uint32_t blobs = 1;
+#if defined(CBUF_ALLOW_PARTIAL)
+    blobs = cbuf->open ? 0 : 1;
+#endif
+    if (!_make_room(cbuf, hsize + data_len + _pad(cbuf, hdr.len + data_len), blobs, allow_overwrite, &overwrite))
+    {
+        return false;
+    }
+    uint32_t widx = _load_own(cbuf->widx);
+
+#if defined(CBUF_ALLOW_PARTIAL)
+    //If we're open, update the length in the existing header
+    if (cbuf->open)
+    {
+        uint32_t hidx = cbuf->hidx;
+        hdr.len += data_len;
+        _hdr_write(cbuf, &hdr, hsize, &hidx);
+    }
+    else
+#endif
+    {
+        //Write the new header. An open blob is stamped again when it's closed.
+        hdr.len = data_len;
+#if defined(CBUF_ALLOW_PARTIAL)
+        hdr.open = open_blob;
+#endif
+        _stamp(cbuf, &hdr);
+        _hdr_write(cbuf, &hdr, hsize, &widx);
+        if (!open_blob)
+        {
+            _STAT(_stat_blob(cbuf, data_len));
+        }
+    }
+
+    //Write the body
+    _generic_write(cbuf, data, data_len, &widx);
+    _STAT(_stat_bytes(cbuf, data_len, widx));
+
+    bool was_empty = false;
+#if defined(CBUF_ALLOW_PARTIAL)
+    //Don't pad or increment the count if we're open already, or have just opened
+    if (!cbuf->open && !open_blob)
+#endif
+    {
+        widx = _wrap(cbuf, widx + _pad(cbuf, data_len));
+        _index_set(cbuf, 0, _load_own(cbuf->widx));
+        _seal(cbuf, _load_own(cbuf->widx));
+
+        //Increment the count
+        was_empty = (_inc(cbuf->count) == 0);
+    }
+
+    //Update the write index only once the blob is complete. This publishes it to the reader
+    _store(cbuf->widx, widx);
+    _signal_readable(cbuf, was_empty);
+#endif
+
+    //output
+    if (count_overwrite)
+    {
+        *count_overwrite = overwrite;
+    }
+
+    return true;
+}
+
+bool cbuf_write(cbuf_t *cbuf, const void *data, uint32_t data_len, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    return _write(cbuf, data, data_len, false, allow_overwrite, count_overwrite);
+}
+
+uint32_t cbuf_write_batch(cbuf_t *cbuf, const cbuf_blob_t *blobs, uint32_t n, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    assert(cbuf != NULL);
+    assert((blobs != NULL) || (n == 0));
+
+    //Count of data items written and overwritten during insertion
+    uint32_t written = 0;
+    uint32_t overwrite = 0;
+
+#if defined(CBUF_ALLOW_PARTIAL)
+    //Writes while open append to the open blob, so there's nothing to batch
+    if (cbuf->open)
+    {
+        for (; written < n; written++)
+        {
+            uint32_t blob_overwrite = 0;
+            if (!cbuf_write(cbuf, blobs[written].data, blobs[written].len, allow_overwrite, &blob_overwrite))
+            {
+                break;
+            }
+            overwrite += blob_overwrite;
+        }
+        n = written;
+    }
+#endif
+
+    //Can't write while a reservation is outstanding; it owns the space at the write index
+    if (cbuf->reserved != CBUF_NO_RESERVATION)
+    {
+        n = 0;
+    }
+
+    while (written < n)
+    {
+        //Take the longest run of blobs that fits in the buffer at once. Writing them one at a time
+        //would never evict any of them, so making room for the run as a whole erases exactly the
+        //blobs the individual writes would have.
+        uint32_t end = written;
+        uint32_t stop = n;
+        uint64_t need = 0;
+#if defined(CBUF_BLOB_INDEX)
+        //Nor can a run hold more blobs than the offset index
+        if (cbuf->offsets && ((n - written) > cbuf->slots))
+        {
+            stop = written + cbuf->slots;
+        }
+#endif
+        while ((end < stop) && (blobs[end].len <= CBUF_MAX_BLOB_LEN) && ((need + _blob_size(cbuf, blobs[end].len)) < (cbuf->len - 1)))
+        {
+            need += _blob_size(cbuf, blobs[end].len);
+            end++;
+        }
+
+        //Without overwrite, a write only succeeds while there's free space for it
+#if defined(CBUF_MPSC)
+        allow_overwrite = false;
+#endif
+        if (!allow_overwrite)
+        {
+            uint32_t free = _free_space(cbuf, _load(cbuf->ridx), _load_own(cbuf->widx));
+            while (need > free)
+            {
+                end--;
+                need -= _blob_size(cbuf, blobs[end].len);
+            }
+#if defined(CBUF_BLOB_INDEX)
+            while (cbuf->offsets && ((cbuf->count + (end - written)) > cbuf->slots))
+            {
+                end--;
+                need -= _blob_size(cbuf, blobs[end].len);
+            }
+#endif
+        }
+
+#if defined(CBUF_MPSC)
+        //Claim the whole run at once so it stays contiguous. Another producer may have taken the
+        //space since we looked; size the run again if so.
+        uint32_t at;
+        if (end == written)
+        {
+            break;
+        }
+        if (!_claim(cbuf, (uint32_t)need, &at))
+        {
+            continue;
+        }
+
+        //Count the run, fill in every body, then commit the blobs in order
+        bool was_empty = (_add(cbuf->count, end - written) == 0);
+        uint32_t widx = at;
+        for (uint32_t i = written; i < end; i++)
+        {
+            uint32_t bidx = _wrap(cbuf, widx + sizeof(cbuf_item_t));
+            _generic_write(cbuf, blobs[i].data, blobs[i].len, &bidx);
+            widx = _wrap(cbuf, widx + _blob_size(cbuf, blobs[i].len));
+        }
+        for (uint32_t i = written; i < end; i++)
+        {
+            _publish(cbuf, at, blobs[i].len);
+            at = _wrap(cbuf, at + _blob_size(cbuf, blobs[i].len));
+        }
+        _signal_readable(cbuf, was_empty);
+        written = end;
+#else
+
+        //Stop at a blob that cbuf_write would have rejected
+        if ((end == written) || !_make_room(cbuf, (uint32_t)need, end - written, allow_overwrite, &overwrite))
+        {
+            break;
+        }
+
+        //Lay out all headers and bodies in one sweep. If the run doesn't reach the wrap point it's
+        //one contiguous area and needs no per-copy wrap handling
+        uint32_t widx = _load_own(cbuf->widx);
+        uint32_t bytes = 0;
+        cbuf_item_t stamp = {0};
+        _stamp(cbuf, &stamp);   //The whole run shares one timestamp
+        if (_first_segment(cbuf, (uint32_t)need, widx) == need)
+        {
+            uint8_t *d = &cbuf->buf[widx];
+            for (uint32_t i = written; i < end; i++)
+            {
+                cbuf_item_t hdr = stamp;
+                uint32_t hsize = _hdr_size(blobs[i].len);
+                hdr.len = blobs[i].len;
+                _index_set(cbuf, i - written, _wrap(cbuf, (uint32_t)(d - cbuf->buf)));
+                _hdr_encode(d, &hdr, hsize);
+                memcpy(d + hsize, blobs[i].data, blobs[i].len);
+                _seal(cbuf, _wrap(cbuf, (uint32_t)(d - cbuf->buf)));
+                d += _blob_size(cbuf, blobs[i].len);
+                _STAT(_stat_blob(cbuf, blobs[i].len); bytes += blobs[i].len);
+            }
+            widx = _wrap(cbuf, widx + (uint32_t)need);
+        }
+        else
+        {
+            for (uint32_t i = written; i < end; i++)
+            {
+                cbuf_item_t hdr = stamp;
+                hdr.len = blobs[i].len;
+                uint32_t at = widx;
+                _index_set(cbuf, i - written, widx);
+                _hdr_write(cbuf, &hdr, _hdr_size(blobs[i].len), &widx);
+                _generic_write(cbuf, blobs[i].data, blobs[i].len, &widx);
+                _seal(cbuf, at);
+                widx = _wrap(cbuf, widx + _pad(cbuf, blobs[i].len));
+                _STAT(_stat_blob(cbuf, blobs[i].len); bytes += blobs[i].len);
+            }
+        }
+        _STAT(_stat_bytes(cbuf, bytes, widx));
+        (void)bytes;
+
+        //Increment the count, then publish the run by updating the write index
+        bool was_empty = (_add(cbuf->count, end - written) == 0);
+        _store(cbuf->widx, widx);
+        _signal_readable(cbuf, was_empty);
+        written = end;
+#endif
+    }
+
+    //output
+    if (count_overwrite)
+    {
+        *count_overwrite = overwrite;
+    }
+
+    return written;
+}
+
+#if !defined(CBUF_MPSC)
+bool cbuf_reserve(cbuf_t *cbuf, uint32_t len, bool allow_overwrite, uint32_t *count_overwrite, cbuf_span_t *span)
+{
+    assert(cbuf != NULL);
+    assert(span != NULL);
+
+    //Count of data items overwritten during insertion
+    uint32_t overwrite = 0;
+
+    //Only one reservation at a time
+    if (cbuf->reserved != CBUF_NO_RESERVATION)
+    {
+        return false;
+    }
+
+#if defined(CBUF_ALLOW_PARTIAL)
+    //The open blob owns the space at the write index
+    if (cbuf->open)
+    {
+        return false;
+    }
+#endif
+
+    //The blob must stay within what its header can describe
+    if (len > CBUF_MAX_BLOB_LEN)
+    {
+        _STAT(cbuf->stats.rejected_too_large++);
+        return false;
+    }
+
+    if (!_make_room(cbuf, _blob_size(cbuf, len), 1, allow_overwrite, &overwrite))
+    {
+        return false;
+    }
+
+    //Hand out the body area just past where the header will go. The header is sized for the
+    //reserved length, since the committed length isn't known yet
+    uint32_t at = _wrap(cbuf, _load_own(cbuf->widx) + _hdr_size(len));
+    uint32_t first = _first_segment(cbuf, len, at);
+    span->seg[0] = &cbuf->buf[at];
+    span->len[0] = first;
+    span->seg[1] = cbuf->buf;
+    span->len[1] = len - first;
+    cbuf->reserved = len;
+
+    //output
+    if (count_overwrite)
+    {
+        *count_overwrite = overwrite;
+    }
+
+    return true;
+}
+
+bool cbuf_commit(cbuf_t *cbuf, uint32_t len)
+{
+    assert(cbuf != NULL);
+
+    if ((cbuf->reserved == CBUF_NO_RESERVATION) || (len > cbuf->reserved))
+    {
+        return false;
+    }
+
+    //The body is already in place; write the header in front of it
+    uint32_t widx = _load_own(cbuf->widx);
+    cbuf_item_t hdr = {0};
+    hdr.len = len;
+    _stamp(cbuf, &hdr);
+    _index_set(cbuf, 0, widx);
+    _hdr_write(cbuf, &hdr, _hdr_size(cbuf->reserved), &widx);
+    _seal(cbuf, _load_own(cbuf->widx));
+    widx = _wrap(cbuf, widx + len + _pad(cbuf, len));
+    cbuf->reserved = CBUF_NO_RESERVATION;
+    _STAT(_stat_blob(cbuf, len); _stat_bytes(cbuf, len, widx));
+
+    //Increment the count, then publish the blob by updating the write index
+    bool was_empty = (_inc(cbuf->count) == 0);
+    _store(cbuf->widx, widx);
+    _signal_readable(cbuf, was_empty);
+    return true;
+}
+
+bool cbuf_abort(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+
+    if (cbuf->reserved == CBUF_NO_RESERVATION)
+    {
+        return false;
+    }
+
+    //Nothing was published, so dropping the reservation is all it takes
+    cbuf->reserved = CBUF_NO_RESERVATION;
+    return true;
+}
+#endif
+
+uint32_t cbuf_read(cbuf_t *cbuf, void *data)
+{
+    assert(cbuf != NULL);
+    uint32_t count;
+    uint32_t ridx;
+    uint32_t len;
+
+    do {
+        count = _load(cbuf->count);
+        ridx  = _load(cbuf->ridx);
+
+        //Check if empty. The count can briefly disagree with the indices while the writer
+        //is mid-update, so report empty as zero rather than the count. A damaged blob reads as
+        //none too, until cbuf_resync skips it.
+        if ((count == 0) || (ridx == _load(cbuf->widx)) || !_ready(cbuf, ridx) || !_intact(cbuf))
+        {
+            return 0;
+        }
+    } while (!_take(cbuf, data, ridx, &len));
+    _STAT(cbuf->stats.blobs_read++; cbuf->stats.bytes_read += len);
+
+    //Return the count of messages we had _before_ the read
+    return count;
+}
+
+uint32_t cbuf_peek(cbuf_t *cbuf, void *data, uint32_t *len)
+{
+    assert(cbuf != NULL);
+    assert(data != NULL);
+    assert(len  != NULL);
+    uint32_t count;
+    uint32_t ridx;
+    uint32_t rlen = 0;
+
+    do {
+        count = _load(cbuf->count);
+        ridx  = _load(cbuf->ridx);
+
+        //Check if empty. The count can briefly disagree with the indices while the writer
+        //is mid-update, so report empty as zero rather than the count
+        if ((count == 0) || (ridx == _load(cbuf->widx)) || !_ready(cbuf, ridx) || !_intact(cbuf))
+        {
+            return 0;
+        }
+
+        //Peek at the header
+        cbuf_item_t item;
+        uint32_t pidx = ridx;
+        _hdr_read(cbuf, &item, &pidx);
+        if (_head_moved(cbuf, ridx))
+        {
+            continue;
+        }
+
+        //Peek the requested data into the output buffer
+        rlen = (*len < item.len) ? *len : item.len;
+        _peek_at(cbuf, data, rlen, pidx);
+    } while (_head_moved(cbuf, ridx));
+
+    *len = rlen;
+    return count;
+}
+
+/** Point a view at the body of len bytes at index at, split at the wrap point */
+static inline void _view(cbuf_t *cbuf, uint32_t at, uint32_t len, cbuf_view_t *view)
+{
+    uint32_t first = _first_segment(cbuf, len, at);
+    view->seg[0] = &cbuf->buf[at];
+    view->len[0] = first;
+    view->seg[1] = cbuf->buf;
+    view->len[1] = len - first;
+}
+
+uint32_t cbuf_peek_nth(cbuf_t *cbuf, uint32_t n, void *data, uint32_t *len)
+{
+    assert(cbuf != NULL);
+    assert(data != NULL);
+    assert(len  != NULL);
+    uint32_t count;
+    uint32_t ridx;
+    uint32_t rlen = 0;
+    bool moved;
+
+    do {
+        count = _load(cbuf->count);
+        ridx  = _load(cbuf->ridx);
+        moved = false;
+
+        //Check if there are enough blobs. The count can briefly disagree with the indices while the
+        //writer is mid-update, so report none rather than the count
+        if ((n >= count) || (ridx == _load(cbuf->widx)))
+        {
+            return 0;
+        }
+
+        //Find the header of the nth blob: straight from the index if there is one, otherwise by
+        //walking the headers in front of it
+        cbuf_item_t item;
+        uint32_t at = ridx;
+#if defined(CBUF_BLOB_INDEX)
+        if (cbuf->offsets)
+        {
+            at = _offset(cbuf, n);
+        }
+        else
+#endif
+        {
+            for (uint32_t i = 0; (i < n) && !moved; i++)
+            {
+                if (!_ready(cbuf, at))
+                {
+                    return 0;
+                }
+                _hdr_read(cbuf, &item, &at);
+                moved = _head_moved(cbuf, ridx);
+                at = _wrap(cbuf, at + item.len + _pad(cbuf, item.len));
+            }
+        }
+        if (moved)
+        {
+            continue;
+        }
+        if (!_ready(cbuf, at))
+        {
+            return 0;
+        }
+
+        //Peek at the header
+        _hdr_read(cbuf, &item, &at);
+        if (_head_moved(cbuf, ridx))
+        {
+            moved = true;
+            continue;
+        }
+
+        //Peek the requested data into the output buffer
+        rlen = (*len < item.len) ? *len : item.len;
+        _peek_at(cbuf, data, rlen, at);
+        moved = _head_moved(cbuf, ridx);
+    } while (moved);
+
+    *len = rlen;
+    return count;
+}
+
+uint32_t cbuf_peek_len(cbuf_t *cbuf, uint32_t *len)
+{
+    assert(cbuf != NULL);
+    uint32_t count;
+    uint32_t ridx;
+    cbuf_item_t item;
+
+    do {
+        count = _load(cbuf->count);
+        ridx  = _load(cbuf->ridx);
+
+        //Check if empty. The count can briefly disagree with the indices while the writer
+        //is mid-update, so report empty as zero rather than the count
+        if ((count == 0) || (ridx == _load(cbuf->widx)) || !_ready(cbuf, ridx) || !_intact(cbuf))
+        {
+            return 0;
+        }
+
+        //Peek at the header
+        uint32_t pidx = ridx;
+        _hdr_read(cbuf, &item, &pidx);
+    } while (_head_moved(cbuf, ridx));
+
+    if (len)
+    {
+        *len = item.len;
+    }
+
+    //Return the count of messages we have now
+    return count;
+}
+
+uint32_t cbuf_peek_view(cbuf_t *cbuf, cbuf_view_t *view)
+{
+    assert(cbuf != NULL);
+    assert(view != NULL);
+    uint32_t count;
+    uint32_t ridx;
+    uint32_t at;
+    cbuf_item_t item;
+
+    do {
+        count = _load(cbuf->count);
+        ridx  = _load(cbuf->ridx);
+
+        //Check if empty. The count can briefly disagree with the indices while the writer
+        //is mid-update, so report empty as zero rather than the count
+        if ((count == 0) || (ridx == _load(cbuf->widx)) || !_ready(cbuf, ridx) || !_intact(cbuf))
+        {
+            return 0;
+        }
+
+        //Peek at the header
+        at = ridx;
+        _hdr_read(cbuf, &item, &at);
+    } while (_head_moved(cbuf, ridx));
+
+    _view(cbuf, at, item.len, view);
+
+    //Return the count of messages we have now
+    return count;
+}
+
+#if defined(CBUF_READERS)
+/** Index of the next blob for a reader. A reader that is level with the head reads from the head. */
+static inline uint32_t _reader_idx(const cbuf_t *cbuf, const cbuf_reader_t *r)
+{
+    return r->ahead ? r->ridx : cbuf->ridx;
+}
+
+uint32_t cbuf_reader_peek_view(cbuf_t *cbuf, uint32_t reader, cbuf_view_t *view)
+{
+    assert(cbuf != NULL);
+    assert(reader < cbuf->nreaders);
+    assert(view != NULL);
+    cbuf_reader_t *r = &cbuf->readers[reader];
+    uint32_t left = cbuf->count - r->ahead;
+
+    if (left == 0)
+    {
+        return 0;
+    }
+
+    cbuf_item_t item;
+    uint32_t at = _reader_idx(cbuf, r);
+    _hdr_read(cbuf, &item, &at);
+    _view(cbuf, at, item.len, view);
+    return left;
+}
+
+uint32_t cbuf_reader_read(cbuf_t *cbuf, uint32_t reader, void *data)
+{
+    assert(cbuf != NULL);
+    assert(reader < cbuf->nreaders);
+    cbuf_reader_t *r = &cbuf->readers[reader];
+    uint32_t left = cbuf->count - r->ahead;
+
+    if (left == 0)
+    {
+        return 0;
+    }
+
+    //Copy the blob out and move this reader past it
+    cbuf_item_t item;
+    uint32_t at = _reader_idx(cbuf, r);
+    _hdr_read(cbuf, &item, &at);
+    _generic_read(cbuf, data, item.len, &at);
+    r->ridx = _wrap(cbuf, at + _pad(cbuf, item.len));
+    r->ahead++;
+    _STAT(cbuf->stats.blobs_read++; cbuf->stats.bytes_read += item.len);
+
+    //Release the blobs every reader is now past. The slowest reader is then level with the head.
+    uint32_t slowest = 0;
+    for (uint32_t i = 1; i < cbuf->nreaders; i++)
+    {
+        if (cbuf->readers[i].ahead < cbuf->readers[slowest].ahead)
+        {
+            slowest = i;
+        }
+    }
+    uint32_t n = cbuf->readers[slowest].ahead;
+    if (n)
+    {
+        _advance(cbuf, cbuf->ridx, cbuf->readers[slowest].ridx, n);
+    }
+    return left;
+}
+
+uint32_t cbuf_reader_lost(cbuf_t *cbuf, uint32_t reader)
+{
+    assert(cbuf != NULL);
+    assert(reader < cbuf->nreaders);
+    uint32_t lost = cbuf->readers[reader].lost;
+    cbuf->readers[reader].lost = 0;
+    return lost;
+}
+#endif
+
+void cbuf_iter_begin(cbuf_t *cbuf, cbuf_iter_t *it)
+{
+    assert(cbuf != NULL);
+    assert(it != NULL);
+    it->left = _load(cbuf->count);
+    it->idx  = _load(cbuf->ridx);
+}
+
+bool cbuf_iter_next(cbuf_t *cbuf, cbuf_iter_t *it, cbuf_view_t *view)
+{
+    assert(cbuf != NULL);
+    assert(it != NULL);
+    assert(view != NULL);
+
+    //The count doesn't include an open blob, so the walk stops in front of it. Also stop at the
+    //write index, which the count can briefly run ahead of, and at an uncommitted blob.
+    if ((it->left == 0) || (it->idx == _load(cbuf->widx)) || !_ready(cbuf, it->idx))
+    {
+        return false;
+    }
+
+    cbuf_item_t item;
+    uint32_t at = it->idx;
+    _hdr_read(cbuf, &item, &at);
+    _view(cbuf, at, item.len, view);
+    it->idx = _wrap(cbuf, at + item.len + _pad(cbuf, item.len));
+    it->left--;
+    return true;
+}
+
+/** Compare len bytes of a view, starting pos bytes into it, to pattern. The range may span both
+ *  segments.
+ */
+static bool _view_equal(const cbuf_view_t *view, uint32_t pos, const uint8_t *pattern, uint32_t len)
+{
+    if (pos >= view->len[0])
+    {
+        return memcmp(view->seg[1] + (pos - view->len[0]), pattern, len) == 0;
+    }
+    uint32_t first = view->len[0] - pos;
+    first = (len < first) ? len : first;
+    return (memcmp(view->seg[0] + pos, pattern, first) == 0) &&
+           (memcmp(view->seg[1], pattern + first, len - first) == 0);
+}
+
+/** Check whether a view starts with, or if prefix is false contains, a pattern of len bytes */
+static bool _view_match(const cbuf_view_t *view, const uint8_t *pattern, uint32_t len, bool prefix)
+{
+    uint32_t total = view->len[0] + view->len[1];
+    if (len > total)
+    {
+        return false;
+    }
+    if (prefix || (len == 0))
+    {
+        return _view_equal(view, 0, pattern, len);
+    }
+
+    //Let memchr, which C libraries vectorize, skip ahead to each occurrence of the first byte of
+    //the pattern, and only compare the whole pattern there. It may run across the wrap point.
+    uint32_t last = total - len;    //Last position the pattern can start at
+    uint32_t base = 0;              //Position of the start of the segment in the view
+    for (uint32_t s = 0; (s < 2) && (base <= last); s++)
+    {
+        const uint8_t *seg = view->seg[s];
+        uint32_t seg_len = (view->len[s] < (last - base + 1)) ? view->len[s] : (last - base + 1);
+        const uint8_t *p = seg;
+        while ((p = memchr(p, pattern[0], seg_len - (uint32_t)(p - seg))) != NULL)
+        {
+            if (_view_equal(view, base + (uint32_t)(p - seg), pattern, len))
+            {
+                return true;
+            }
+            p++;
+        }
+        base += view->len[s];
+    }
+    return false;
+}
+
+bool cbuf_iter_find(cbuf_t *cbuf, cbuf_iter_t *it, const void *pattern, uint32_t len, bool prefix, cbuf_view_t *view)
+{
+    assert((pattern != NULL) || (len == 0));
+
+    while (cbuf_iter_next(cbuf, it, view))
+    {
+        if (_view_match(view, (const uint8_t*)pattern, len, prefix))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t cbuf_consume(cbuf_t *cbuf, uint32_t n)
+{
+    assert(cbuf != NULL);
+    uint32_t done;
+    uint32_t ridx;
+    uint32_t idx;
+    uint32_t bytes;
+    bool moved;
+
+#if defined(CBUF_BLOB_INDEX)
+    //The index gives the end of the last blob to remove directly
+    if (cbuf->offsets)
+    {
+        done = (n < cbuf->count) ? n : cbuf->count;
+        _STAT(cbuf->stats.blobs_read += done; cbuf->stats.bytes_read += _index_bytes(cbuf, done));
+        _advance(cbuf, cbuf->ridx, _offset(cbuf, done), done);
+        return done;
+    }
+#endif
+
+    do {
+        uint32_t count = _load(cbuf->count);
+        uint32_t widx  = _load(cbuf->widx);
+        ridx  = _load(cbuf->ridx);
+        idx   = ridx;
+        bytes = 0;
+        moved = false;
+
+        //Walk the headers of up to n blobs without touching their bodies
+        for (done = 0; (done < n) && (done < count) && (idx != widx) && _ready(cbuf, idx); done++)
+        {
+            cbuf_item_t item;
+            _hdr_read(cbuf, &item, &idx);
+            if (_head_moved(cbuf, ridx))
+            {
+                moved = true;
+                break;
+            }
+            idx = _wrap(cbuf, idx + item.len + _pad(cbuf, item.len));
+            bytes += item.len;
+        }
+    } while (moved || !_advance(cbuf, ridx, idx, done));
+    _STAT(cbuf->stats.blobs_read += done; cbuf->stats.bytes_read += bytes);
+    (void)bytes;
+
+    return done;
+}
+
+uint32_t cbuf_read_batch(cbuf_t *cbuf, void *arena, uint32_t arena_len, uint32_t *offsets, uint32_t *lens, uint32_t max_blobs)
+{
+    assert(cbuf != NULL);
+    assert((arena != NULL) || (arena_len == 0));
+    assert(lens != NULL);
+    uint8_t *d = (uint8_t*)arena;
+    uint32_t done;
+    uint32_t ridx;
+    uint32_t idx;
+    uint32_t used;
+    bool moved;
+
+    do {
+        uint32_t count = _load(cbuf->count);
+        uint32_t widx  = _load(cbuf->widx);
+        used  = 0;
+        ridx  = _load(cbuf->ridx);
+        idx   = ridx;
+        moved = false;
+
+        //Copy whole blobs back to back into the arena until it, the output arrays or the buffer run out
+        for (done = 0; (done < max_blobs) && (done < count) && (idx != widx) && _ready(cbuf, idx); done++)
+        {
+            cbuf_item_t item;
+            uint32_t hidx = idx;
+            _hdr_read(cbuf, &item, &idx);
+            if (_head_moved(cbuf, ridx))
+            {
+                moved = true;
+                break;
+            }
+            if (item.len > (arena_len - used))
+            {
+                //Doesn't fit; leave it for the next batch
+                idx = hidx;
+                break;
+            }
+            _generic_read(cbuf, d + used, item.len, &idx);
+            idx = _wrap(cbuf, idx + _pad(cbuf, item.len));
+            if (offsets)
+            {
+                offsets[done] = used;
+            }
+            lens[done] = item.len;
+            used += item.len;
+        }
+    } while (moved || !_advance(cbuf, ridx, idx, done));
+    _STAT(cbuf->stats.blobs_read += done; cbuf->stats.bytes_read += used);
+
+    return done;
+}
+
+#if defined(CBUF_CRC)
+bool cbuf_corrupt(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    return (cbuf->count != 0) && !_intact(cbuf);
+}
+
+uint32_t cbuf_resync(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    if (!cbuf_corrupt(cbuf))
+    {
+        return 0;
+    }
+
+    //Blobs end at the open blob, if there is one
+    uint32_t end = cbuf->widx;
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        end = cbuf->hidx;
+    }
+#endif
+
+    //Headers only ever start at aligned positions. Try each one after the damaged blob until one
+    //holds a blob that fits and passes its check.
+    uint32_t at = cbuf->ridx;
+    do {
+        at = _wrap(cbuf, at + _align(cbuf));
+    } while ((at != end) && !_valid_at(cbuf, at));
+    uint32_t skipped = (at >= cbuf->ridx) ? (at - cbuf->ridx) : (cbuf->len - cbuf->ridx + at);
+
+    //Count the blobs that follow on from it. If the chain breaks again, the break counts as one
+    //more blob, so reads stop there and report it.
+    uint32_t count = 0;
+    uint32_t idx = at;
+    while (idx != end)
+    {
+#if defined(CBUF_BLOB_INDEX)
+        if (cbuf->offsets)
+        {
+            if (count == cbuf->slots)
+            {
+                break;
+            }
+            cbuf->offsets[count] = idx;
+        }
+#endif
+        count++;
+        if (!_valid_at(cbuf, idx))
+        {
+            break;
+        }
+        cbuf_item_t item;
+        _hdr_read(cbuf, &item, &idx);
+        idx = _wrap(cbuf, idx + item.len + _pad(cbuf, item.len));
+    }
+
+#if defined(CBUF_BLOB_INDEX)
+    cbuf->ohead = 0;
+#endif
+#if defined(CBUF_FD)
+    cbuf->sent = 0;
+#endif
+    cbuf->ridx    = at;
+    cbuf->count   = count;
+    cbuf->checked = false;
+    return skipped;
+}
+#endif
+
+#if defined(CBUF_TIMESTAMP)
+void cbuf_set_clock(cbuf_t *cbuf, uint64_t (*clock)(void))
+{
+    assert(cbuf != NULL);
+    cbuf->clock = clock;
+    _rebase(cbuf);
+}
+
+bool cbuf_peek_ts(cbuf_t *cbuf, uint32_t n, uint64_t *ts)
+{
+    assert(cbuf != NULL);
+    assert(ts != NULL);
+
+    if (n >= cbuf->count)
+    {
+        return false;
+    }
+
+    //Find the header of the nth blob: straight from the index if there is one, otherwise by walking
+    //the headers in front of it
+    uint32_t at = cbuf->ridx;
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets)
+    {
+        at = _offset(cbuf, n);
+    }
+    else
+#endif
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            cbuf_item_t item;
+            _hdr_read(cbuf, &item, &at);
+            at = _wrap(cbuf, at + item.len + _pad(cbuf, item.len));
+        }
+    }
+    *ts = _ts_at(cbuf, at);
+    return true;
+}
+
+uint32_t cbuf_iter_range(cbuf_t *cbuf, uint64_t t0, uint64_t t1, cbuf_iter_t *it)
+{
+    assert(cbuf != NULL);
+    assert(it != NULL);
+    uint32_t end;
+
+    //Start at the first blob stamped at t0 or later, and stop in front of the first stamped at t1 or later
+    uint32_t first = _ts_rank(cbuf, t0, &it->idx);
+    uint32_t last  = (t1 > t0) ? _ts_rank(cbuf, t1, &end) : first;
+    it->left = last - first;
+    return it->left;
+}
+
+uint32_t cbuf_expire_older_than(cbuf_t *cbuf, uint64_t t)
+{
+    assert(cbuf != NULL);
+    uint32_t at;
+    uint32_t n = _ts_rank(cbuf, t, &at);
+
+#if defined(CBUF_STATS)
+    //Count the expired blobs as erased. Only the statistics need their lengths.
+    uint32_t idx = cbuf->ridx;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        cbuf_item_t item;
+        _hdr_read(cbuf, &item, &idx);
+        idx = _wrap(cbuf, idx + item.len + _pad(cbuf, item.len));
+        cbuf->stats.bytes_evicted += item.len;
+    }
+    cbuf->stats.blobs_evicted += n;
+#endif
+
+    //Drop them all in one step
+    _advance(cbuf, cbuf->ridx, at, n);
+    return n;
+}
+#endif
+
+#if defined(CBUF_FD)
+/** Bytes _make_room can find at the write index: the free space, or with allow_overwrite all of
+ *  the buffer but the open blob and the byte that is always kept free
+ */
+static uint32_t _room(const cbuf_t *cbuf, bool allow_overwrite)
+{
+    uint32_t widx = _load_own(cbuf->widx);
+    if (!allow_overwrite)
+    {
+        return _free_space(cbuf, _load(cbuf->ridx), widx);
+    }
+    uint32_t keep = 1;
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        keep = (widx >= cbuf->hidx) ? (widx - cbuf->hidx) : (cbuf->len - cbuf->hidx + widx);
+    }
+#endif
+    return cbuf->len - 1 - keep;
+}
+
+/** Point iovecs at len bytes of buffer memory from index at, split at the wrap point.
+ *  Returns the number of iovecs used. Empty segments are left out.
+ */
+static uint32_t _iov(cbuf_t *cbuf, uint32_t at, uint32_t len, struct iovec *iov)
+{
+    uint32_t first = _first_segment(cbuf, len, at);
+    uint32_t n = 0;
+    if (first)
+    {
+        iov[n].iov_base = &cbuf->buf[at];
+        iov[n++].iov_len = first;
+    }
+    if (len - first)
+    {
+        iov[n].iov_base = cbuf->buf;
+        iov[n++].iov_len = len - first;
+    }
+    return n;
+}
+
+int32_t cbuf_write_from_fd(cbuf_t *cbuf, int fd, uint32_t max, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    assert(cbuf != NULL);
+    struct iovec iov[2];
+    uint32_t overwrite = 0;
+    ssize_t got;
+
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        //The open blob must stay within what its header can describe
+        cbuf_item_t hdr;
+        uint32_t hidx = cbuf->hidx;
+        uint32_t hsize = _hdr_read(cbuf, &hdr, &hidx);
+        uint32_t room = _room(cbuf, allow_overwrite);
+        uint32_t fit = (room < (CBUF_MAX_BLOB_LEN - hdr.len)) ? room : (CBUF_MAX_BLOB_LEN - hdr.len);
+
+        //Take no more than fits, padding included
+        while ((fit > 0) && ((fit + _pad(cbuf, hdr.len + fit)) > room))
+        {
+            fit--;
+        }
+        max = (max < fit) ? max : fit;
+
+        //Make room for max more bytes, and for the padding once it's closed, as an append would
+        if ((fit == 0) || !_make_room(cbuf, max + _pad(cbuf, hdr.len + max), 0, allow_overwrite, &overwrite))
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        uint32_t widx = _load_own(cbuf->widx);
+        got = readv(fd, iov, _iov(cbuf, widx, max, iov));
+        if (got > 0)
+        {
+            //Grow the open blob by what arrived
+            hdr.len += got;
+            hidx = cbuf->hidx;
+            _hdr_write(cbuf, &hdr, hsize, &hidx);
+            widx = _wrap(cbuf, widx + got);
+            _STAT(_stat_bytes(cbuf, got, widx));
+            _store(cbuf->widx, widx);
+        }
+    }
+    else
+#endif
+    {
+        //Take no more than fits in one blob, header and padding included
+        uint32_t room = _room(cbuf, allow_overwrite);
+        uint32_t fit = (room > CBUF_HEADER_MAX) ? (room - CBUF_HEADER_MAX) : 0;
+        fit = (fit < CBUF_MAX_BLOB_LEN) ? fit : CBUF_MAX_BLOB_LEN;
+        while ((fit > 0) && (_blob_size(cbuf, fit) > room))
+        {
+            fit--;
+        }
+        max = (max < fit) ? max : fit;
+
+        //Read straight into the body of a reserved blob, and publish whatever arrived
+        cbuf_span_t span;
+        if ((fit == 0) || !cbuf_reserve(cbuf, max, allow_overwrite, &overwrite, &span))
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        iov[0].iov_base = span.seg[0];
+        iov[0].iov_len  = span.len[0];
+        iov[1].iov_base = span.seg[1];
+        iov[1].iov_len  = span.len[1];
+        got = readv(fd, iov, span.len[1] ? 2 : 1);
+        if (got > 0)
+        {
+            cbuf_commit(cbuf, got);
+        }
+        else
+        {
+            cbuf_abort(cbuf);
+        }
+    }
+
+    //output
+    if (count_overwrite)
+    {
+        *count_overwrite = overwrite;
+    }
+
+    return got;
+}
+
+int32_t cbuf_write_to_fd(cbuf_t *cbuf, int fd, uint32_t max_blobs, bool raw)
+{
+    assert(cbuf != NULL);
+    struct iovec iov[2 * CBUF_FD_BLOBS];
+    uint32_t ends[CBUF_FD_BLOBS];   //Index just past each blob
+    uint32_t sizes[CBUF_FD_BLOBS];  //Bytes each blob puts out
+    uint32_t lens[CBUF_FD_BLOBS];   //Body length of each blob
+    uint32_t count = _load(cbuf->count);
+    uint32_t ridx  = _load(cbuf->ridx);
+    uint32_t widx  = _load(cbuf->widx);
+    uint32_t iovs  = 0;
+    uint32_t n;
+
+    //Pick up where the last call left off if the kernel only took part of the head blob. The
+    //head moving since then means that blob is gone, and cleared sent.
+    uint32_t skip = (cbuf->sidx == ridx) ? _load(cbuf->sent) : 0;
+
+    //Gather the bodies of up to max_blobs blobs, or the whole run of blobs as stored
+    max_blobs = (max_blobs < CBUF_FD_BLOBS) ? max_blobs : CBUF_FD_BLOBS;
+    uint32_t idx = ridx;
+    for (n = 0; (n < max_blobs) && (n < count) && (idx != widx) && _ready(cbuf, idx); n++)
+    {
+        cbuf_item_t item;
+        uint32_t at = idx;
+        _hdr_read(cbuf, &item, &at);
+        ends[n] = _wrap(cbuf, at + item.len + _pad(cbuf, item.len));
+        lens[n] = item.len;
+        if (raw)
+        {
+            //Measured rather than computed, as a blob that was opened keeps its largest header
+            sizes[n] = (ends[n] > idx) ? (ends[n] - idx) : (cbuf->len - idx + ends[n]);
+        }
+        else
+        {
+            uint32_t from = (n == 0) ? skip : 0;
+            sizes[n] = item.len;
+            iovs += _iov(cbuf, _wrap(cbuf, at + from), item.len - from, &iov[iovs]);
+        }
+        idx = ends[n];
+    }
+    if (raw && n)
+    {
+        uint32_t run = (idx > ridx) ? (idx - ridx) : (cbuf->len - ridx + idx);
+        iovs = _iov(cbuf, _wrap(cbuf, ridx + skip), run - skip, iov);
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    //Blobs with empty bodies have nothing to send, but are still consumed
+    ssize_t put = iovs ? writev(fd, iov, iovs) : 0;
+    if (put < 0)
+    {
+        return -1;
+    }
+
+    //Consume the blobs the kernel took all of, and remember how far into the next one it got
+    uint32_t left = skip + put;
+    uint32_t done = 0;
+    uint32_t bytes = 0;
+    while ((done < n) && (left >= sizes[done]))
+    {
+        left -= sizes[done];
+        bytes += lens[done];
+        done++;
+    }
+    if (done && _advance(cbuf, ridx, ends[done - 1], done))
+    {
+        _STAT(cbuf->stats.blobs_read += done; cbuf->stats.bytes_read += bytes);
+        ridx = ends[done - 1];
+    }
+    (void)bytes;
+    cbuf->sidx = ridx;
+    _store(cbuf->sent, left);
+
+    return put;
+}
+#endif
+
+#if !defined(CBUF_ATOMIC)
+/** Index that index idx of the buffer moves to when the buffer is linearized into len bytes, with
+ *  the head at origin
+ */
+static inline uint32_t _relocate(const cbuf_t *cbuf, uint32_t idx, uint32_t origin, uint32_t len)
+{
+    uint32_t ridx = cbuf->ridx;
+    uint32_t rel = (idx >= ridx) ? (idx - ridx) : (cbuf->len - ridx + idx);
+    return (origin + rel) % len;
+}
+
+bool cbuf_resize(cbuf_t *cbuf, uint8_t *mem, uint32_t len, uint32_t *count_overwrite)
+{
+    assert(cbuf != NULL);
+    assert(mem != NULL);
+    uint32_t overwrite = 0;
+
+#if defined(CBUF_POW2)
+    if ((len == 0) || ((len & (len - 1)) != 0))
+    {
+        return false;
+    }
+#endif
+#if defined(CBUF_MIRROR)
+    if (cbuf->mirror)
+    {
+        return false;
+    }
+#endif
+#if defined(CBUF_PERSIST)
+    //A file-backed buffer's memory sits right after its own header in the mapping
+    if (cbuf->buf == ((uint8_t*)cbuf - offsetof(cbuf_file_t, cbuf) + CBUF_FILE_DATA))
+    {
+        return false;
+    }
+#endif
+    //The alignment of the bodies has to carry over
+    if ((len < (2 * _align(cbuf))) || ((len % _align(cbuf)) != 0) || (((uintptr_t)mem % _align(cbuf)) != 0) ||
+        (cbuf->reserved != CBUF_NO_RESERVATION))
+    {
+        return false;
+    }
+
+    //The open blob moves too, and has to keep room to be padded when it's closed
+    uint32_t pending = 0;
+#if defined(CBUF_ALLOW_PARTIAL)
+    if (cbuf->open)
+    {
+        cbuf_item_t hdr;
+        uint32_t hidx = cbuf->hidx;
+        _hdr_read(cbuf, &hdr, &hidx);
+        pending = _pad(cbuf, hdr.len);
+        uint32_t open_len = (cbuf->widx >= cbuf->hidx) ? (cbuf->widx - cbuf->hidx) : (cbuf->len - cbuf->hidx + cbuf->widx);
+        if ((open_len + pending) > (len - 1))
+        {
+            return false;
+        }
+    }
+#endif
+
+    //Erase the oldest blobs, as an overwriting write would, until the rest fits. One byte stays
+    //free so that a full buffer can't look empty.
+    while (true)
+    {
+        uint32_t ridx = cbuf->ridx;
+        uint32_t used = (cbuf->widx >= ridx) ? (cbuf->widx - ridx) : (cbuf->len - ridx + cbuf->widx);
+        if ((used + pending) <= (len - 1))
+        {
+            break;
+        }
+        uint32_t blen;
+#if defined(CBUF_SPILL)
+        _spill(cbuf, ridx, 1);
+#endif
+        _take(cbuf, NULL, ridx, &blen);
+        overwrite++;
+        _STAT(cbuf->stats.blobs_evicted++; cbuf->stats.bytes_evicted += blen);
+    }
+
+    //Copy everything between the head and the write index to the start of the new memory, in at
+    //most three pieces: the source and the destination can each wrap once
+    uint32_t origin = _origin(cbuf);
+    uint32_t from = cbuf->ridx;
+    uint32_t at = origin;
+    uint32_t left = (cbuf->widx >= from) ? (cbuf->widx - from) : (cbuf->len - from + cbuf->widx);
+    uint32_t widx = (origin + left) % len;
+    while (left)
+    {
+        uint32_t n = left;
+        n = (n < (cbuf->len - from)) ? n : (cbuf->len - from);
+        n = (n < (len - at)) ? n : (len - at);
+        memcpy(&mem[at], &cbuf->buf[from], n);
+        from = (from + n) % cbuf->len;
+        at = (at + n) % len;
+        left -= n;
+    }
+
+    //Move every index that points into the buffer along with the data
+#if defined(CBUF_ALLOW_PARTIAL)
+    cbuf->hidx = _relocate(cbuf, cbuf->hidx, origin, len);
+#endif
+#if defined(CBUF_BLOB_INDEX)
+    if (cbuf->offsets)
+    {
+        for (uint32_t i = 0; i < cbuf->count; i++)
+        {
+            cbuf->offsets[_slot(cbuf, i)] = _relocate(cbuf, cbuf->offsets[_slot(cbuf, i)], origin, len);
+        }
+    }
+#endif
+#if defined(CBUF_READERS)
+    for (uint32_t i = 0; i < cbuf->nreaders; i++)
+    {
+        cbuf->readers[i].ridx = _relocate(cbuf, cbuf->readers[i].ridx, origin, len);
+    }
+#endif
+#if defined(CBUF_FD)
+    cbuf->sidx = _relocate(cbuf, cbuf->sidx, origin, len);
+#endif
+    cbuf->ridx = origin;
+    cbuf->widx = widx;
+    cbuf->buf  = mem;
+    cbuf->len  = len;
+#if defined(CBUF_CRC)
+    cbuf->checked = false;
+#endif
+#if defined(CBUF_STATS)
+    uint32_t used = (widx >= origin) ? (widx - origin) : (len - origin + widx);
+    cbuf->stats.high_water = (cbuf->stats.high_water < used) ? cbuf->stats.high_water : used;
+#endif
+
+    //output
+    if (count_overwrite)
+    {
+        *count_overwrite = overwrite;
+    }
+
+    return true;
+}
+#endif
+
+#if defined(CBUF_STATS)
+uint32_t cbuf_suggest_len(cbuf_t *cbuf, uint32_t min_len, uint32_t max_len)
+{
+    assert(cbuf != NULL);
+    uint32_t len = cbuf->len;
+    uint32_t high = cbuf->stats.high_water;
+
+    //Double a buffer that came close to filling up, and halve one that stayed mostly empty. The gap
+    //between the two thresholds keeps a buffer from flapping between sizes.
+    uint64_t target = len;
+    if (high > (len / 4 * 3))
+    {
+        target = (uint64_t)len * 2;
+    }
+    else if (high < (len / 4))
+    {
+        target = len / 2;
+    }
+    target = (target + _align(cbuf) - 1) / _align(cbuf) * _align(cbuf);
+    target = (target < min_len) ? min_len : (target > max_len) ? max_len : target;
+
+    //The next period starts from what is in use now
+    uint32_t ridx = _load(cbuf->ridx);
+    uint32_t widx = _load(cbuf->widx);
+    cbuf->stats.high_water = (widx >= ridx) ? (widx - ridx) : (len - ridx + widx);
+    return (uint32_t)target;
+}
+#endif
+
+#if defined(CBUF_SPILL)
+bool cbuf_init_spill(cbuf_t *cbuf, int fd, uint8_t *stage, uint32_t stage_len)
+{
+    assert(cbuf != NULL);
+    assert((stage != NULL) || (stage_len == 0));
+
+    //The segment file starts out empty
+    if ((fd >= 0) && (ftruncate(fd, 0) != 0))
+    {
+        return false;
+    }
+    memset(&cbuf->spill, 0, sizeof(cbuf->spill));
+    cbuf->spill.fd        = fd;
+    cbuf->spill.stage     = ((fd >= 0) && stage_len) ? stage : NULL;
+    cbuf->spill.stage_len = stage_len;
+    return true;
+}
+
+int32_t cbuf_spill_flush(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    cbuf_spill_t *s = &cbuf->spill;
+    uint32_t len = s->staged - s->shead;
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    //Append everything staged in one write. After a short write the segment ends where it did, so
+    //the rest is written over it on the next try and the file never holds a partial blob.
+    ssize_t put = pwrite(s->fd, &s->stage[s->shead], len, (off_t)s->woff);
+    if (put != (ssize_t)len)
+    {
+        errno = (put < 0) ? errno : EIO;
+        return -1;
+    }
+    s->woff += len;
+    s->shead = 0;
+    s->staged = 0;
+    return len;
+}
+
+bool cbuf_read_replay(cbuf_t *cbuf, void *data, uint32_t *len)
+{
+    assert(cbuf != NULL);
+    assert(len != NULL);
+    cbuf_spill_t *s = &cbuf->spill;
+    uint32_t blen;
+
+    //Oldest first: the blobs in the segment file, then the ones staged for it, then the buffer
+    if (s->roff < s->woff)
+    {
+        if ((pread(s->fd, &blen, sizeof(blen), (off_t)s->roff) != sizeof(blen)) ||
+            (pread(s->fd, data, blen, (off_t)(s->roff + sizeof(blen))) != (ssize_t)blen))
+        {
+            return false;
+        }
+        s->roff += sizeof(blen) + blen;
+        if (s->roff == s->woff)
+        {
+            //Everything spilled has been replayed, so the next flush starts the segment over. The
+            //file is only ever read up to woff, so what's left of it past there doesn't matter.
+            s->roff = 0;
+            s->woff = 0;
+        }
+    }
+    else if (s->shead < s->staged)
+    {
+        memcpy(&blen, &s->stage[s->shead], sizeof(blen));
+        memcpy(data, &s->stage[s->shead + sizeof(blen)], blen);
+        s->shead += sizeof(blen) + blen;
+    }
+    else if (cbuf_peek_len(cbuf, &blen))
+    {
+        cbuf_read(cbuf, data);
+    }
+    else
+    {
+        return false;
+    }
+
+    *len = blen;
+    return true;
+}
+
+uint32_t cbuf_spill_lost(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    uint32_t lost = cbuf->spill.lost;
+    cbuf->spill.lost = 0;
+    return lost;
+}
+#endif
+
+#if defined(CBUF_POOL)
+/** Round a length up to a multiple of CBUF_POOL_ALIGN */
+static inline uint64_t _pool_round(uint64_t len)
+{
+    return (len + CBUF_POOL_ALIGN - 1) & ~(uint64_t)(CBUF_POOL_ALIGN - 1);
+}
+
+/** Words in the ready bitmap of a pool of rings rings */
+static inline uint32_t _pool_words(uint32_t rings)
+{
+    return (rings + 63) / 64;
+}
+
+/** Bytes of arena in front of the memory of the first ring: the metadata table, the ready bitmap
+ *  and the free stack, each starting on a cache line
+ */
+static inline uint64_t _pool_meta(uint32_t rings)
+{
+    return _pool_round((uint64_t)rings * sizeof(cbuf_t)) +
+           _pool_round((uint64_t)_pool_words(rings) * sizeof(uint64_t)) +
+           _pool_round((uint64_t)rings * sizeof(uint32_t));
+}
+
+uint64_t cbuf_pool_size(uint32_t rings, uint32_t ring_len)
+{
+    return _pool_meta(rings) + (uint64_t)rings * _pool_round(ring_len);
+}
+
+bool cbuf_pool_init(cbuf_pool_t *pool, void *arena, uint32_t rings, uint32_t ring_len)
+{
+    assert(pool != NULL);
+    assert(arena != NULL);
+    uint8_t *a = (uint8_t*)arena;
+
+#if defined(CBUF_POW2)
+    if ((ring_len & (ring_len - 1)) != 0)
+    {
+        return false;
+    }
+#endif
+    if ((((uintptr_t)arena % CBUF_POOL_ALIGN) != 0) || (ring_len == 0) || (_pool_round(ring_len) > UINT32_MAX))
+    {
+        return false;
+    }
+
+    //The metadata of every ring is packed into one table at the start of the arena, so a sweep over
+    //the rings touches consecutive cache lines. The memory of each ring starts on a cache line of
+    //its own, so that rings written by different threads never share one.
+    pool->rings    = (cbuf_t*)a;
+    a += _pool_round((uint64_t)rings * sizeof(cbuf_t));
+    pool->ready    = (uint64_t*)a;
+    a += _pool_round((uint64_t)_pool_words(rings) * sizeof(uint64_t));
+    pool->free     = (uint32_t*)a;
+    pool->mem      = (uint8_t*)arena + _pool_meta(rings);
+    pool->nrings   = rings;
+    pool->ring_len = ring_len;
+    pool->stride   = (uint32_t)_pool_round(ring_len);
+    memset(pool->ready, 0, (size_t)_pool_words(rings) * sizeof(uint64_t));
+
+    //Hand out the lowest ids first, so the rings in use gather at the front of the table. A free
+    //ring has no buffer memory, so that freeing it again can be caught.
+    for (uint32_t i = 0; i < rings; i++)
+    {
+        pool->free[i] = rings - 1 - i;
+        pool->rings[i].buf = NULL;
+    }
+    pool->nfree = rings;
+    return true;
+}
+
+cbuf_t *cbuf_pool_alloc(cbuf_pool_t *pool, uint32_t *id)
+{
+    assert(pool != NULL);
+    assert(id != NULL);
+
+    if (pool->nfree == 0)
+    {
+        return NULL;
+    }
+    *id = pool->free[--pool->nfree];
+    cbuf_t *ring = &pool->rings[*id];
+    cbuf_init(ring, pool->mem + (uint64_t)*id * pool->stride, pool->ring_len);
+    return ring;
+}
+
+bool cbuf_pool_free(cbuf_pool_t *pool, uint32_t id)
+{
+    assert(pool != NULL);
+
+    //Pushing an id that is already on the free stack would hand its ring out twice
+    if ((id >= pool->nrings) || (pool->rings[id].buf == NULL))
+    {
+        return false;
+    }
+    assert(pool->nfree < pool->nrings);
+
+    pool->rings[id].buf = NULL;
+    pool->ready[id / 64] &= ~(1ull << (id % 64));
+    pool->free[pool->nfree++] = id;
+    return true;
+}
+
+cbuf_t *cbuf_pool_ring(cbuf_pool_t *pool, uint32_t id)
+{
+    assert(pool != NULL);
+    assert(id < pool->nrings);
+    return &pool->rings[id];
+}
+
+bool cbuf_pool_write(cbuf_pool_t *pool, uint32_t id, const void *data, uint32_t data_len, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    if (!cbuf_write(cbuf_pool_ring(pool, id), data, data_len, allow_overwrite, count_overwrite))
+    {
+        return false;
+    }
+    cbuf_pool_mark(pool, id);
+    return true;
+}
+
+void cbuf_pool_mark(cbuf_pool_t *pool, uint32_t id)
+{
+    assert(pool != NULL);
+    assert(id < pool->nrings);
+    pool->ready[id / 64] |= 1ull << (id % 64);
+}
+
+bool cbuf_pool_next_ready(cbuf_pool_t *pool, uint32_t *id)
+{
+    assert(pool != NULL);
+    assert(id != NULL);
+
+    if (*id >= pool->nrings)
+    {
+        return false;
+    }
+
+    //Skip 64 idle rings per word; bits past the last ring are never set
+    uint32_t w = *id / 64;
+    uint64_t bits = pool->ready[w] & (~0ull << (*id % 64));
+    while (bits == 0)
+    {
+        if (++w >= _pool_words(pool->nrings))
+        {
+            return false;
+        }
+        bits = pool->ready[w];
+    }
+    uint32_t bit = __builtin_ctzll(bits);
+    pool->ready[w] &= ~(1ull << bit);
+    *id = w * 64 + bit;
+    return true;
+}
+#endif
+
+#if defined(CBUF_STATS)
+void cbuf_stats(cbuf_t *cbuf, cbuf_stats_t *stats)
+{
+    assert(cbuf != NULL);
+    assert(stats != NULL);
+    *stats = cbuf->stats;
+}
+
+void cbuf_stats_reset(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    uint64_t open_start = cbuf->stats.open_start;
+    memset(&cbuf->stats, 0, sizeof(cbuf->stats));
+    cbuf->stats.open_start = open_start;
+}
+#endif
+
+uint32_t cbuf_count(cbuf_t *cbuf)
+{
+    return _load(cbuf->count);
+}
+
+#if defined(CBUF_WAIT)
+/** Turn a timeout in milliseconds into a CLOCK_MONOTONIC deadline in *ts. Returns ts, or NULL for
+ *  a negative timeout, which never expires.
+ */
+static const struct timespec *_deadline(struct timespec *ts, int32_t timeout_ms)
+{
+    if (timeout_ms < 0)
+    {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static bool _expired(const struct timespec *deadline)
+{
+    struct timespec now;
+    if (!deadline)
+    {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec > deadline->tv_sec) ||
+           ((now.tv_sec == deadline->tv_sec) && (now.tv_nsec >= deadline->tv_nsec));
+}
+
+bool cbuf_wait_readable(cbuf_t *cbuf, int32_t timeout_ms)
+{
+    assert(cbuf != NULL);
+    struct timespec ts;
+    const struct timespec *deadline = _deadline(&ts, timeout_ms);
+    bool readable;
+
+    atomic_fetch_add(&cbuf->rwait, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (1)
+    {
+        //Same test cbuf_read uses for empty
+        uint32_t ridx = _load(cbuf->ridx);
+        uint32_t count = _load(cbuf->count);
+        readable = (count != 0) && (ridx != _load(cbuf->widx)) && _ready(cbuf, ridx);
+        if (readable || _expired(deadline))
+        {
+            break;
+        }
+
+        if (count != 0)
+        {
+            //A writer has counted a blob but not published it yet. It won't wake us, as the
+            //buffer is no longer empty, and it won't be long.
+            sched_yield();
+        }
+        else
+        {
+            //Writers wake the count on the empty to non-empty transition
+            _futex_wait(&cbuf->count, 0, deadline);
+        }
+    }
+    atomic_fetch_sub(&cbuf->rwait, 1);
+
+    return readable;
+}
+
+bool cbuf_wait_writable(cbuf_t *cbuf, uint32_t len, int32_t timeout_ms)
+{
+    assert(cbuf != NULL);
+    struct timespec ts;
+    const struct timespec *deadline = _deadline(&ts, timeout_ms);
+    uint32_t need = _blob_size(cbuf, len);
+    bool writable;
+
+    //Same limit cbuf_write uses
+    if (need >= (cbuf->len - 1))
+    {
+        return false;
+    }
+
+    atomic_fetch_add(&cbuf->wwait, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (1)
+    {
+        uint32_t ridx = _load(cbuf->ridx);
+        writable = (need <= _free_space(cbuf, ridx, _load(cbuf->widx)));
+        if (writable || _expired(deadline))
+        {
+            break;
+        }
+
+        //Readers wake the read index whenever they move it
+        _futex_wait(&cbuf->ridx, ridx, deadline);
+    }
+    atomic_fetch_sub(&cbuf->wwait, 1);
+
+    return writable;
+}
+
+int cbuf_eventfd(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    if (cbuf->efd < 0)
+    {
+        cbuf->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+    return cbuf->efd;
+}
+
+void cbuf_deinit_wait(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    if (cbuf->efd >= 0)
+    {
+        close(cbuf->efd);
+        cbuf->efd = -1;
+    }
+}
+#endif
+
+#if defined(CBUF_ALLOW_PARTIAL)
+/** Start a blob that is open for partial writes, holding the first len bytes of its body */
+static bool _open(cbuf_t *cbuf, const void *data, uint32_t len, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    if (cbuf->open || (cbuf->reserved != CBUF_NO_RESERVATION))
+    {
+        return false;
+    }
+    cbuf->hidx = _load_own(cbuf->widx);
+
+    //Write the header, marked as "open". It isn't counted until it's closed
+    if (!_write(cbuf, data, len, true, allow_overwrite, count_overwrite))
+    {
+        //Failed to write (likely because an overwrite would be required)
+        return false;
+    }
+    _STAT(cbuf->stats.open_start = _now_ns());
+
+    //Now that the header is written, mark the blob as open
+    cbuf->open = true;
+    return true;
+}
+
+bool cbuf_open(cbuf_t *cbuf, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    return _open(cbuf, NULL, 0, allow_overwrite, count_overwrite);
+}
+
+bool cbuf_close(cbuf_t *cbuf)
+{
+    if (cbuf->open)
+    {
+        //Clear the open flag from the header, keeping its size, and stamp it now that it's complete
+        cbuf_item_t item;
+        uint32_t hidx = cbuf->hidx;
+        uint32_t hsize = _hdr_read(cbuf, &item, &hidx);
+        item.open = 0;
+        _stamp(cbuf, &item);
+        hidx = cbuf->hidx;
+        _hdr_write(cbuf, &item, hsize, &hidx);
+        _seal(cbuf, cbuf->hidx);
+        _STAT(_stat_blob(cbuf, item.len); cbuf->stats.open_ns += _now_ns() - cbuf->stats.open_start);
+
+        //Pad it out so the next body is aligned. The appends made room for this
+        _store(cbuf->widx, _wrap(cbuf, _load_own(cbuf->widx) + _pad(cbuf, item.len)));
+        //Increment the count on the buffer and indicate closed. cbuf_open made room for its index entry
+        _index_set(cbuf, 0, cbuf->hidx);
+        _inc(cbuf->count);
+        cbuf->open = false;
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+uint32_t cbuf_ingest(cbuf_t *cbuf, const void *data, uint32_t len, uint8_t delim, bool allow_overwrite, uint32_t *count_overwrite)
+{
+    assert(cbuf != NULL);
+    assert((data != NULL) || (len == 0));
+    const uint8_t *src = data;
+    uint32_t done = 0;
+    uint32_t overwrite = 0;
+
+    while (done < len)
+    {
+        //Each piece runs up to and including the next delimiter, or to the end of the data
+        const uint8_t *end = memchr(&src[done], delim, len - done);
+        uint32_t piece = end ? (uint32_t)(end - &src[done]) + 1 : (len - done);
+        uint32_t erased = 0;
+        bool res;
+
+        if (cbuf->open)
+        {
+            //Continue the blob left open by the last call, and close it if it's now complete
+            res = _write(cbuf, &src[done], piece, false, allow_overwrite, &erased);
+            if (res && end)
+            {
+                cbuf_close(cbuf);
+            }
+        }
+        else if (end)
+        {
+            //A whole blob: one header, one copy
+            res = _write(cbuf, &src[done], piece, false, allow_overwrite, &erased);
+        }
+        else
+        {
+            //The trailing bytes wait in an open blob for the rest of their line
+            res = _open(cbuf, &src[done], piece, allow_overwrite, &erased);
+        }
+
+        overwrite += erased;
+        if (!res)
+        {
+            break;
+        }
+        done += piece;
+    }
+
+    if (count_overwrite)
+    {
+        *count_overwrite = overwrite;
+    }
+    return done;
+}
+#endif /* defined(CBUF_ALLOW_PARTIAL) */
+
+#if defined(CBUF_TEST)
+void cbuf_viz(cbuf_t *cbuf)
+{
+    assert(cbuf != NULL);
+    const uint32_t W = 120; //Width of characters to display
+    uint32_t cur_widx = _load(cbuf->widx);
+    uint32_t cur_ridx = _load(cbuf->ridx);
+    uint32_t widx = W * cur_widx / cbuf->len;
+    uint32_t ridx = W * cur_ridx / cbuf->len;
+    char v[W + 1];
+
+    //Draw the Write pointer
+    //printf("%*s%c%*s\n", widx, "", 'W', (cbuf->len - widx - 1), "");
+    printf("%*s%c (%d)\n", widx, "", 'W', cur_widx);
+
+    //Draw a horizontal line
+    memset(v, '-', W);
+    v[W] = '\0';
+
+    //Draw a represenation of the buffer contents on the horizontal line
+    //Walk a local copy of the read index so we can read it non-destructively
+    uint32_t at = cur_ridx;
+    while (1)
+    {
+        //Stop at the write index, or at a blob a producer hasn't committed yet
+        if ((at == cur_widx) || !_ready(cbuf, at)) break;
+
+        //read out the data to get the start and end indices
+        cbuf_item_t item;
+        uint32_t item_idx = W * at / cbuf->len;
+        _hdr_read(cbuf, &item, &at);
+
+#if defined(CBUF_ALLOW_PARTIAL)
+        if (item.open)
+        {
+            //Item is open and being written
+            uint32_t end_idx = W * cur_widx / cbuf->len;
+
+            //Draw the data on the line
+            for (uint32_t idx=item_idx; idx != end_idx; idx = (idx + 1) % W)
+            {
+                v[idx] = '*';
+            }
+            v[item_idx] = '|';
+
+            //Done reading if we're at the open blob
+            break;
+        }
+        else
+#endif
+        {
+            _generic_read(cbuf, NULL, item.len + _pad(cbuf, item.len), &at);
+            uint32_t end_idx = W * at / cbuf->len;
+
+            //Draw the data on the line
+            for (uint32_t idx=item_idx; idx != end_idx; idx = (idx + 1) % W)
+            {
+                v[idx] = '=';
+            }
+            v[item_idx] = '|';
+        }
+
+        if (at == cur_ridx) break;
+    }
+    printf("%s\n", v);
+
+    //Draw the read pointer
+    printf("%*s%c (%d)\n", ridx, "", 'R', cur_ridx);
+}
+#endif
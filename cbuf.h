@@ -1,98 +1,832 @@
-#ifndef __CBUF_H__
-#define __CBUF_H__
-
-#include <stdint.h>
-#include <stdbool.h>
-
-/** Here we define a circular buffer into which data of arbitrary length can be written at once.
- *  If writing that data would cause the buffer to wrap, one or more of the oldest messages are
- *  erased, if allowed.
- *
- *  Data is written and read into the buffer as arbitrary-length items. The whole item must be
- *  written or read at once. Ensure your pointers have sufficient space to do so.
- *
- *  To provide thread-safety, the caller of these functions should wrap them in appropriate mutexes.
- */
-
-/** If CBUF_ALLOW_PARTIAL is defined, the cbuf also allows a secondary mode where the buffer can be
- * "opened" for multiple sequential writes that aren't the full buffer size. This would allow using
- * it similar to a standard circular buffer, while still maintaining the arbitrary-length behavior.
- * When "open" reads are still allowed but buffer-writes are blocked. cbuf_read will not read the
- * currently open buffer
- */
-//#define CBUF_ALLOW_PARTIAL
-
-/** Structure that holds the metadata for a circular buffer */
-typedef struct {
-    uint32_t ridx;      //Read index
-    uint32_t widx;      //Write index
-    uint32_t count;     //Count of items in the buffer
-    uint32_t len;       //Length of buffer (in bytes)
-    uint8_t *buf;       //Pointer to buffer memory
-#if defined(CBUF_ALLOW_PARTIAL)
-    uint8_t  open;      //True if the cbuf is open for partial writes
-    uint32_t hidx;      //Index to the header of the open item
-#endif
-} cbuf_t;
-
-/** Intialize a circular buffer struct.
- *    cbuf         pointer to the circular buffer struct
- *    mem          pointer to the memory space that will store the data
- *    len          length of the memory space, in bytes
- */
-void cbuf_init(cbuf_t *cbuf, uint8_t *mem, uint32_t len);
-
-/** Write a data blob to the circular buffer
-*    cbuf         pointer to the circular buffer struct
-*    data         data to write to the buffer
-*    data_len     length of the data to write, in bytes
-*    allow_overwrite    set true if the write operation can overwrite old data to write new data
-*    count_overwrite    returns the number of old messages erased to make room for the new data
-* Returns true if the data was written, false otherwise.
-*/
-bool cbuf_write(cbuf_t *cbuf, const void *data, uint32_t data_len, bool allow_overwrite, uint32_t *count_overwrite);
-
-/** Read a data blob from the circular buffer
-*    cbuf         pointer to the circular buffer struct
-*    data         data to read from the buffer. Use cbuf_peek_len() first to get the length of this data
-*                 Can be NULL to remove the next item from the buffer without storing it elsewhere
-* Returns the number of messages on the buffer _before_ the read.
-*/
-uint32_t cbuf_read(cbuf_t *cbuf, void *data);
-
-/** Reads some or all of the next data blob from the circular buffer, WITHOUT consuming the blob
-*    cbuf         pointer to the circular buffer struct
-*    data         data to read from the buffer. Use cbuf_peek_len() first to get the max length of this data
-*    len          (in) length of the data buffer / (out) actual number of bytes written
-* Returns the number of messages on the buffer, including the one being peeked at
-*/
-uint32_t cbuf_peek(cbuf_t *cbuf, void *data, uint32_t *len);
-
-/** Get the length of the next data blob to be read from the circular buffer
-*    cbuf         pointer to the circular buffer struct
-*    len          length of the data
-* Returns the number of messages on the buffer.
-*/
-uint32_t cbuf_peek_len(cbuf_t *cbuf, uint32_t *len);
-
-/** Returns the number of data blobs in the circular buffer */
-uint32_t cbuf_count(cbuf_t *cbuf);
-
-#if defined(CBUF_TEST)
-/** Print a visualization of the buffer state to the screen. Looks super cool, but really for debug only. */
-void cbuf_viz(cbuf_t *cbuf);
-#endif
-
-#if defined(CBUF_ALLOW_PARTIAL)
-/** Open a blob for multiple sequential writes using cbuf_write.
- *  Returns true if successful
- */
-bool cbuf_open(cbuf_t *cbuf, bool allow_overwrite, uint32_t *count_overwrite);
-
-/** Close the currently open buffer and mark is as a complete blob.
- *  Returns true if successful */
-bool cbuf_close(cbuf_t *cbuf);
-#endif
-
-#endif
-
+#ifndef __CBUF_H__
+#define __CBUF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Here we define a circular buffer into which data of arbitrary length can be written at once.
+ *  If writing that data would cause the buffer to wrap, one or more of the oldest messages are
+ *  erased, if allowed.
+ *
+ *  Data is written and read into the buffer as arbitrary-length items. The whole item must be
+ *  written or read at once. Ensure your pointers have sufficient space to do so.
+ *
+ *  To provide thread-safety, the caller of these functions should wrap them in appropriate mutexes.
+ */
+
+/** If CBUF_ALLOW_PARTIAL is defined, the cbuf also allows a secondary mode where the buffer can be
+ * "opened" for multiple sequential writes that aren't the full buffer size. This would allow using
+ * it similar to a standard circular buffer, while still maintaining the arbitrary-length behavior.
+ * When "open" reads are still allowed but buffer-writes are blocked. cbuf_read will not read the
+ * currently open buffer
+ */
+//#define CBUF_ALLOW_PARTIAL
+
+/** If CBUF_POW2 is defined, the length passed to cbuf_init must be a power of two. Index wrapping
+ * then becomes a mask instead of a compare-and-subtract.
+ */
+//#define CBUF_POW2
+
+/** Every blob is stored behind a header holding its length. By default the header is 4 bytes. For
+ * rings of small blobs, one of these shrinks it:
+ *   CBUF_HEADER_16      2-byte header. Blobs are limited to 65535 bytes, or 32767 with CBUF_ALLOW_PARTIAL
+ *   CBUF_HEADER_VARINT  1 byte for blobs under 128 bytes (64 with CBUF_ALLOW_PARTIAL), growing by a
+ *                       byte per 7 bits of length. An open blob's header is written at its largest
+ *                       size so it can be updated in place as the blob grows.
+ * Neither is available with CBUF_MPSC, which relies on the 4-byte header.
+ */
+//#define CBUF_HEADER_16
+//#define CBUF_HEADER_VARINT
+
+/** Largest blob that the header can describe */
+#if defined(CBUF_HEADER_16) && defined(CBUF_ALLOW_PARTIAL)
+#define CBUF_MAX_BLOB_LEN   0x7FFFu
+#elif defined(CBUF_HEADER_16)
+#define CBUF_MAX_BLOB_LEN   0xFFFFu
+#elif defined(CBUF_ALLOW_PARTIAL) || defined(CBUF_MPSC)
+#define CBUF_MAX_BLOB_LEN   0x7FFFFFFFu
+#else
+#define CBUF_MAX_BLOB_LEN   0xFFFFFFFFu
+#endif
+
+/** If CBUF_ALIGN is defined, cbuf_set_align can make every blob body start at a multiple of 8, 16,
+ * 64 or any other power of two bytes from the start of the buffer memory, so that consumers can
+ * access structs or use aligned vector loads on blobs in place through cbuf_peek_view (and write
+ * them through cbuf_reserve). Each header sits right in front of its body, and each body is
+ * followed by padding up to the next aligned header position. Reads skip the padding, and writes
+ * count it in the room they make. A body that wraps is still split at the wrap point, unless the
+ * buffer is mirrored. Not available with CBUF_HEADER_VARINT, whose header size varies.
+ */
+//#define CBUF_ALIGN
+
+/** If CBUF_BLOB_INDEX is defined, cbuf_init_index can attach an offset index to a buffer: a ring of
+ * the start offsets of the queued blobs, in caller-provided memory, kept up to date by every write
+ * and read. Making room for a write in overwrite mode then finds how many of the oldest blobs to
+ * erase with a binary search and erases them in one step, instead of reading their headers one at
+ * a time. cbuf_peek_nth and cbuf_consume take constant time. The index holds a fixed number of
+ * blobs; a full index counts as a full buffer. Not available with CBUF_SPSC or CBUF_MPSC.
+ */
+//#define CBUF_BLOB_INDEX
+
+/** If CBUF_READERS is defined, cbuf_init_readers can attach several independent readers to a
+ * buffer, so one writer can feed the same blobs to each of them without copying them into separate
+ * buffers. Each reader has its own read index and reads with cbuf_reader_read; a blob is removed
+ * once every reader is past it. A write that needs the space of blobs some readers haven't read yet
+ * erases them if allow_overwrite is set, and those readers skip ahead and count the loss (see
+ * cbuf_reader_lost); otherwise it fails. cbuf_read and cbuf_consume still remove the oldest blob
+ * for everyone. Not available with CBUF_SPSC or CBUF_MPSC.
+ */
+//#define CBUF_READERS
+
+/** If CBUF_SPSC is defined, cbuf_write, cbuf_read, cbuf_peek, cbuf_peek_len and cbuf_count are safe
+ * to call without external locking as long as there is exactly one writing thread and one reading
+ * thread. The indices become atomics, each on its own cache line.
+ *
+ * In overwrite mode the writer evicts the oldest blobs itself. A reader that was copying an evicted
+ * blob notices and retries on the new oldest blob, so a read never returns torn data. The head can
+ * change between cbuf_peek_len and cbuf_read, so the reader's buffer must fit the largest blob the
+ * writer produces.
+ */
+//#define CBUF_SPSC
+
+/** If CBUF_MPSC is defined, any number of threads may call cbuf_write and cbuf_write_batch at once,
+ * alongside one thread reading with cbuf_read, cbuf_peek, cbuf_peek_len, cbuf_peek_view,
+ * cbuf_consume and cbuf_read_batch, all without external locking.
+ *
+ * Writers claim space by atomically advancing the write index, fill it independently, and then
+ * publish each blob by setting the committed bit in its header. The reader stops at the first blob
+ * that isn't committed yet, and zeroes the space of the blobs it removes so a new claim never sees
+ * stale headers. Blobs are padded to 4 bytes so that a header never straddles the wrap point.
+ *
+ * Writers never overwrite in this mode: allow_overwrite is ignored and a write fails when the
+ * buffer is full. cbuf_reserve/cbuf_commit/cbuf_abort are not available.
+ */
+//#define CBUF_MPSC
+
+#if defined(CBUF_SPSC) || defined(CBUF_MPSC)
+#define CBUF_ATOMIC     //Indices are atomics shared between threads
+#endif
+
+/** If CBUF_WAIT is defined along with CBUF_SPSC or CBUF_MPSC, threads can block instead of polling
+ * (Linux only). cbuf_wait_readable sleeps until there is a blob to read, and cbuf_wait_writable
+ * until a blob of a given length fits without overwriting. cbuf_eventfd hands out an eventfd that
+ * becomes readable whenever the buffer goes from empty to non-empty, for use with poll/epoll.
+ *
+ * Writers only make a system call on the empty to non-empty transition, and only if someone is
+ * waiting or an eventfd exists. Readers only make one when a writer is waiting for space.
+ */
+//#define CBUF_WAIT
+
+/** If CBUF_MIRROR is defined, cbuf_init_mirror is available (Linux only). It allocates the buffer
+ * from a memfd mapped twice, back to back, so the data just past the end of the buffer is the data
+ * at its start. Every blob is then one contiguous range: reads and writes are a single copy, and
+ * spans and views never have a second segment, so blobs can be accessed in place.
+ */
+//#define CBUF_MIRROR
+
+/** If CBUF_PERSIST is defined, a buffer can live in a memory-mapped file (POSIX only), so its
+ * contents survive the process. cbuf_open_file maps the file and returns a cbuf_t that sits in the
+ * file next to its buffer memory; every other function works on it as usual.
+ *
+ * If the process died without cbuf_close_file, the indices are rebuilt on the next open by walking
+ * the blob headers from the read index up to the write index, without moving any data:
+ *   - a blob that doesn't end within the write index is dropped, along with anything after it
+ *   - an open partial blob is closed, keeping the bytes that made it into the buffer
+ *   - an outstanding reservation is dropped
+ */
+//#define CBUF_PERSIST
+
+/** If CBUF_FD is defined, data can move between the buffer and a file descriptor (POSIX only)
+ * without passing through another buffer. cbuf_write_from_fd reads with readv straight into the
+ * free space, as a new blob or appended to the open partial blob. cbuf_write_to_fd sends queued
+ * blobs with writev, either their bodies alone or as stored, headers included, and consumes only
+ * the blobs the kernel took all of. Not available with CBUF_MPSC.
+ */
+//#define CBUF_FD
+
+/** If CBUF_SPILL is defined, cbuf_init_spill can keep the blobs that overwriting writes erase
+ * instead of dropping them (POSIX only). Each erased blob is copied into a caller-provided stage in
+ * memory, and cbuf_spill_flush appends everything staged to a segment file in one write, so writes
+ * never do file I/O themselves. cbuf_read_replay then reads the blobs in the order they were
+ * written: those in the file, those still staged, and then those in the buffer. Blobs that don't
+ * fit in the stage are lost, and counted (see cbuf_spill_lost). Not available with CBUF_SPSC or
+ * CBUF_MPSC.
+ */
+//#define CBUF_SPILL
+
+/** If CBUF_POOL is defined, cbuf_pool_init can manage many rings of one size class, e.g. one per
+ * connection, in a single caller-provided arena. The metadata of all rings sits back to back in one
+ * table, cache-line aligned, followed by the buffer memory of each ring. Rings are allocated and
+ * freed in constant time from a stack of free ids. A bitmap marks the rings written through
+ * cbuf_pool_write (or cbuf_pool_mark), so cbuf_pool_next_ready can sweep the non-empty rings a
+ * 64-bit word at a time instead of looking at every ring. Rings of other sizes go in other pools.
+ * Not available with CBUF_SPSC or CBUF_MPSC, whose metadata is padded out to cache lines.
+ */
+//#define CBUF_POOL
+
+/** If CBUF_TIMESTAMP is defined, every blob header also holds a 64-bit timestamp, taken when the
+ * blob is completed (by cbuf_write, cbuf_write_batch, cbuf_commit or cbuf_close) from the monotonic
+ * clock in nanoseconds, or from the function given to cbuf_set_clock. Since timestamps never
+ * decrease from the oldest blob to the newest, cbuf_iter_range can find the blobs of a time range
+ * and cbuf_expire_older_than can drop stale ones without reading any bodies; with an offset index
+ * (CBUF_BLOB_INDEX) both are binary searches. A clock that starts behind the stamps already in the
+ * buffer, like the monotonic clock when CBUF_PERSIST reopens a file after a reboot, is offset to
+ * carry on from the newest one. Adds 8 bytes to every header. Not available with CBUF_SPSC or
+ * CBUF_MPSC.
+ */
+//#define CBUF_TIMESTAMP
+
+/** If CBUF_CRC is defined, every blob header ends in a CRC32C of the rest of the header and the
+ * body, filled in as the blob is completed. cbuf_read, cbuf_peek, cbuf_peek_len and cbuf_peek_view
+ * check the oldest blob first: if its length runs past the queued data or its CRC doesn't match,
+ * they return 0 as if the buffer were empty, cbuf_corrupt returns true, and cbuf_resync skips ahead
+ * to the next intact blob. Meant for buffers in shared memory or files (CBUF_PERSIST), where
+ * cbuf_recover also cuts the buffer back at the first damaged blob. Overwriting writes also check
+ * each blob they erase, unless an offset index (CBUF_BLOB_INDEX) knows where it ends, and fail
+ * rather than erase a damaged one. The other reads trust the headers. Adds 4 bytes to every header.
+ *
+ * The CRC uses the SSE4.2 crc32 instruction when built with it (e.g. -msse4.2) on x86-64, the ARMv8
+ * CRC32 instructions when built with them (e.g. -march=armv8-a+crc), and slicing-by-8 tables
+ * otherwise. Not available with CBUF_SPSC, CBUF_MPSC or CBUF_READERS.
+ */
+//#define CBUF_CRC
+
+/** If CBUF_STATS is defined, every cbuf_t keeps running statistics, read with cbuf_stats. With
+ * CBUF_SPSC each counter is only updated by one side, but a snapshot taken while both sides are
+ * running may be slightly out of date. Without CBUF_STATS the statistics cost nothing.
+ */
+//#define CBUF_STATS
+
+#if defined(CBUF_STATS)
+#define CBUF_STATS_BUCKETS  32  //Size histogram buckets: bucket b counts blobs of 2^(b-1) to 2^b - 1 bytes
+
+/** Runtime statistics of a circular buffer */
+typedef struct {
+    uint64_t blobs_written;         //Blobs completed by cbuf_write, cbuf_write_batch, cbuf_commit and cbuf_close
+    uint64_t bytes_written;         //Payload bytes written, including appends to an open blob
+    uint64_t blobs_read;            //Blobs removed by cbuf_read, cbuf_consume and cbuf_read_batch
+    uint64_t bytes_read;            //Payload bytes of those blobs
+    uint64_t blobs_evicted;         //Blobs erased to make room for new data
+    uint64_t bytes_evicted;         //Payload bytes of those blobs
+    uint64_t rejected_too_large;    //Writes refused because they could never fit
+    uint64_t rejected_no_room;      //Writes refused because making room wasn't allowed or possible
+    uint64_t size_hist[CBUF_STATS_BUCKETS]; //Completed blobs by size
+    uint64_t open_ns;               //Total time blobs have spent open for partial writes (ns)
+    uint64_t open_start;            //When the currently open blob was opened (ns, internal)
+    uint32_t high_water;            //Most bytes ever in use, headers included
+} cbuf_stats_t;
+#endif
+
+#if defined(CBUF_ATOMIC)
+#include <stdatomic.h>
+#define CBUF_CACHELINE  64
+#define CBUF_INDEX      _Alignas(CBUF_CACHELINE) _Atomic uint32_t
+#define CBUF_CONST      _Alignas(CBUF_CACHELINE)
+#else
+#define CBUF_INDEX      uint32_t
+#define CBUF_CONST
+#endif
+
+#if defined(CBUF_SPILL)
+/** Where the erased blobs of a buffer go */
+typedef struct {
+    int      fd;        //Segment file, or -1
+    uint8_t *stage;     //Blobs erased since the last flush, each a 4-byte length and a body, or NULL
+    uint32_t stage_len; //Length of the stage (in bytes)
+    uint32_t staged;    //Bytes in the stage
+    uint32_t shead;     //Bytes at the start of the stage already replayed
+    uint32_t lost;      //Blobs that didn't fit in the stage, since cbuf_spill_lost
+    uint64_t woff;      //Length of the segment file
+    uint64_t roff;      //Offset in the segment file of the next blob to replay
+} cbuf_spill_t;
+#endif
+
+#if defined(CBUF_READERS)
+/** Position of one reader of a buffer with several readers */
+typedef struct {
+    uint32_t ridx;      //Read index, when ahead isn't zero
+    uint32_t ahead;     //Blobs this reader has read that are still in the buffer for the others
+    uint32_t lost;      //Blobs erased before this reader got to them, since cbuf_reader_lost
+} cbuf_reader_t;
+#endif
+
+/** Structure that holds the metadata for a circular buffer */
+typedef struct {
+    CBUF_INDEX ridx;    //Read index
+    CBUF_INDEX widx;    //Write index
+    CBUF_INDEX count;   //Count of items in the buffer
+    CBUF_CONST uint32_t len; //Length of buffer (in bytes)
+    uint8_t *buf;       //Pointer to buffer memory
+    uint32_t reserved;  //Length of the outstanding cbuf_reserve, or CBUF_NO_RESERVATION
+#if defined(CBUF_ALIGN)
+    uint32_t align;     //Blob bodies start at a multiple of this many bytes
+#endif
+#if defined(CBUF_BLOB_INDEX)
+    uint32_t *offsets;  //Ring of the header indices of the queued blobs, or NULL
+    uint32_t slots;     //Length of the offsets ring (in entries)
+    uint32_t ohead;     //Entry of the oldest blob in the offsets ring
+#endif
+#if defined(CBUF_SPILL)
+    cbuf_spill_t spill; //Stage and segment file for erased blobs
+#endif
+#if defined(CBUF_READERS)
+    cbuf_reader_t *readers; //Independent readers, or NULL
+    uint32_t nreaders;  //Number of readers
+#endif
+#if defined(CBUF_MIRROR)
+    bool     mirror;    //True if buf is mapped twice, back to back
+#endif
+#if defined(CBUF_ALLOW_PARTIAL)
+    uint8_t  open;      //True if the cbuf is open for partial writes
+    uint32_t hidx;      //Index to the header of the open item
+#endif
+#if defined(CBUF_CRC)
+    bool     checked;   //True once the oldest blob has passed its CRC check
+#endif
+#if defined(CBUF_TIMESTAMP)
+    uint64_t (*clock)(void); //Source of blob timestamps, or NULL for the monotonic clock (ns)
+    uint64_t epoch;     //Added to the clock so it never stamps behind the newest blob
+#endif
+#if defined(CBUF_FD)
+    uint32_t sidx;      //Read index of the blob cbuf_write_to_fd sent part of
+    CBUF_INDEX sent;    //Bytes of that blob already sent. Cleared whenever the head moves
+#endif
+#if defined(CBUF_STATS)
+    cbuf_stats_t stats; //Runtime statistics
+#endif
+#if defined(CBUF_WAIT)
+    _Atomic uint32_t rwait; //Count of threads in cbuf_wait_readable
+    _Atomic uint32_t wwait; //Count of threads in cbuf_wait_writable
+    int      efd;       //eventfd signalled when the buffer becomes non-empty, or -1
+#endif
+} cbuf_t;
+
+#define CBUF_NO_RESERVATION 0xFFFFFFFFu
+
+#if defined(CBUF_POOL)
+#define CBUF_POOL_ALIGN     64  //Alignment of the arena, the metadata table and every ring's memory
+
+/** A pool of rings of one size, carved out of one arena */
+typedef struct {
+    cbuf_t   *rings;    //Table of ring metadata, one per id
+    uint64_t *ready;    //Bitmap of the rings that may have blobs to read
+    uint32_t *free;     //Stack of the ids of free rings
+    uint8_t  *mem;      //Buffer memory of ring 0. That of ring id is id * stride bytes on
+    uint32_t nrings;    //Number of rings
+    uint32_t ring_len;  //Length of each ring's buffer memory (in bytes)
+    uint32_t stride;    //Distance between the buffer memory of consecutive rings (in bytes)
+    uint32_t nfree;     //Number of ids on the free stack
+} cbuf_pool_t;
+#endif
+
+/** One blob of a batch write */
+typedef struct {
+    const void *data;   //Data to write
+    uint32_t len;       //Length of the data, in bytes
+} cbuf_blob_t;
+
+/** A writable region of buffer memory, split in up to two segments at the wrap point.
+ *  The second segment has zero length if the region doesn't wrap.
+ */
+typedef struct {
+    uint8_t *seg[2];    //Start of each segment
+    uint32_t len[2];    //Length of each segment (in bytes)
+} cbuf_span_t;
+
+/** A read-only view of a blob's body in buffer memory, split in up to two segments at the wrap point.
+ *  The second segment has zero length if the blob doesn't wrap.
+ */
+typedef struct {
+    const uint8_t *seg[2];  //Start of each segment
+    uint32_t len[2];        //Length of each segment (in bytes)
+} cbuf_view_t;
+
+/** A position in a walk over the blobs in a circular buffer, from the oldest to the newest */
+typedef struct {
+    uint32_t idx;       //Index of the header of the next blob
+    uint32_t left;      //Number of blobs left to walk
+} cbuf_iter_t;
+
+/** Intialize a circular buffer struct.
+ *    cbuf         pointer to the circular buffer struct
+ *    mem          pointer to the memory space that will store the data
+ *    len          length of the memory space, in bytes
+ */
+void cbuf_init(cbuf_t *cbuf, uint8_t *mem, uint32_t len);
+
+#if !defined(CBUF_SPSC) && !defined(CBUF_MPSC)
+/** Move a circular buffer to new memory of a different length, keeping its blobs, their order, and
+ *  any open blob. The blobs are copied once, linearized so that the oldest starts the new memory.
+ *  If they don't all fit, the oldest are erased as an overwriting write would. Iterators and views
+ *  don't survive it. Not for mirrored or file-backed buffers.
+ *    cbuf         pointer to the circular buffer struct
+ *    mem          pointer to the new memory. It must not overlap the old
+ *    len          length of the new memory, in bytes
+ *    count_overwrite    returns the number of old messages erased to make it fit
+ *  Returns true if successful, after which the old memory is no longer used. Returns false, changing
+ *  nothing, if there is an outstanding reservation, the open blob doesn't fit, or the memory can't
+ *  keep the buffer's alignment.
+ */
+bool cbuf_resize(cbuf_t *cbuf, uint8_t *mem, uint32_t len, uint32_t *count_overwrite);
+#endif
+
+#if defined(CBUF_ALIGN)
+/** Align every blob body in the buffer memory. Call it on an empty buffer, right after cbuf_init,
+ *  cbuf_init_mirror or cbuf_open_file.
+ *    cbuf         pointer to the circular buffer struct
+ *    align        alignment in bytes, a power of two. The buffer memory and its length must be
+ *                 multiples of it. With CBUF_MPSC it must be at least 4
+ *  Returns true if successful, or false if the alignment can't be used or the buffer isn't empty.
+ */
+bool cbuf_set_align(cbuf_t *cbuf, uint32_t align);
+#endif
+
+#if defined(CBUF_BLOB_INDEX)
+/** Attach an offset index to a circular buffer. Blobs already in the buffer are indexed.
+ *    cbuf         pointer to the circular buffer struct
+ *    offsets      memory for the index, one entry per blob
+ *    slots        number of entries. At most this many blobs can be in the buffer at once
+ *  Returns true if successful, or false if the buffer already holds more blobs than that.
+ *  Release the index by attaching one with no slots.
+ */
+bool cbuf_init_index(cbuf_t *cbuf, uint32_t *offsets, uint32_t slots);
+#endif
+
+#if defined(CBUF_READERS)
+/** Attach independent readers to a circular buffer. Each starts with every blob already queued
+ *  still to read. A buffer reopened by cbuf_open_file has none until they are attached again.
+ *    cbuf         pointer to the circular buffer struct
+ *    readers      memory for the readers, one entry each
+ *    n            number of readers. Detach them by attaching none
+ *  Returns true if successful.
+ */
+bool cbuf_init_readers(cbuf_t *cbuf, cbuf_reader_t *readers, uint32_t n);
+
+/** Read the next blob for one reader. The blob is removed once every reader has read it.
+ *    cbuf         pointer to the circular buffer struct
+ *    reader       the reader, from 0 to the number of readers - 1
+ *    data         data to read from the buffer. Use cbuf_reader_peek_view first to get its length
+ *                 Can be NULL to skip the blob
+ *  Returns the number of blobs this reader had left to read _before_ the read.
+ */
+uint32_t cbuf_reader_read(cbuf_t *cbuf, uint32_t reader, void *data);
+
+/** Point a view at the next blob for one reader, WITHOUT consuming it
+ *    cbuf         pointer to the circular buffer struct
+ *    reader       the reader
+ *    view         returns the blob body, in up to two segments
+ *  Returns the number of blobs this reader has left to read, including the one being viewed.
+ */
+uint32_t cbuf_reader_peek_view(cbuf_t *cbuf, uint32_t reader, cbuf_view_t *view);
+
+/** Get the number of blobs erased before one reader could read them, and reset it */
+uint32_t cbuf_reader_lost(cbuf_t *cbuf, uint32_t reader);
+#endif
+
+#if defined(CBUF_MIRROR)
+/** Intialize a circular buffer struct with a newly allocated, mirrored buffer.
+ *    cbuf         pointer to the circular buffer struct
+ *    len          length of the buffer, in bytes. Rounded up to a whole number of pages
+ *  Returns true if successful. Release the buffer with cbuf_deinit_mirror.
+ */
+bool cbuf_init_mirror(cbuf_t *cbuf, uint32_t len);
+
+/** Release a buffer allocated by cbuf_init_mirror */
+void cbuf_deinit_mirror(cbuf_t *cbuf);
+#endif
+
+#if defined(CBUF_WAIT)
+/** Wait until there is a blob to read.
+ *    cbuf         pointer to the circular buffer struct
+ *    timeout_ms   longest time to wait, in milliseconds. Negative waits forever
+ *  Returns true if there is a blob to read, or false if the timeout expired first.
+ */
+bool cbuf_wait_readable(cbuf_t *cbuf, int32_t timeout_ms);
+
+/** Wait until a blob of len bytes can be written without overwriting anything.
+ *    cbuf         pointer to the circular buffer struct
+ *    len          length of the blob, in bytes
+ *    timeout_ms   longest time to wait, in milliseconds. Negative waits forever
+ *  Returns true if the blob fits, or false if the timeout expired first or it can never fit.
+ *  With CBUF_MPSC another writer may take the space before the caller writes.
+ */
+bool cbuf_wait_writable(cbuf_t *cbuf, uint32_t len, int32_t timeout_ms);
+
+/** Get an eventfd that is signalled each time the buffer goes from empty to non-empty, creating
+ *  it on first use. It is non-blocking. To avoid missing a signal, read the eventfd before draining
+ *  the buffer, and drain until cbuf_read returns 0. Call it before other threads use the buffer.
+ *  Returns the file descriptor, or -1 on failure. Release it with cbuf_deinit_wait.
+ */
+int cbuf_eventfd(cbuf_t *cbuf);
+
+/** Close the eventfd created by cbuf_eventfd, if any */
+void cbuf_deinit_wait(cbuf_t *cbuf);
+#endif
+
+#if defined(CBUF_PERSIST)
+/** Open or create a file-backed circular buffer.
+ *    path         file to map. Created if it doesn't exist, and reset if it was created with a
+ *                 different length or by a build with a different cbuf_t layout
+ *    len          length of the buffer memory, in bytes
+ *    clean        returns false if the contents had to be repaired after a crash. Can be NULL
+ *  Returns the circular buffer, or NULL on failure. Release it with cbuf_close_file.
+ *  Only the blobs and indices are kept in the file. Whatever was attached from the memory of the
+ *  process that wrote it is dropped on reopening, and must be attached again: the offset index
+ *  (cbuf_init_index), the reader cursors (cbuf_init_readers) and spilling (cbuf_init_spill).
+ */
+cbuf_t *cbuf_open_file(const char *path, uint32_t len, bool *clean);
+
+/** Flush a file-backed circular buffer to disk. Returns true if successful. */
+bool cbuf_sync_file(cbuf_t *cbuf);
+
+/** Flush, mark as cleanly closed, and unmap a file-backed circular buffer */
+void cbuf_close_file(cbuf_t *cbuf);
+
+/** Rebuild the write index and count of a circular buffer whose metadata may be stale, such as one
+ *  left behind by a crashed process, by validating the blob headers. cbuf_open_file calls this when
+ *  needed.
+ *  Returns true if the metadata was consistent and nothing was dropped or repaired.
+ */
+bool cbuf_recover(cbuf_t *cbuf);
+#endif
+
+/** Write a data blob to the circular buffer
+*    cbuf         pointer to the circular buffer struct
+*    data         data to write to the buffer
+*    data_len     length of the data to write, in bytes
+*    allow_overwrite    set true if the write operation can overwrite old data to write new data
+*    count_overwrite    returns the number of old messages erased to make room for the new data
+* Returns true if the data was written, false otherwise.
+*/
+bool cbuf_write(cbuf_t *cbuf, const void *data, uint32_t data_len, bool allow_overwrite, uint32_t *count_overwrite);
+
+/** Write several data blobs to the circular buffer at once. Behaves exactly like calling cbuf_write
+*  on each blob in order and stopping at the first one that fails, but checks for space and erases
+*  old blobs once per run of blobs instead of once per blob.
+*    cbuf         pointer to the circular buffer struct
+*    blobs        blobs to write
+*    n            number of blobs
+*    allow_overwrite    set true if the write operation can overwrite old data to write new data
+*    count_overwrite    returns the number of old messages erased to make room for the new data
+* Returns the number of blobs written.
+*/
+uint32_t cbuf_write_batch(cbuf_t *cbuf, const cbuf_blob_t *blobs, uint32_t n, bool allow_overwrite, uint32_t *count_overwrite);
+
+#if !defined(CBUF_MPSC)
+/** Reserve space for a blob of up to len bytes so it can be written in place instead of copied in.
+*  Old blobs are erased to make room the same way cbuf_write does. cbuf_write and cbuf_open fail
+*  until the reservation is committed or aborted.
+*    cbuf         pointer to the circular buffer struct
+*    len          maximum length of the blob, in bytes
+*    allow_overwrite    set true if the reservation can overwrite old data to make room
+*    count_overwrite    returns the number of old messages erased to make room
+*    span         returns the writable body area, in up to two segments
+* Returns true if the space was reserved, false otherwise.
+*/
+bool cbuf_reserve(cbuf_t *cbuf, uint32_t len, bool allow_overwrite, uint32_t *count_overwrite, cbuf_span_t *span);
+
+/** Publish the reserved blob
+*    cbuf         pointer to the circular buffer struct
+*    len          actual length of the blob, in bytes. May be less than was reserved
+* Returns true if the blob was published, false if there was no reservation or len is too large.
+*/
+bool cbuf_commit(cbuf_t *cbuf, uint32_t len);
+
+/** Drop the reserved blob without publishing it. Blobs erased to make room for it stay erased.
+* Returns true if there was a reservation to drop.
+*/
+bool cbuf_abort(cbuf_t *cbuf);
+#endif
+
+/** Read a data blob from the circular buffer
+*    cbuf         pointer to the circular buffer struct
+*    data         data to read from the buffer. Use cbuf_peek_len() first to get the length of this data
+*                 Can be NULL to remove the next item from the buffer without storing it elsewhere
+* Returns the number of messages on the buffer _before_ the read.
+*/
+uint32_t cbuf_read(cbuf_t *cbuf, void *data);
+
+/** Reads some or all of the next data blob from the circular buffer, WITHOUT consuming the blob
+*    cbuf         pointer to the circular buffer struct
+*    data         data to read from the buffer. Use cbuf_peek_len() first to get the max length of this data
+*    len          (in) length of the data buffer / (out) actual number of bytes written
+* Returns the number of messages on the buffer, including the one being peeked at
+*/
+uint32_t cbuf_peek(cbuf_t *cbuf, void *data, uint32_t *len);
+
+/** Reads some or all of the nth data blob from the circular buffer (0 being the next to be read),
+*  WITHOUT consuming anything. Takes constant time with CBUF_BLOB_INDEX, and walks the headers of
+*  the blobs in front of it otherwise.
+*    cbuf         pointer to the circular buffer struct
+*    n            position of the blob in the buffer
+*    data         data to read from the buffer
+*    len          (in) length of the data buffer / (out) actual number of bytes written
+* Returns the number of messages on the buffer, or 0 if it doesn't hold more than n.
+*/
+uint32_t cbuf_peek_nth(cbuf_t *cbuf, uint32_t n, void *data, uint32_t *len);
+
+/** Get the length of the next data blob to be read from the circular buffer
+*    cbuf         pointer to the circular buffer struct
+*    len          length of the data
+* Returns the number of messages on the buffer.
+*/
+uint32_t cbuf_peek_len(cbuf_t *cbuf, uint32_t *len);
+
+/** Point a view at the next data blob in the circular buffer, WITHOUT copying or consuming it.
+*  The view stays valid until the blob is consumed. With CBUF_SPSC it is only stable if the writer
+*  never overwrites; otherwise the writer may evict the blob and reuse its memory at any time.
+*    cbuf         pointer to the circular buffer struct
+*    view         returns the blob body, in up to two segments
+* Returns the number of messages on the buffer, including the one being viewed
+*/
+uint32_t cbuf_peek_view(cbuf_t *cbuf, cbuf_view_t *view);
+
+/** Start a walk over the blobs in the circular buffer, WITHOUT consuming them. The walk covers the
+*  blobs there are now, and stops in front of an open partial blob. It must not outlive a read or
+*  an overwriting write; with CBUF_SPSC it has the same limits as cbuf_peek_view.
+*    cbuf         pointer to the circular buffer struct
+*    it           returns the start of the walk
+*/
+void cbuf_iter_begin(cbuf_t *cbuf, cbuf_iter_t *it);
+
+/** Point a view at the next blob of a walk, and move past it
+*    cbuf         pointer to the circular buffer struct
+*    it           the walk, from cbuf_iter_begin
+*    view         returns the blob body, in up to two segments
+* Returns false if the walk is over.
+*/
+bool cbuf_iter_next(cbuf_t *cbuf, cbuf_iter_t *it, cbuf_view_t *view);
+
+/** Move a walk to the next blob whose body starts with, or contains, a byte pattern. To find the
+*  last such blob, call it until it returns false and keep the last view.
+*    cbuf         pointer to the circular buffer struct
+*    it           the walk, from cbuf_iter_begin. Left just past the blob found
+*    pattern      bytes to look for
+*    len          length of the pattern, in bytes
+*    prefix       set true to only match blobs that start with the pattern
+*    view         returns the body of the blob found, in up to two segments
+* Returns true if a blob was found, or false if the walk ended first.
+*/
+bool cbuf_iter_find(cbuf_t *cbuf, cbuf_iter_t *it, const void *pattern, uint32_t len, bool prefix, cbuf_view_t *view);
+
+/** Remove up to n data blobs from the circular buffer without copying them out. Takes constant
+*  time with CBUF_BLOB_INDEX.
+*    cbuf         pointer to the circular buffer struct
+*    n            number of blobs to remove
+* Returns the number of blobs removed.
+*/
+uint32_t cbuf_consume(cbuf_t *cbuf, uint32_t n);
+
+/** Read as many whole data blobs as fit into one arena, back to back, consuming them
+*    cbuf         pointer to the circular buffer struct
+*    arena        memory to copy the blobs into
+*    arena_len    length of the arena, in bytes
+*    offsets      returns the offset of each blob in the arena. Can be NULL
+*    lens         returns the length of each blob
+*    max_blobs    number of entries in offsets and lens
+* Returns the number of blobs read. A blob that doesn't fit in the rest of the arena is left for the
+* next call, so an arena smaller than the next blob reads nothing.
+*/
+uint32_t cbuf_read_batch(cbuf_t *cbuf, void *arena, uint32_t arena_len, uint32_t *offsets, uint32_t *lens, uint32_t max_blobs);
+
+#if defined(CBUF_FD)
+#define CBUF_FD_BLOBS   32  //Most blobs cbuf_write_to_fd sends per call
+
+/** Read from a file descriptor straight into the buffer, with a single readv. The data becomes a
+*  new blob, or is appended to the open blob with CBUF_ALLOW_PARTIAL. max is cut down to the room
+*  the buffer has, or can make by erasing old blobs, and that much room is made before reading, the
+*  same way cbuf_reserve does.
+*    cbuf         pointer to the circular buffer struct
+*    fd           file descriptor to read from
+*    max          most bytes to read
+*    allow_overwrite    set true if old data can be overwritten to make room
+*    count_overwrite    returns the number of old messages erased to make room
+* Returns the number of bytes read, 0 at end of file, or -1 with errno set on error. errno is
+* ENOBUFS if there was no room at all. Nothing is written unless bytes were read.
+*/
+int32_t cbuf_write_from_fd(cbuf_t *cbuf, int fd, uint32_t max, bool allow_overwrite, uint32_t *count_overwrite);
+
+/** Send the oldest blobs to a file descriptor with a single writev, consuming the ones the kernel
+*  took all of. When it takes part of a blob, the next call sends the rest of it, as long as the
+*  blob is still at the head. With CBUF_SPSC it has the same limits as cbuf_peek_view.
+*    cbuf         pointer to the circular buffer struct
+*    fd           file descriptor to write to
+*    max_blobs    most blobs to send, up to CBUF_FD_BLOBS
+*    raw          set true to send the blobs as stored, headers and padding included, rather than
+*                 only their bodies. Keep using the same setting while a blob is partly sent
+* Returns the number of bytes sent, 0 if there was nothing to send, or -1 with errno set on error.
+*/
+int32_t cbuf_write_to_fd(cbuf_t *cbuf, int fd, uint32_t max_blobs, bool raw);
+#endif
+
+#if defined(CBUF_POOL)
+/** Bytes of arena a pool of rings rings of ring_len bytes each needs, metadata included */
+uint64_t cbuf_pool_size(uint32_t rings, uint32_t ring_len);
+
+/** Initialize a pool of rings in an arena. Every ring starts out free.
+ *    pool         pointer to the pool struct
+ *    arena        memory for the pool, aligned to CBUF_POOL_ALIGN and cbuf_pool_size bytes long
+ *    rings        number of rings
+ *    ring_len     length of each ring's buffer memory, in bytes
+ *  Returns true if successful.
+ */
+bool cbuf_pool_init(cbuf_pool_t *pool, void *arena, uint32_t rings, uint32_t ring_len);
+
+/** Take a free ring from a pool. It is empty and freshly initialized.
+ *    id           returns the id of the ring
+ *  Returns the ring, or NULL if every ring is in use.
+ */
+cbuf_t *cbuf_pool_alloc(cbuf_pool_t *pool, uint32_t *id);
+
+/** Give a ring back to its pool. Whatever it holds is dropped.
+ *  Returns true if successful, or false if id is not a ring in use, e.g. one already freed.
+ */
+bool cbuf_pool_free(cbuf_pool_t *pool, uint32_t id);
+
+/** Get the ring with a given id */
+cbuf_t *cbuf_pool_ring(cbuf_pool_t *pool, uint32_t id);
+
+/** Write a blob to a ring of a pool, as cbuf_write does, and mark the ring ready to read */
+bool cbuf_pool_write(cbuf_pool_t *pool, uint32_t id, const void *data, uint32_t data_len, bool allow_overwrite, uint32_t *count_overwrite);
+
+/** Mark a ring ready to read, after writing to it with the other cbuf_ functions */
+void cbuf_pool_mark(cbuf_pool_t *pool, uint32_t id);
+
+/** Find the next ring marked ready, and clear its mark. Read it until it's empty, or mark it again.
+ *  A sweep over every ready ring is:
+ *      for (uint32_t id = 0; cbuf_pool_next_ready(pool, &id); id++)
+ *    id           the id to start looking at. Returns the id of the ring found
+ *  Returns true if a ring was found, or false if no ring from id on is marked.
+ */
+bool cbuf_pool_next_ready(cbuf_pool_t *pool, uint32_t *id);
+#endif
+
+#if defined(CBUF_CRC)
+/** Compute the CRC32C (Castagnoli) of len bytes, continuing from the crc of the bytes before them.
+ *  Pass 0 as crc to start.
+ */
+uint32_t cbuf_crc32c(uint32_t crc, const void *data, uint32_t len);
+
+/** Check whether the oldest blob is damaged, which is when the reads return 0 while blobs are queued */
+bool cbuf_corrupt(cbuf_t *cbuf);
+
+/** Skip a damaged oldest blob: drop everything up to the next header that holds an intact blob, or
+ *  up to the write index if there is none, and recount the blobs from there.
+ *  Returns the number of bytes dropped, or 0 if the oldest blob wasn't damaged.
+ */
+uint32_t cbuf_resync(cbuf_t *cbuf);
+#endif
+
+#if defined(CBUF_TIMESTAMP)
+/** Take blob timestamps from clock instead of the monotonic clock, e.g. a tick counter on targets
+ *  without clock_gettime. It must never go backwards. Pass NULL to go back to the monotonic clock.
+ *  If the new clock reads behind the newest blob, its readings are offset to carry on from there.
+ */
+void cbuf_set_clock(cbuf_t *cbuf, uint64_t (*clock)(void));
+
+/** Get the timestamp of the nth oldest blob without removing it.
+ *    n            0 for the oldest blob
+ *    ts           returns the timestamp
+ *  Returns true if successful, or false if there aren't that many blobs.
+ */
+bool cbuf_peek_ts(cbuf_t *cbuf, uint32_t n, uint64_t *ts);
+
+/** Start a walk over the blobs stamped in [t0, t1), oldest first. Walk them with cbuf_iter_next.
+ *  Returns the number of blobs in the range.
+ */
+uint32_t cbuf_iter_range(cbuf_t *cbuf, uint64_t t0, uint64_t t1, cbuf_iter_t *it);
+
+/** Remove every blob stamped before t in one step. An open blob stays, and expired blobs are not
+ *  spilled. With CBUF_STATS they count as evicted.
+ *  Returns the number of blobs removed.
+ */
+uint32_t cbuf_expire_older_than(cbuf_t *cbuf, uint64_t t);
+#endif
+
+#if defined(CBUF_SPILL)
+/** Keep the blobs erased to make room, instead of dropping them.
+*    cbuf         pointer to the circular buffer struct
+*    fd           segment file, open for reading and writing. It is emptied. -1 stops spilling
+*    stage        memory that holds erased blobs until they are flushed
+*    stage_len    length of the stage, in bytes
+* Returns true if successful.
+*/
+bool cbuf_init_spill(cbuf_t *cbuf, int fd, uint8_t *stage, uint32_t stage_len);
+
+/** Append the staged blobs to the segment file. Call it often enough that the stage doesn't fill
+*  up, from wherever file I/O is welcome (it must not run at the same time as a write).
+* Returns the number of bytes appended, or -1 with errno set on error. The blobs then stay staged.
+*/
+int32_t cbuf_spill_flush(cbuf_t *cbuf);
+
+/** Read the oldest blob, whether it was spilled or is still in the buffer
+*    cbuf         pointer to the circular buffer struct
+*    data         data to read. It must have room for the largest blob
+*    len          returns the length of the blob
+* Returns true if a blob was read, or false if there are none or the segment file couldn't be read.
+*/
+bool cbuf_read_replay(cbuf_t *cbuf, void *data, uint32_t *len);
+
+/** Get the number of erased blobs that were lost because the stage was full, and reset it */
+uint32_t cbuf_spill_lost(cbuf_t *cbuf);
+#endif
+
+#if defined(CBUF_STATS)
+/** Take a snapshot of the statistics of a circular buffer */
+void cbuf_stats(cbuf_t *cbuf, cbuf_stats_t *stats);
+
+/** Zero the statistics of a circular buffer */
+void cbuf_stats_reset(cbuf_t *cbuf);
+
+/** Suggest a length for a circular buffer from its high-water mark since the last call: double if
+ *  it rose above three quarters of the buffer, halve if it stayed below a quarter, otherwise the
+ *  current length. The result is kept within min_len and max_len, and the high-water mark restarts
+ *  from the bytes in use. Call it periodically and pass the result to cbuf_resize when it differs,
+ *  to right-size many buffers automatically.
+ */
+uint32_t cbuf_suggest_len(cbuf_t *cbuf, uint32_t min_len, uint32_t max_len);
+#endif
+
+/** Returns the number of data blobs in the circular buffer */
+uint32_t cbuf_count(cbuf_t *cbuf);
+
+#if defined(CBUF_TEST)
+/** Print a visualization of the buffer state to the screen. Looks super cool, but really for debug only. */
+void cbuf_viz(cbuf_t *cbuf);
+#endif
+
+#if defined(CBUF_ALLOW_PARTIAL)
+/** Open a blob for multiple sequential writes using cbuf_write.
+ *  Returns true if successful
+ */
+bool cbuf_open(cbuf_t *cbuf, bool allow_overwrite, uint32_t *count_overwrite);
+
+/** Close the currently open buffer and mark is as a complete blob.
+ *  Returns true if successful */
+bool cbuf_close(cbuf_t *cbuf);
+
+/** Split a stream of bytes into blobs at a delimiter, e.g. lines of serial input. Each delimiter
+ *  ends a blob and is kept as its last byte. The bytes after the last delimiter are left in an open
+ *  blob, which the next call continues (cbuf_close ends it early). Complete blobs inside the data
+ *  are each written with a single copy.
+ *    cbuf         pointer to the circular buffer struct
+ *    data         bytes to split
+ *    len          number of bytes
+ *    delim        delimiter byte
+ *    allow_overwrite    set true if the writes can overwrite old data to make room
+ *    count_overwrite    returns the number of old messages erased to make room
+ *  Returns the number of bytes taken. Fewer than len if a blob couldn't be written, in which case
+ *  the rest can be passed again once there is room.
+ */
+uint32_t cbuf_ingest(cbuf_t *cbuf, const void *data, uint32_t len, uint8_t delim, bool allow_overwrite, uint32_t *count_overwrite);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
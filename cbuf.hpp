@@ -0,0 +1,355 @@
+#ifndef __CBUF_HPP__
+#define __CBUF_HPP__
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+#include "cbuf.h"
+
+/** Header-only C++ front-end for cbuf. blobcirc::ring keeps a cbuf_t and its buffer memory
+ *  together, and uses the same on-buffer format as cbuf.c, so raw() can be passed to any cbuf_
+ *  function and the two can be mixed freely on one buffer.
+ *
+ *  The capacity, header width, alignment and partial-write support are template parameters, so
+ *  index wrapping, header and padding sizes are compile-time constants. Writes and reads of
+ *  trivially copyable types whose blob doesn't wrap become a few fixed-size copies. Anything off
+ *  the fast path (erasing old blobs, a wrapping blob with no room, appending to an open blob) is
+ *  handed to the C functions.
+ *
+ *  The layout facts must match the build of cbuf.c, which the static_asserts check. Not available
+ *  with CBUF_SPSC, CBUF_MPSC, CBUF_HEADER_VARINT, CBUF_BLOB_INDEX, CBUF_TIMESTAMP or CBUF_CRC, nor
+ *  with CBUF_READERS, whose cursors move with the head only through the C functions. With
+ *  CBUF_STATS, only the C functions update the statistics.
+ */
+
+#if defined(CBUF_ATOMIC) || defined(CBUF_HEADER_VARINT) || defined(CBUF_BLOB_INDEX) || defined(CBUF_TIMESTAMP) || defined(CBUF_CRC) || \
+    defined(CBUF_READERS)
+#error "cbuf.hpp does not support CBUF_SPSC, CBUF_MPSC, CBUF_HEADER_VARINT, CBUF_BLOB_INDEX, CBUF_TIMESTAMP, CBUF_CRC or CBUF_READERS"
+#endif
+
+namespace blobcirc {
+
+#if defined(CBUF_HEADER_16)
+using c_header_t = uint16_t;            //Header word of the C build
+#else
+using c_header_t = uint32_t;
+#endif
+
+#if defined(CBUF_ALLOW_PARTIAL)
+inline constexpr bool c_partial = true; //Whether the C build has partial writes
+#else
+inline constexpr bool c_partial = false;
+#endif
+
+/** Compile-time options of a ring
+ *    Align        blob bodies start at a multiple of this many bytes. Needs CBUF_ALIGN if above 1
+ *    Partial      whether blobs can be open for partial writes. Must match CBUF_ALLOW_PARTIAL
+ */
+template <uint32_t Align = 1, bool Partial = c_partial>
+struct options {
+    static constexpr uint32_t align = Align;
+    static constexpr bool partial = Partial;
+};
+
+/** A read-only view of a blob's body, split in up to two segments at the wrap point */
+struct view {
+    std::span<const uint8_t> first;     //Up to the wrap point
+    std::span<const uint8_t> second;    //From the start of the buffer; empty if the blob doesn't wrap
+
+    uint32_t size() const { return (uint32_t)(first.size() + second.size()); }
+};
+
+template <uint32_t Capacity, typename HeaderT = c_header_t, typename Options = options<>>
+class ring {
+    static_assert(std::is_same_v<HeaderT, uint16_t> || std::is_same_v<HeaderT, uint32_t>, "header must be uint16_t or uint32_t");
+    static_assert(sizeof(HeaderT) == sizeof(c_header_t), "header width must match the C build (CBUF_HEADER_16)");
+    static_assert(Options::partial == c_partial, "partial writes must match the C build (CBUF_ALLOW_PARTIAL)");
+    static_assert((Options::align != 0) && ((Options::align & (Options::align - 1)) == 0), "alignment must be a power of two");
+    static_assert((Capacity % Options::align) == 0, "capacity must be a multiple of the alignment");
+    static_assert(Capacity > 2 * sizeof(HeaderT), "capacity is too small");
+#if !defined(CBUF_ALIGN)
+    static_assert(Options::align == 1, "alignment needs CBUF_ALIGN");
+#endif
+#if defined(CBUF_POW2)
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two with CBUF_POW2");
+#endif
+
+public:
+    static constexpr uint32_t capacity = Capacity;
+    static constexpr uint32_t header_size = sizeof(HeaderT);
+    static constexpr uint32_t align = Options::align;
+
+    /** Largest blob the header can describe. The top bit is the open flag with partial writes */
+    static constexpr uint32_t max_blob_len = Options::partial ? ((uint32_t)(HeaderT)~0u >> 1) : (uint32_t)(HeaderT)~0u;
+
+    /** Bytes of padding that follow a blob body of len bytes, so that the next body is aligned too */
+    static constexpr uint32_t pad(uint32_t len) { return (0u - (len + header_size)) & (align - 1); }
+
+    /** Bytes a blob with a body of len bytes takes up in the buffer, header and padding included */
+    static constexpr uint32_t blob_size(uint32_t len) { return header_size + len + pad(len); }
+
+    ring()
+    {
+        cbuf_init(&c_, mem_, Capacity);
+#if defined(CBUF_ALIGN)
+        //mem_ is aligned to at least align, so this can't fail; the fast path relies on it
+        [[maybe_unused]] bool aligned = cbuf_set_align(&c_, align);
+        assert(aligned);
+#endif
+    }
+
+    ring(const ring&) = delete;
+    ring &operator=(const ring&) = delete;
+
+    /** The underlying circular buffer, for use with the C functions */
+    cbuf_t *raw() { return &c_; }
+
+    /** Number of blobs in the ring */
+    uint32_t count() const { return c_.count; }
+
+    /** Write a blob, like cbuf_write */
+    bool write(const void *data, uint32_t len, bool allow_overwrite = true, uint32_t *count_overwrite = nullptr)
+    {
+        return put(data, len, allow_overwrite, count_overwrite);
+    }
+
+    /** Write a trivially copyable value as a blob of sizeof(T) bytes */
+    template <typename T> requires (!std::is_pointer_v<T> && !std::is_array_v<T>)
+    bool write(const T &value, bool allow_overwrite = true, uint32_t *count_overwrite = nullptr)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be written");
+        static_assert(blob_size(sizeof(T)) < (Capacity - 1), "type can never fit in the ring");
+        return put(&value, sizeof(T), allow_overwrite, count_overwrite);
+    }
+
+    /** Read the next blob into data, like cbuf_read. Returns the number of blobs before the read. */
+    uint32_t read(void *data)
+    {
+        uint32_t len;
+        return take(data, &len);
+    }
+
+    /** Read the next blob into a trivially copyable value. Returns false, reading nothing, if the
+     *  ring is empty or the blob isn't sizeof(T) bytes.
+     */
+    template <typename T> requires (!std::is_pointer_v<T> && !std::is_array_v<T>)
+    bool read(T &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be read");
+        uint32_t at = c_.ridx;
+        if (empty() || (header(at) != sizeof(T)))
+        {
+            return false;
+        }
+        uint32_t len;
+        return take(&value, &len) != 0;
+    }
+
+    /** Point a view at the next blob without consuming it. Returns false if the ring is empty. */
+    bool peek(view &v) const
+    {
+        if (empty())
+        {
+            return false;
+        }
+        uint32_t at = c_.ridx;
+        uint32_t len = header(at);
+        at = wrap(at + header_size);
+        uint32_t first = (len < (Capacity - at)) ? len : (Capacity - at);
+        v.first  = std::span<const uint8_t>(&mem_[at], first);
+        v.second = std::span<const uint8_t>(mem_, len - first);
+        return true;
+    }
+
+    /** Remove up to n blobs without copying them out. Returns the number removed. */
+    uint32_t consume(uint32_t n = 1)
+    {
+        uint32_t idx = c_.ridx;
+        uint32_t done = 0;
+        for (; (done < n) && (done < c_.count) && (idx != c_.widx); done++)
+        {
+            uint32_t len = header(idx);
+            idx = wrap(idx + blob_size(len));
+        }
+        advance(idx, done);
+        return done;
+    }
+
+    /** A reservation for a blob to be written in place. It is aborted when it goes out of scope
+     *  unless it was committed.
+     */
+    class reservation {
+    public:
+        std::span<uint8_t> first;       //Writable body area up to the wrap point
+        std::span<uint8_t> second;      //Remainder from the start of the buffer; empty if it doesn't wrap
+
+        reservation() = default;
+        reservation(const reservation&) = delete;
+        reservation &operator=(const reservation&) = delete;
+        reservation(reservation &&other) : first(other.first), second(other.second), owner_(other.owner_) { other.owner_ = nullptr; }
+        ~reservation()
+        {
+            if (owner_)
+            {
+                cbuf_abort(owner_);
+            }
+        }
+
+        /** True if the space was reserved and hasn't been committed yet */
+        explicit operator bool() const { return owner_ != nullptr; }
+
+        /** Publish the blob with its actual length, like cbuf_commit */
+        bool commit(uint32_t len)
+        {
+            if (!owner_ || !cbuf_commit(owner_, len))
+            {
+                return false;
+            }
+            owner_ = nullptr;
+            return true;
+        }
+
+    private:
+        friend class ring;
+        cbuf_t *owner_ = nullptr;
+    };
+
+    /** Reserve space for a blob of up to len bytes, like cbuf_reserve. Test the result to see
+     *  whether it succeeded.
+     */
+    reservation reserve(uint32_t len, bool allow_overwrite = true, uint32_t *count_overwrite = nullptr)
+    {
+        reservation r;
+        cbuf_span_t span;
+        if (cbuf_reserve(&c_, len, allow_overwrite, count_overwrite, &span))
+        {
+            r.first  = std::span<uint8_t>(span.seg[0], span.len[0]);
+            r.second = std::span<uint8_t>(span.seg[1], span.len[1]);
+            r.owner_ = &c_;
+        }
+        return r;
+    }
+
+private:
+    static constexpr uint32_t wrap(uint32_t idx)
+    {
+        if constexpr ((Capacity & (Capacity - 1)) == 0)
+        {
+            return idx & (Capacity - 1);
+        }
+        else
+        {
+            return (idx >= Capacity) ? (idx - Capacity) : idx;
+        }
+    }
+
+    /** Copy len bytes in at index at, in at most two pieces around the wrap point */
+    void copy_in(uint32_t at, const void *src, uint32_t len)
+    {
+        uint32_t first = (len < (Capacity - at)) ? len : (Capacity - at);
+        std::memcpy(&mem_[at], src, first);
+        std::memcpy(mem_, (const uint8_t*)src + first, len - first);
+    }
+
+    /** Copy len bytes out from index at, in at most two pieces around the wrap point */
+    void copy_out(void *dst, uint32_t at, uint32_t len) const
+    {
+        uint32_t first = (len < (Capacity - at)) ? len : (Capacity - at);
+        std::memcpy(dst, &mem_[at], first);
+        std::memcpy((uint8_t*)dst + first, mem_, len - first);
+    }
+
+    /** Length of the blob whose header is at index at */
+    uint32_t header(uint32_t at) const
+    {
+        HeaderT hdr;
+        copy_out(&hdr, at, header_size);
+        return hdr & max_blob_len;
+    }
+
+    bool empty() const { return (c_.count == 0) || (c_.ridx == c_.widx); }
+
+    /** Move the head past n blobs to index to, as _advance does in the C build */
+    void advance(uint32_t to, uint32_t n)
+    {
+        c_.ridx = to;
+        c_.count -= n;
+#if defined(CBUF_FD)
+        if (n)
+        {
+            c_.sent = 0;    //cbuf_write_to_fd must not resume a blob that is gone
+        }
+#endif
+    }
+
+    /** Same test as the C build: one byte is always kept free so a full ring can't look empty */
+    uint32_t free_space() const
+    {
+        return (c_.ridx > c_.widx) ? (c_.ridx - c_.widx - 1) : (Capacity - c_.widx + c_.ridx - 1);
+    }
+
+    bool put(const void *data, uint32_t len, bool allow_overwrite, uint32_t *count_overwrite)
+    {
+        uint32_t need = blob_size(len);
+        bool busy = (c_.reserved != CBUF_NO_RESERVATION);
+#if defined(CBUF_ALLOW_PARTIAL)
+        busy = busy || c_.open;
+#endif
+        //Erasing old blobs, appending to an open blob and refusing a write are left to cbuf_write,
+        //which never takes a blob as large as the buffer less one byte
+        if (busy || (len > max_blob_len) || (need >= (Capacity - 1)) || (need > free_space()))
+        {
+            return cbuf_write(&c_, data, len, allow_overwrite, count_overwrite);
+        }
+
+        uint32_t widx = c_.widx;
+        HeaderT hdr = (HeaderT)len;
+        if ((widx + header_size + len) <= Capacity)
+        {
+            //Doesn't wrap: two fixed-size copies when len is known
+            std::memcpy(&mem_[widx], &hdr, header_size);
+            std::memcpy(&mem_[widx + header_size], data, len);
+        }
+        else
+        {
+            copy_in(widx, &hdr, header_size);
+            copy_in(wrap(widx + header_size), data, len);
+        }
+        c_.count++;
+        c_.widx = wrap(widx + need);
+
+        if (count_overwrite)
+        {
+            *count_overwrite = 0;
+        }
+        return true;
+    }
+
+    /** Remove the next blob, copying its body to dst if not NULL. Returns the count before. */
+    uint32_t take(void *dst, uint32_t *len)
+    {
+        uint32_t count = c_.count;
+        if (empty())
+        {
+            return 0;
+        }
+        uint32_t at = c_.ridx;
+        *len = header(at);
+        if (dst)
+        {
+            copy_out(dst, wrap(at + header_size), *len);
+        }
+        advance(wrap(at + blob_size(*len)), 1);
+        return count;
+    }
+
+    cbuf_t c_;
+    alignas((Options::align > 64) ? Options::align : 64) uint8_t mem_[Capacity];
+};
+
+} //namespace blobcirc
+
+#endif
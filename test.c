@@ -1,78 +1,298 @@
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdarg.h>
-#include <string.h>
-#include <time.h>
-
-#include "cbuf.h"
-
-#define MESSAGE_MAX_LEN (64)
-#define MESSAGE_Q_LEN (256)
-
-static cbuf_t cbuf;
-static uint8_t mbuf[MESSAGE_Q_LEN];
-
-static void init(void)
-{
-    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
-}
-
-void write_blob(const char* msg)
-{
-    uint32_t count_overwrite = 0;
-    cbuf_write(&cbuf, msg, strlen(msg) + 1, true, &count_overwrite);
-
-    printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
-    cbuf_viz(&cbuf);
-}
-
-void read_one(void)
-{
-    char msg[MESSAGE_Q_LEN];
-    uint32_t len;
-    if (cbuf_peek_len(&cbuf, &len) > 0)
-    {
-        printf("Length to read: %d\n", len);
-        cbuf_read(&cbuf, msg);
-        printf("%s\n", msg);
-        cbuf_viz(&cbuf); printf("\n");
-    }
-    else
-    {
-        printf("Nothing to read\n");
-    }
-}
-
-void read_all(void)
-{
-    char msg[MESSAGE_Q_LEN];
-    uint32_t len;
-    while(cbuf_peek_len(&cbuf, &len))
-    {
-        printf("Length to read: %d\n", len);
-        cbuf_read(&cbuf, msg);
-        printf("%s\n", msg);
-        cbuf_viz(&cbuf); printf("\n");
-    }
-}
-
-#define PAD "[..................]" //20 charatacters of padding
-
-int main(void)
-{
-    printf("Message queue is %lu bytes\n", sizeof(mbuf));
-    init();
-
-    write_blob("bytes 0" PAD);
-    write_blob("bytes 1 lorem ipsum dolor sit amet" PAD);
-    write_blob("bytes 2" PAD);
-    write_blob("bytes 3 but also something longer" PAD);
-    write_blob("bytes 4" PAD);
-    write_blob("bytes 6" PAD);
-    write_blob("bytes 7 and some stuff" PAD);
-    write_blob("bytes 8 but why" PAD);
-    write_blob("bytes 9" PAD);
-
-    read_all();
-}
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_MAX_LEN (64)
+#define MESSAGE_Q_LEN (256)
+
+static cbuf_t cbuf;
+static _Alignas(64) uint8_t mbuf[MESSAGE_Q_LEN];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t offsets[8];
+#endif
+
+static _Alignas(64) uint8_t small_mbuf[MESSAGE_Q_LEN / 2];
+static _Alignas(64) uint8_t large_mbuf[MESSAGE_Q_LEN * 2];
+
+//Things that went wrong on the way through the demo, as opposed to what it prints
+static uint32_t errors;
+
+static void init(void)
+{
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+#if defined(CBUF_ALIGN)
+    if (!cbuf_set_align(&cbuf, 16))
+    {
+        printf("Failed to align the buffer\n");
+        errors++;
+    }
+#endif
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&cbuf, offsets, sizeof(offsets) / sizeof(offsets[0]));
+#endif
+}
+
+void write_blob(const char* msg)
+{
+    uint32_t count_overwrite = 0;
+    cbuf_write(&cbuf, msg, strlen(msg) + 1, true, &count_overwrite);
+
+    printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
+    cbuf_viz(&cbuf);
+}
+
+//Write a blob in place through a reservation instead of copying it in
+void reserve_blob(const char* msg)
+{
+    uint32_t count_overwrite = 0;
+    uint32_t len = strlen(msg) + 1;
+    cbuf_span_t span;
+    if (cbuf_reserve(&cbuf, MESSAGE_MAX_LEN, true, &count_overwrite, &span))
+    {
+        //Fill the reservation segment by segment; it may be split at the wrap point
+        uint32_t first = (len < span.len[0]) ? len : span.len[0];
+        memcpy(span.seg[0], msg, first);
+        memcpy(span.seg[1], msg + first, len - first);
+        cbuf_commit(&cbuf, len);
+        printf("Committed a message of %d bytes in %d+%d (overwrote %d)\n", len, first, len - first, count_overwrite);
+    }
+    else
+    {
+        printf("Failed to reserve %d bytes\n", MESSAGE_MAX_LEN);
+        errors++;
+    }
+    cbuf_viz(&cbuf);
+}
+
+void read_one(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    uint32_t len;
+    if (cbuf_peek_len(&cbuf, &len) > 0)
+    {
+        printf("Length to read: %d\n", len);
+        errors += (cbuf_read(&cbuf, msg) == 0) || (strlen(msg) + 1 != len);
+        printf("%s\n", msg);
+        cbuf_viz(&cbuf); printf("\n");
+    }
+    else
+    {
+        printf("Nothing to read\n");
+        errors++;
+    }
+}
+
+//Print every blob from the newest to the oldest without consuming any
+void peek_all(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    for (uint32_t n = cbuf_count(&cbuf); n > 0; n--)
+    {
+        uint32_t len = sizeof(msg);
+        errors += !cbuf_peek_nth(&cbuf, n - 1, msg, &len) || (strlen(msg) + 1 != len);
+        printf("Blob %d (%d bytes): %s\n", n - 1, len, msg);
+    }
+}
+
+//True if a blob of len bytes starts with, or contains, a pattern
+static bool matches(const char *blob, uint32_t len, const char *pattern, bool prefix)
+{
+    uint32_t plen = strlen(pattern);
+    for (uint32_t at = 0; (at + plen) <= len; at++)
+    {
+        if (memcmp(&blob[at], pattern, plen) == 0)
+        {
+            return true;
+        }
+        if (prefix)
+        {
+            break;
+        }
+    }
+    return false;
+}
+
+//Walk the blobs without consuming them, and print the last one that contains a pattern. The walk
+//must find what a plain search of copies made with cbuf_peek_nth finds.
+void find_last(const char *pattern, bool prefix)
+{
+    cbuf_iter_t it;
+    cbuf_view_t view;
+    char last[MESSAGE_Q_LEN];
+    uint32_t last_len = 0;
+    uint32_t found = 0;
+    cbuf_iter_begin(&cbuf, &it);
+    while (cbuf_iter_find(&cbuf, &it, pattern, strlen(pattern), prefix, &view))
+    {
+        memcpy(last, view.seg[0], view.len[0]);
+        memcpy(&last[view.len[0]], view.seg[1], view.len[1]);
+        last_len = view.len[0] + view.len[1];
+        found++;
+    }
+    printf("Found %d blobs %s \"%s\"", found, prefix ? "starting with" : "containing", pattern);
+    if (found)
+    {
+        printf(", the last is %.*s", (int)last_len, last);
+    }
+    printf("\n");
+
+    char msg[MESSAGE_Q_LEN];
+    char expect[MESSAGE_Q_LEN];
+    uint32_t expect_len = 0;
+    uint32_t expect_found = 0;
+    for (uint32_t n = 0; n < cbuf_count(&cbuf); n++)
+    {
+        uint32_t len = sizeof(msg);
+        cbuf_peek_nth(&cbuf, n, msg, &len);
+        if (matches(msg, len, pattern, prefix))
+        {
+            memcpy(expect, msg, len);
+            expect_len = len;
+            expect_found++;
+        }
+    }
+    errors += (found != expect_found) || (last_len != expect_len) || (memcmp(last, expect, last_len) != 0);
+}
+
+//Look for a pattern that runs across the wrap point, in the blob that wraps
+void find_wrapped(void)
+{
+    cbuf_iter_t it;
+    cbuf_view_t view;
+    char pattern[5] = {0};
+    cbuf_iter_begin(&cbuf, &it);
+    while (cbuf_iter_next(&cbuf, &it, &view))
+    {
+        //Two bytes either side, short of the NULL that ends the blob
+        if ((view.len[0] >= 2) && (view.len[1] >= 3))
+        {
+            memcpy(pattern, &view.seg[0][view.len[0] - 2], 2);
+            memcpy(&pattern[2], view.seg[1], 2);
+            break;
+        }
+    }
+    if (pattern[0] == 0)
+    {
+        printf("No blob wraps around the end of the buffer\n");
+        errors++;
+        return;
+    }
+    find_last(pattern, false);
+}
+
+void read_all(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    uint32_t len;
+    while(cbuf_peek_len(&cbuf, &len))
+    {
+        printf("Length to read: %d\n", len);
+        errors += (cbuf_read(&cbuf, msg) == 0) || (strlen(msg) + 1 != len);
+        printf("%s\n", msg);
+        cbuf_viz(&cbuf); printf("\n");
+    }
+}
+
+//Print every blob in place through a view, then consume them all at once
+void view_all(void)
+{
+    cbuf_view_t view;
+    if (cbuf_peek_view(&cbuf, &view))
+    {
+        printf("Viewing %d+%d bytes at offset %ld: %.*s%.*s\n", view.len[0], view.len[1], (long)(view.seg[0] - mbuf),
+               (int)view.len[0], (const char*)view.seg[0], (int)view.len[1], (const char*)view.seg[1]);
+    }
+    printf("Consumed %d\n", cbuf_consume(&cbuf, MESSAGE_Q_LEN));
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+//Drain the buffer into one arena with a single call
+void read_batch_all(void)
+{
+    char arena[MESSAGE_Q_LEN];
+    uint32_t offsets[8];
+    uint32_t lens[8];
+    uint32_t n = cbuf_read_batch(&cbuf, arena, sizeof(arena), offsets, lens, 8);
+    printf("Read %d messages in one batch\n", n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        printf("  @%d (%d bytes): %s\n", offsets[i], lens[i], &arena[offsets[i]]);
+    }
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+#define PAD "[..................]" //20 charatacters of padding
+
+//Move the live blobs into other memory
+void resize(uint8_t *mem, uint32_t len)
+{
+    uint32_t count_overwrite = 0;
+    if (cbuf_resize(&cbuf, mem, len, &count_overwrite))
+    {
+        printf("Resized to %u bytes, %u messages left (overwrote %d)\n", len, cbuf_count(&cbuf), count_overwrite);
+    }
+    else
+    {
+        printf("Failed to resize to %u bytes\n", len);
+        errors++;
+    }
+    cbuf_viz(&cbuf);
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    init();
+
+    write_blob("bytes 0" PAD);
+    write_blob("bytes 1 lorem ipsum dolor sit amet" PAD);
+    write_blob("bytes 2" PAD);
+    write_blob("bytes 3 but also something longer" PAD);
+    write_blob("bytes 4" PAD);
+    write_blob("bytes 6" PAD);
+    write_blob("bytes 7 and some stuff" PAD);
+    write_blob("bytes 8 but why" PAD);
+    write_blob("bytes 9" PAD);
+
+    peek_all();
+    find_last("bytes", true);
+    find_last("...]", false);
+    find_last("but", false);
+    find_last("nothing like this", false);
+    find_wrapped();
+    read_all();
+
+    reserve_blob("reserved 0" PAD);
+    reserve_blob("reserved 1 lorem ipsum dolor sit amet" PAD);
+    reserve_blob("reserved 2" PAD);
+    reserve_blob("reserved 3 but also something longer" PAD);
+    reserve_blob("reserved 4" PAD);
+
+    read_one();
+    view_all();
+
+    write_blob("batch 0" PAD);
+    write_blob("batch 1 lorem ipsum dolor sit amet" PAD);
+    write_blob("batch 2" PAD);
+    read_batch_all();
+
+    write_blob("resize 0" PAD);
+    write_blob("resize 1 lorem ipsum dolor sit amet" PAD);
+    write_blob("resize 2" PAD);
+    write_blob("resize 3 but also something longer" PAD);
+    resize(small_mbuf, sizeof(small_mbuf));
+    resize(large_mbuf, sizeof(large_mbuf));
+    write_blob("resize 4" PAD);
+    write_blob("resize 5 lorem ipsum dolor sit amet" PAD);
+    peek_all();
+    read_all();
+
+    test_report("Demo", errors + (cbuf_count(&cbuf) != 0));
+    return test_result();
+}
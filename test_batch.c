@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (1000)
+#define MESSAGE_MAX_LEN (300)
+#define ROUNDS (50000)
+#define BATCH_MAX (8)
+
+//One ring is written in batches, its twin one blob at a time
+static cbuf_t batched;
+static cbuf_t single;
+static _Alignas(64) uint8_t batched_mbuf[MESSAGE_Q_LEN];
+static _Alignas(64) uint8_t single_mbuf[MESSAGE_Q_LEN];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t batched_offsets[MESSAGE_Q_LEN / 4];
+static uint32_t single_offsets[MESSAGE_Q_LEN / 4];
+#endif
+
+static void init(cbuf_t *cbuf, uint8_t *mbuf)
+{
+    cbuf_init(cbuf, mbuf, MESSAGE_Q_LEN);
+#if defined(CBUF_ALIGN)
+    cbuf_set_align(cbuf, 16);
+#endif
+}
+
+//The twins must agree on everything a reader or the next writer could see
+static uint32_t compare(void)
+{
+    uint32_t errors = (batched.ridx != single.ridx) || (batched.widx != single.widx);
+    errors += (cbuf_count(&batched) != cbuf_count(&single));
+    errors += (memcmp(batched_mbuf, single_mbuf, MESSAGE_Q_LEN) != 0);
+#if defined(CBUF_BLOB_INDEX)
+    errors += (memcmp(batched_offsets, single_offsets, sizeof(batched_offsets)) != 0);
+#endif
+    return errors;
+}
+
+//Write random runs of blobs, some larger than the buffer or empty, with and without overwrite, and
+//read a few now and then. A batch must write, erase and report exactly what a loop of writes does.
+static uint32_t run(void)
+{
+    static uint8_t msg[BATCH_MAX][MESSAGE_MAX_LEN];
+    static uint8_t huge[MESSAGE_Q_LEN];
+    uint8_t out[MESSAGE_Q_LEN];
+    uint32_t errors = 0;
+    uint32_t rng = 1;
+    uint32_t seq = 0;
+    uint32_t cut_short = 0;
+
+    init(&batched, batched_mbuf);
+    init(&single, single_mbuf);
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&batched, batched_offsets, MESSAGE_Q_LEN / 4);
+    cbuf_init_index(&single, single_offsets, MESSAGE_Q_LEN / 4);
+#endif
+    for (uint32_t round = 0; round < ROUNDS; round++)
+    {
+        cbuf_blob_t blobs[BATCH_MAX];
+        rng = rng * 1103515245u + 12345u;
+        uint32_t n = 1 + (rng >> 8) % BATCH_MAX;
+        bool allow_overwrite = ((rng >> 20) % 4) != 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            rng = rng * 1103515245u + 12345u;
+            blobs[i].data = msg[i];
+            blobs[i].len = test_message(msg[i], seq++, MESSAGE_MAX_LEN);
+            if (((rng >> 12) % 61) == 0)
+            {
+                blobs[i].len = 0;
+            }
+            else if (((rng >> 12) % 61) == 1)
+            {
+                blobs[i].data = huge;
+                blobs[i].len = MESSAGE_Q_LEN;
+            }
+        }
+
+        uint32_t batched_overwrite = 0;
+        uint32_t single_overwrite = 0;
+        uint32_t written = cbuf_write_batch(&batched, blobs, n, allow_overwrite, &batched_overwrite);
+        uint32_t expect = 0;
+        uint32_t erased = 0;
+        while ((expect < n) && cbuf_write(&single, blobs[expect].data, blobs[expect].len, allow_overwrite, &erased))
+        {
+            single_overwrite += erased;
+            expect++;
+        }
+        errors += (written != expect) || (batched_overwrite != single_overwrite);
+        cut_short += (written < n);
+
+        for (uint32_t reads = (rng >> 24) % 4; reads > 0; reads--)
+        {
+            errors += (cbuf_read(&batched, out) != cbuf_read(&single, out));
+        }
+        errors += compare();
+    }
+    printf("  %u rounds, %u cut short\n", ROUNDS, cut_short);
+    return errors + (cut_short == 0);
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(batched_mbuf));
+    test_report("Batch matches single writes", run());
+    return test_result();
+}
@@ -0,0 +1,170 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "cbuf.hpp"
+#include "test_util.h"
+
+#define ROUNDS (20000)
+#define MESSAGE_MAX_LEN (100)
+
+#if defined(CBUF_ALIGN)
+using ring_t = blobcirc::ring<1000, blobcirc::c_header_t, blobcirc::options<8>>;
+#else
+using ring_t = blobcirc::ring<1000>;
+#endif
+
+struct sample {
+    uint32_t seq;
+    float value;
+    uint16_t flags;
+};
+
+static ring_t ring;
+
+//Write with one API and read with the other, with the buffer wrapping and overwriting as it goes
+static uint32_t mixed(bool cpp_writes)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t next = 0;
+    uint32_t errors = 0;
+    cbuf_t *c = ring.raw();
+
+    for (uint32_t seq = 0; seq < ROUNDS; seq++)
+    {
+        uint32_t len = test_message(msg, seq, MESSAGE_MAX_LEN);
+        uint32_t erased = 0;
+        bool ok = cpp_writes ? ring.write(msg, len, true, &erased) : cbuf_write(c, msg, len, true, &erased);
+        errors += !ok;
+        next += erased;
+
+        //Drain every few writes, so that the ring sometimes fills up and erases old blobs
+        if ((seq % 19) != 18)
+        {
+            continue;
+        }
+        while (ring.count() > (seq % 3))
+        {
+            uint32_t rlen = MESSAGE_MAX_LEN;
+            if (cpp_writes)
+            {
+                cbuf_peek(c, msg, &rlen);
+                cbuf_read(c, NULL);
+            }
+            else
+            {
+                blobcirc::view v;
+                ring.peek(v);
+                rlen = v.size();
+                memcpy(msg, v.first.data(), v.first.size());
+                memcpy(msg + v.first.size(), v.second.data(), v.second.size());
+                ring.consume();
+            }
+            errors += test_check_message(msg, rlen, next, MESSAGE_MAX_LEN);
+            next++;
+        }
+    }
+    while (ring.read(msg))
+    {
+        next++;
+    }
+    errors += (next != ROUNDS);
+    return errors;
+}
+
+//Typed writes and reads, and in-place writes through a reservation
+static uint32_t typed(void)
+{
+    uint32_t errors = 0;
+    cbuf_t *c = ring.raw();
+
+    for (uint32_t seq = 0; seq < ROUNDS; seq++)
+    {
+        sample s = {seq, seq * 0.5f, (uint16_t)seq};
+        errors += !ring.write(s);
+
+        {
+            auto r = ring.reserve(sizeof(seq));
+            if (!r)
+            {
+                errors++;
+                continue;
+            }
+            memcpy(r.first.data(), &seq, r.first.size());
+            memcpy(r.second.data(), (uint8_t*)&seq + r.first.size(), r.second.size());
+            if ((seq % 5) != 0)
+            {
+                r.commit(sizeof(seq));
+            }
+            //Otherwise it is aborted when r goes out of scope
+        }
+
+        sample out;
+        uint32_t got = 0;
+        uint32_t len;
+        errors += (cbuf_peek_len(c, &len) == 0) || (len != sizeof(sample));
+        len = sizeof(got);
+        errors += !ring.read(out) || (out.seq != seq) || (out.value != seq * 0.5f);
+        errors += ring.read(out);   //The committed blob is the wrong size for a sample
+        if ((seq % 5) != 0)
+        {
+            errors += (cbuf_peek(c, &got, &len) == 0) || (got != seq);
+            ring.consume();
+        }
+        errors += (ring.count() != 0);
+    }
+    return errors;
+}
+
+//The largest blobs, written into an empty ring: the fast path refuses exactly what cbuf_write does
+static uint32_t largest(void)
+{
+    static uint8_t big[ring_t::capacity];
+    uint32_t errors = 0;
+    for (uint32_t len = ring_t::capacity - 2 * (ring_t::header_size + ring_t::align); len <= ring_t::capacity; len++)
+    {
+        ring.consume(ring.count());
+        bool fits = ring_t::blob_size(len) < (ring_t::capacity - 1);
+        errors += (ring.write(big, len, false) != fits) || (ring.count() != (fits ? 1u : 0u));
+    }
+    ring.consume(ring.count());
+    return errors;
+}
+
+#if defined(CBUF_ALIGN)
+//An alignment wider than a cache line: the C functions must put blobs where the fast path does, in
+//every ring of an array
+static blobcirc::ring<4096, blobcirc::c_header_t, blobcirc::options<128>> wide[2];
+
+static uint32_t wide_align(uint32_t w)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    cbuf_t *c = wide[w].raw();
+    uint32_t errors = (c->align != 128) || (((uintptr_t)c->buf % 128) != 0);
+    for (uint32_t seq = 0; seq < ROUNDS; seq += 2)
+    {
+        errors += !wide[w].write(msg, test_message(msg, seq, MESSAGE_MAX_LEN));
+        errors += !cbuf_write(c, msg, test_message(msg, seq + 1, MESSAGE_MAX_LEN), true, NULL);
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            uint32_t len = MESSAGE_MAX_LEN;
+            errors += (cbuf_peek(c, msg, &len) == 0) || test_check_message(msg, len, seq + i, MESSAGE_MAX_LEN);
+            cbuf_read(c, NULL);
+        }
+    }
+    return errors;
+}
+#endif
+
+int main(void)
+{
+    printf("Ring is %zu bytes, %u byte header, %u byte alignment\n", sizeof(ring), ring_t::header_size, ring_t::align);
+    test_report("C++ writes, C reads", mixed(true));
+    test_report("C writes, C++ reads", mixed(false));
+    test_report("Typed and reserved", typed());
+    test_report("Largest blobs", largest());
+#if defined(CBUF_ALIGN)
+    test_report("Wide alignment", wide_align(0) + wide_align(1));
+#endif
+    return test_result();
+}
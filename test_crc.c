@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (1000)
+#define MESSAGE_MAX_LEN (100)
+#define ROUNDS (20000)
+#define DATA_LEN (4096)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t offsets[MESSAGE_Q_LEN / 4];
+#endif
+
+//Bit at a time CRC32C, to check the fast one against
+static uint32_t crc32c_ref(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+//The check value of CRC32C, and every start alignment and length, whole and in two pieces
+static uint32_t crc_test(void)
+{
+    static uint8_t data[DATA_LEN];
+    uint32_t errors = (cbuf_crc32c(0, "123456789", 9) != 0xE3069283u);
+    for (uint32_t i = 0; i < DATA_LEN; i++)
+    {
+        data[i] = (uint8_t)(i * 131 + (i >> 7));
+    }
+    for (uint32_t start = 0; start < 16; start++)
+    {
+        for (uint32_t len = 0; len < DATA_LEN - start; len += 1 + len / 8)
+        {
+            uint32_t ref = crc32c_ref(0, &data[start], len);
+            errors += (cbuf_crc32c(0, &data[start], len) != ref);
+            errors += (cbuf_crc32c(cbuf_crc32c(0, &data[start], len / 3), &data[start + len / 3], len - len / 3) != ref);
+        }
+    }
+    return errors;
+}
+
+static void init(void)
+{
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&cbuf, offsets, MESSAGE_Q_LEN / 4);
+#endif
+}
+
+//Read one blob, resyncing past any damage first. Blobs that come out must be intact and in order.
+static uint32_t read_checked(uint32_t *next, uint32_t *damaged)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t len;
+    uint32_t seq;
+
+    while (cbuf_corrupt(&cbuf))
+    {
+        (*damaged)++;
+        if ((cbuf_peek_len(&cbuf, &len) != 0) || (cbuf_read(&cbuf, msg) != 0) || (cbuf_resync(&cbuf) == 0))
+        {
+            return 1;
+        }
+    }
+    if (!cbuf_peek_len(&cbuf, &len))
+    {
+        return 0;
+    }
+    cbuf_read(&cbuf, msg);
+    memcpy(&seq, msg, sizeof(seq));
+    uint32_t errors = (seq < *next) || test_check_message(msg, len, seq, MESSAGE_MAX_LEN);
+    *next = seq + 1;
+    return errors;
+}
+
+//Damage the oldest header in a few ways; each is caught before the length is trusted
+static uint32_t header_test(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t next = 0;
+    uint32_t damaged = 0;
+    const uint8_t hits[3] = {0x01, 0x7F, 0xFF};
+
+    init();
+    for (uint32_t seq = 0; seq < 100; seq++)
+    {
+        cbuf_write(&cbuf, msg, test_message(msg, seq, MESSAGE_MAX_LEN), true, NULL);
+    }
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        //The length is at the start of the header
+        errors += read_checked(&next, &damaged);
+        uint32_t first = next;
+        mbuf[cbuf.ridx] ^= hits[i];
+        errors += (cbuf_read(&cbuf, msg) != 0) || !cbuf_corrupt(&cbuf);
+        errors += read_checked(&next, &damaged);
+        errors += (next != first + 2);
+    }
+    while (cbuf_count(&cbuf))
+    {
+        errors += read_checked(&next, &damaged);
+    }
+    return errors + (damaged != 3) + (next != 100);
+}
+
+//Write, flip a byte somewhere in the queued data now and then, and read. Every blob that comes out
+//is intact, and every flip in a header or body is noticed. The writer waits for the reader.
+static uint32_t flip_test(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t next = 0;
+    uint32_t damaged = 0;
+    uint32_t flips = 0;
+
+    init();
+    for (uint32_t seq = 0; seq < ROUNDS; seq++)
+    {
+        uint32_t len = test_message(msg, seq, MESSAGE_MAX_LEN);
+        while (!cbuf_write(&cbuf, msg, len, false, NULL))
+        {
+            errors += read_checked(&next, &damaged);
+        }
+        if ((seq % 13) == 0)
+        {
+            uint32_t used = (cbuf.widx >= cbuf.ridx) ? (cbuf.widx - cbuf.ridx) : (MESSAGE_Q_LEN - cbuf.ridx + cbuf.widx);
+            uint32_t at = (cbuf.ridx + (seq * 7919) % used) % MESSAGE_Q_LEN;
+            mbuf[at] ^= (uint8_t)(1 + seq % 255);
+            flips++;
+        }
+        if ((seq % 3) == 0)
+        {
+            errors += read_checked(&next, &damaged);
+        }
+    }
+    while (cbuf_count(&cbuf))
+    {
+        errors += read_checked(&next, &damaged);
+    }
+    printf("  %u flips, %u damaged blobs skipped\n", flips, damaged);
+    return errors + (damaged == 0) + (damaged > flips);
+}
+
+//Damage the oldest blob, then keep writing over it. Without an offset index the damaged length
+//can't be trusted to find the next blob, so the write fails until the damage is skipped.
+static uint32_t overwrite_test(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t next = 0;
+    uint32_t damaged = 0;
+    uint32_t refused = 0;
+
+    init();
+    for (uint32_t seq = 0; seq < ROUNDS; seq++)
+    {
+        uint32_t len = test_message(msg, seq, MESSAGE_MAX_LEN);
+        if ((seq % 17) == 0)
+        {
+            //The length is at the start of the header; make it run far past the queued data
+            mbuf[cbuf.ridx] ^= 0x80;
+            mbuf[(cbuf.ridx + 1) % MESSAGE_Q_LEN] ^= 0x7F;
+        }
+        while (!cbuf_write(&cbuf, msg, len, true, NULL))
+        {
+            refused++;
+            errors += !cbuf_corrupt(&cbuf) || (cbuf_resync(&cbuf) == 0) || (refused > ROUNDS);
+            damaged++;
+        }
+        if ((seq % 5) == 0)
+        {
+            errors += read_checked(&next, &damaged);
+        }
+    }
+    while (cbuf_count(&cbuf))
+    {
+        errors += read_checked(&next, &damaged);
+    }
+    printf("  %u damaged blobs skipped, %u writes refused\n", damaged, refused);
+#if defined(CBUF_BLOB_INDEX)
+    return errors + (refused != 0);
+#else
+    return errors + (refused == 0);
+#endif
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    test_report("CRC32C", crc_test());
+    test_report("Damaged headers", header_test());
+    test_report("Flipped bytes", flip_test());
+    test_report("Overwriting damaged blobs", overwrite_test());
+    return test_result();
+}
@@ -0,0 +1,295 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#if defined(CBUF_POW2)
+#define MESSAGE_Q_LEN (1024)
+#else
+#define MESSAGE_Q_LEN (1000)
+#endif
+#define SEND_Q_LEN (8192)         //Holds more than a unix socket takes in one go
+#define MESSAGE_MAX_LEN (200)
+#define MESSAGE_COUNT (20000)
+#define STREAM_LEN (1u << 20)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN];
+static uint8_t sbuf[SEND_Q_LEN];
+static uint8_t rx[STREAM_LEN];
+static uint8_t tx[STREAM_LEN];
+
+//Check the messages that have fully arrived, and move the rest to the front. Raw messages carry the
+//header they had in the buffer.
+static uint32_t check_messages(uint32_t *have, uint32_t *next, bool raw)
+{
+    uint32_t at = 0;
+    uint32_t errors = 0;
+    while (true)
+    {
+        uint32_t len = test_message_len(0, 0, *next, MESSAGE_MAX_LEN);
+        uint32_t hdr = raw ? 4 : 0;
+        if ((*have - at) < (hdr + len))
+        {
+            break;
+        }
+        if (raw)
+        {
+            uint32_t stored;
+            memcpy(&stored, &rx[at], sizeof(stored));
+            errors += (stored != len);
+        }
+        errors += test_check_message(&rx[at + hdr], len, *next, MESSAGE_MAX_LEN);
+        at += hdr + len;
+        (*next)++;
+    }
+    memmove(rx, &rx[at], *have - at);
+    *have -= at;
+    return errors;
+}
+
+//Send blobs through a socket with a small send buffer, so that the kernel often takes part of one
+static uint32_t send_test(bool raw)
+{
+    int sv[2];
+    int sndbuf = 1024;
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t seq = 0;
+    uint32_t next = 0;
+    uint32_t have = 0;
+    uint32_t errors = 0;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    cbuf_init(&cbuf, sbuf, SEND_Q_LEN);
+
+    while (next < MESSAGE_COUNT)
+    {
+        //Queue what fits, then send some of it and receive some of that
+        while ((seq < MESSAGE_COUNT) && cbuf_write(&cbuf, msg, test_message(msg, seq, MESSAGE_MAX_LEN), false, NULL))
+        {
+            seq++;
+        }
+        if ((cbuf_write_to_fd(&cbuf, sv[0], 1 + seq % CBUF_FD_BLOBS, raw) < 0) && (errno != EAGAIN))
+        {
+            errors++;
+            break;
+        }
+        ssize_t got = read(sv[1], &rx[have], 1 + (seq * 13) % 700);
+        if (got > 0)
+        {
+            have += got;
+            errors += check_messages(&have, &next, raw);
+        }
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    return errors + (cbuf_count(&cbuf) != 0);
+}
+
+//Receive a stream from a pipe straight into blobs, some of them built up across several reads
+static uint32_t receive_test(void)
+{
+    int p[2];
+    uint32_t sent = 0;
+    uint32_t got = 0;
+    uint32_t errors = 0;
+
+    if (pipe(p) != 0)
+    {
+        return 1;
+    }
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    for (uint32_t i = 0; i < STREAM_LEN; i++)
+    {
+        tx[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+
+    for (uint32_t round = 0; sent < STREAM_LEN; round++)
+    {
+        uint32_t chunk = 1 + (round * 337) % 900;
+        chunk = (chunk < (STREAM_LEN - sent)) ? chunk : (STREAM_LEN - sent);
+        if (write(p[1], &tx[sent], chunk) != chunk)
+        {
+            return errors + 1;
+        }
+        sent += chunk;
+
+#if defined(CBUF_ALLOW_PARTIAL)
+        bool open = (round % 2) && cbuf_open(&cbuf, false, NULL);
+#endif
+        //Read it back in pieces until the pipe is empty, draining the buffer when it fills up
+        int32_t n;
+        do {
+            n = cbuf_write_from_fd(&cbuf, p[0], 1 + (round * 53) % 300, false, NULL);
+            if ((n < 0) && (errno == ENOBUFS))
+            {
+#if defined(CBUF_ALLOW_PARTIAL)
+                if (open)
+                {
+                    //The open blob can't be drained; close it and carry on in a new one
+                    cbuf_close(&cbuf);
+                    open = false;
+                }
+#endif
+                uint32_t len;
+                while (cbuf_peek_len(&cbuf, &len))
+                {
+                    cbuf_read(&cbuf, &rx[got]);
+                    got += len;
+                }
+                n = 1;
+            }
+        } while (n > 0);
+        errors += (errno != EAGAIN);
+#if defined(CBUF_ALLOW_PARTIAL)
+        if (open)
+        {
+            cbuf_close(&cbuf);
+        }
+#endif
+    }
+
+    uint32_t len;
+    while (cbuf_peek_len(&cbuf, &len))
+    {
+        cbuf_read(&cbuf, &rx[got]);
+        got += len;
+    }
+    close(p[0]);
+    close(p[1]);
+    return errors + (got != STREAM_LEN) + (memcmp(rx, tx, STREAM_LEN) != 0);
+}
+
+//Send blobs until the buffer is empty, receiving what arrives into got, which holds size bytes
+static uint32_t send_all(int sv[2], uint8_t *got, uint32_t size, uint32_t *have)
+{
+    uint32_t errors = 0;
+    ssize_t n = 1;
+    while ((cbuf_count(&cbuf) != 0) || (n > 0))
+    {
+        errors += (cbuf_write_to_fd(&cbuf, sv[0], 1, false) < 0) && (errno != EAGAIN);
+        n = read(sv[1], &got[*have], size - *have);
+        *have += (n > 0) ? n : 0;
+    }
+    return errors;
+}
+
+//The kernel takes part of a blob. Consuming nothing keeps the rest of it to send. Once a blob the
+//kernel took part of is read some other way and a new blob lands at the same index, the next send
+//starts the new blob from its first byte.
+static uint32_t resume_test(void)
+{
+    static uint8_t ring[4 * 8192];
+    static uint8_t body[8192];
+    static uint8_t got[2 * 8192];   //Room for anything sent twice
+    int sv[2];
+    int sndbuf = 1024;
+    uint32_t have = 0;
+    uint32_t errors = 0;
+
+    //Size the bodies so that four blobs fill the ring exactly, whatever the header size
+    cbuf_init(&cbuf, ring, sizeof(ring));
+    cbuf_write(&cbuf, body, 0, false, NULL);
+    uint32_t len = 8192 - cbuf.widx;
+    cbuf_init(&cbuf, ring, sizeof(ring));
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+    memset(body, 0xAA, len);
+    cbuf_write(&cbuf, body, len, false, NULL);
+    int32_t put = cbuf_write_to_fd(&cbuf, sv[0], 1, false);
+    errors += (put <= 0) || ((uint32_t)put >= len) || (cbuf_consume(&cbuf, 0) != 0);
+    errors += send_all(sv, got, sizeof(got), &have);
+    errors += (have != len) || (memcmp(got, body, len) != 0);
+
+    cbuf_write(&cbuf, body, len, false, NULL);
+    put = cbuf_write_to_fd(&cbuf, sv[0], 1, false);
+    errors += (put <= 0) || ((uint32_t)put >= len) || (cbuf_count(&cbuf) != 1);
+    while (read(sv[1], got, sizeof(got)) > 0);
+    uint32_t sidx = cbuf.ridx;
+    cbuf_read(&cbuf, NULL);
+
+    //Go once around the ring, so that the next blob starts where the partly sent one did
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        errors += !cbuf_write(&cbuf, body, len, false, NULL);
+        cbuf_read(&cbuf, NULL);
+    }
+    for (uint32_t i = 0; i < len; i++)
+    {
+        body[i] = (uint8_t)(i * 7);
+    }
+    errors += !cbuf_write(&cbuf, body, len, false, NULL) || (cbuf.ridx != sidx);
+    have = 0;
+    errors += send_all(sv, got, sizeof(got), &have);
+
+    close(sv[0]);
+    close(sv[1]);
+    return errors + (have != len) + (memcmp(got, body, len) != 0);
+}
+
+//A read asking for more than the room left takes what fits, and only fails once there is no room
+static uint32_t room_test(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint8_t out[MESSAGE_Q_LEN];
+    uint32_t errors = 0;
+    uint32_t erased = 0;
+    int p[2];
+
+    if (pipe(p) != 0)
+    {
+        return 1;
+    }
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    for (uint32_t i = 0; i < 4096; i++)
+    {
+        tx[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    errors += (write(p[1], tx, 4096) != 4096);
+
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        errors += !cbuf_write(&cbuf, msg, test_message(msg, seq, MESSAGE_MAX_LEN), false, NULL);
+    }
+    int32_t n = cbuf_write_from_fd(&cbuf, p[0], 4096, false, NULL);
+    uint32_t len = sizeof(out);
+    errors += (n <= 0) || (n >= 4096);
+    errors += (cbuf_peek_nth(&cbuf, 3, out, &len) == 0) || (len != (uint32_t)n) || (memcmp(out, tx, len) != 0);
+
+    //Fill what is left, then erase old blobs for more
+    while (cbuf_write_from_fd(&cbuf, p[0], 4096, false, NULL) > 0);
+    errors += (errno != ENOBUFS);
+    errors += (cbuf_write_from_fd(&cbuf, p[0], 4096, true, &erased) <= 0) || (erased == 0);
+
+    close(p[0]);
+    close(p[1]);
+    return errors;
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    test_report("Send bodies", send_test(false));
+    test_report("Send raw", send_test(true));
+    test_report("Receive", receive_test());
+    test_report("Resume after the head moved", resume_test());
+    test_report("Read into the room left", room_test());
+    return test_result();
+}
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (4096)
+#define MESSAGE_MAX_LEN (300)
+#define ROUNDS (100000)
+
+static cbuf_t cbuf;
+
+//Count 1 unless a view is one segment holding exactly the message for seq. Views of blobs that
+//run past the end of the buffer are counted in *straddled.
+static uint32_t check_view(const cbuf_view_t *view, uint32_t seq, uint32_t *straddled)
+{
+    *straddled += (view->seg[0] + view->len[0]) > (cbuf.buf + cbuf.len);
+    return (view->len[1] != 0) || test_check_message(view->seg[0], view->len[0], seq, MESSAGE_MAX_LEN);
+}
+
+//Write blobs with cbuf_write and cbuf_reserve/cbuf_commit, and read them back with cbuf_read,
+//cbuf_peek and cbuf_peek_view, so that every way in and out meets blobs across the wrap point.
+//Every span and view of a mirrored buffer is a single segment.
+static uint32_t run(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t wseq = 0;
+    uint32_t rseq = 0;
+    uint32_t straddled = 0;
+    uint32_t rng = 1;
+
+    errors += !cbuf_init_mirror(&cbuf, MESSAGE_Q_LEN) || (cbuf.len != MESSAGE_Q_LEN);
+
+    //The memory past the end is the start of the buffer
+    cbuf.buf[0] = 0x5A;
+    errors += (cbuf.buf[cbuf.len] != 0x5A);
+
+    for (uint32_t round = 0; round < ROUNDS; round++)
+    {
+        rng = rng * 1103515245u + 12345u;
+        uint32_t len = test_message(msg, wseq, MESSAGE_MAX_LEN);
+        if ((rng >> 16) % 2)
+        {
+            wseq += cbuf_write(&cbuf, msg, len, false, NULL);
+        }
+        else
+        {
+            cbuf_span_t span;
+            if (cbuf_reserve(&cbuf, MESSAGE_MAX_LEN, false, NULL, &span))
+            {
+                errors += (span.len[1] != 0) || (span.len[0] < MESSAGE_MAX_LEN);
+                memcpy(span.seg[0], msg, len);
+                errors += !cbuf_commit(&cbuf, len);
+                wseq++;
+            }
+        }
+
+        //Read about as fast as writing, so the buffer stays part full and the blobs move around it
+        for (uint32_t reads = (rng >> 24) % 3; reads > 0; reads--)
+        {
+            cbuf_view_t view;
+            uint32_t got = MESSAGE_MAX_LEN;
+            if (!cbuf_peek_view(&cbuf, &view))
+            {
+                break;
+            }
+            errors += check_view(&view, rseq, &straddled);
+            errors += (cbuf_peek(&cbuf, msg, &got) == 0) || test_check_message(msg, got, rseq, MESSAGE_MAX_LEN);
+            errors += (cbuf_read(&cbuf, msg) == 0) || test_check_message(msg, got, rseq, MESSAGE_MAX_LEN);
+            rseq++;
+        }
+    }
+
+    //Walk what's left in place, then drain it
+    cbuf_iter_t it;
+    cbuf_view_t view;
+    uint32_t seq = rseq;
+    cbuf_iter_begin(&cbuf, &it);
+    while (cbuf_iter_next(&cbuf, &it, &view))
+    {
+        errors += check_view(&view, seq++, &straddled);
+    }
+    while (cbuf_read(&cbuf, msg))
+    {
+        rseq++;
+    }
+    errors += (seq != wseq) || (rseq != wseq);
+
+    printf("  %u blobs, %u views across the wrap point\n", wseq, straddled);
+    cbuf_deinit_mirror(&cbuf);
+    return errors + (straddled == 0);
+}
+
+int main(void)
+{
+    printf("Message queue is %u bytes\n", MESSAGE_Q_LEN);
+    test_report("Mirrored buffer", run());
+    return test_result();
+}
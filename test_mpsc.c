@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (4096)
+#define MESSAGE_MAX_LEN (200)
+#define MESSAGE_COUNT (250000)  //Per producer
+#define MAX_PRODUCERS (4)
+#define BATCH (4)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN] __attribute__((aligned(4)));
+
+static atomic_uint running;
+
+//Even producers write one blob at a time, odd ones in batches
+static void *producer(void *arg)
+{
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    uint8_t msg[BATCH][MESSAGE_MAX_LEN];
+    cbuf_blob_t blobs[BATCH];
+
+    for (uint32_t seq = 0; seq < MESSAGE_COUNT; )
+    {
+        uint32_t n = (id & 1) ? BATCH : 1;
+        n = (MESSAGE_COUNT - seq < n) ? (MESSAGE_COUNT - seq) : n;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            blobs[i].data = msg[i];
+            blobs[i].len  = test_tagged_message(msg[i], id, seq + i, MESSAGE_MAX_LEN);
+        }
+
+        uint32_t written = (n == 1) ? cbuf_write(&cbuf, blobs[0].data, blobs[0].len, false, NULL)
+                                    : cbuf_write_batch(&cbuf, blobs, n, false, NULL);
+        if (written == 0)
+        {
+            //Full; wait for the consumer
+            sched_yield();
+            continue;
+        }
+
+        //Retry whatever part of a batch didn't fit, keeping the sequence in order
+        for (uint32_t i = written; i < n; i++)
+        {
+            while (!cbuf_write(&cbuf, blobs[i].data, blobs[i].len, false, NULL))
+            {
+                sched_yield();
+            }
+        }
+        seq += n;
+    }
+    atomic_fetch_sub(&running, 1);
+    return NULL;
+}
+
+static void run(uint32_t producers)
+{
+    pthread_t threads[MAX_PRODUCERS];
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint8_t expect[MESSAGE_MAX_LEN];
+    int64_t last[MAX_PRODUCERS];
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    struct timespec t0, t1;
+
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+    atomic_store(&running, producers);
+    for (uint32_t p = 0; p < producers; p++)
+    {
+        last[p] = -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t p = 0; p < producers; p++)
+    {
+        pthread_create(&threads[p], NULL, producer, (void*)(uintptr_t)p);
+    }
+
+    while (1)
+    {
+        bool finished = (atomic_load(&running) == 0);
+        if (cbuf_read(&cbuf, msg) == 0)
+        {
+            if (finished) break;
+            sched_yield();
+            continue;
+        }
+
+        //Messages must arrive intact, and in order for each producer
+        uint32_t id, seq;
+        memcpy(&id, msg, sizeof(id));
+        memcpy(&seq, msg + sizeof(id), sizeof(seq));
+        if ((id >= producers) || (seq >= MESSAGE_COUNT))
+        {
+            errors++;
+            continue;
+        }
+        uint32_t len = test_tagged_message(expect, id, seq, MESSAGE_MAX_LEN);
+        if (memcmp(msg, expect, len) || ((int64_t)seq != last[id] + 1))
+        {
+            errors++;
+        }
+        last[id] = seq;
+        received++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (uint32_t p = 0; p < producers; p++)
+    {
+        pthread_join(threads[p], NULL);
+    }
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%d producers: %.0f msgs/s\n", producers, received / secs);
+    char name[64];
+    snprintf(name, sizeof(name), "%d producers: sent %d, received %d", producers, producers * MESSAGE_COUNT, received);
+    test_report(name, errors + (received != producers * MESSAGE_COUNT));
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    run(1);
+    run(2);
+    run(4);
+    return test_result();
+}
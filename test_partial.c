@@ -1,148 +1,295 @@
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdarg.h>
-#include <string.h>
-#include <time.h>
-
-#include "cbuf.h"
-
-#define MESSAGE_Q_LEN (128)
-
-static cbuf_t cbuf;
-static uint8_t mbuf[MESSAGE_Q_LEN];
-
-static void init(void)
-{
-    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
-}
-
-//Write a string that ends in a NULL
-void write_blob(const char* msg)
-{
-    uint32_t count_overwrite = 0;
-    if (cbuf_write(&cbuf, msg, strlen(msg) + 1, true, &count_overwrite))
-    {
-        printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
-    }
-    else
-    {
-        printf("Failed to enqueue a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
-    }
-
-    cbuf_viz(&cbuf); printf("\n");
-}
-
-//Write a string that doesn't end in a NULL
-void write_partial(const char* msg)
-{
-    uint32_t count_overwrite = 0;
-    if (cbuf_write(&cbuf, msg, strlen(msg), true, &count_overwrite))
-    {
-        printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg), count_overwrite);
-    }
-    else
-    {
-        printf("Failed to enqueue a message of %lu bytes (overwrote %d)\n", strlen(msg), count_overwrite);
-    }
-
-    cbuf_viz(&cbuf); printf("\n");
-}
-
-void open_blob()
-{
-    uint32_t count_overwrite = 0;
-    cbuf_open(&cbuf, true, &count_overwrite);
-
-    printf("Opened a new message (overwrote %d)\n", count_overwrite);
-    cbuf_viz(&cbuf); printf("\n");
-}
-
-void close_blob()
-{
-    cbuf_close(&cbuf);
-    printf("Closed\n");
-    cbuf_viz(&cbuf); printf("\n");
-}
-
-void read_one(void)
-{
-    char msg[MESSAGE_Q_LEN];
-    uint32_t len;
-    if (cbuf_peek_len(&cbuf, &len) > 0)
-    {
-        printf("Length to read: %d\n", len);
-        cbuf_read(&cbuf, msg);
-        printf("%s\n", msg);
-        cbuf_viz(&cbuf); printf("\n");
-    }
-    else
-    {
-        printf("Nothing to read\n");
-    }
-}
-
-void read_all(void)
-{
-    char msg[MESSAGE_Q_LEN];
-    uint32_t len;
-    while(cbuf_peek_len(&cbuf, &len))
-    {
-        printf("Length to read: %d\n", len);
-        cbuf_read(&cbuf, msg);
-        printf("%s\n", msg);
-        cbuf_viz(&cbuf); printf("\n");
-    }
-}
-
-#define PAD "[..................]" //20 charatacters of padding
-
-int main(void)
-{
-    printf("Message queue is %lu bytes\n", sizeof(mbuf));
-    init();
-
-    // write_blob("bytes 0" PAD);
-    // write_blob("bytes 1 lorem ipsum dolor sit amet" PAD);
-    // write_blob("bytes 2" PAD);
-    // write_blob("bytes 3 but also something longer" PAD);
-    // write_blob("bytes 4" PAD);
-    // write_blob("bytes 6" PAD);
-    // write_blob("bytes 7 and some stuff" PAD);
-    // write_blob("bytes 8 but why" PAD);
-    // write_blob("bytes 9" PAD);
-
-    write_blob("Buffer Fill 1" PAD);
-    write_blob("Buffer Fill 2" PAD);
-    write_blob("Buffer Fill 3" PAD);
-
-    open_blob();
-    write_partial(PAD);
-    write_partial(PAD);
-    write_partial("hello ");
-    write_blob("world!");
-    write_partial(PAD);
-    write_partial(PAD);
-    write_partial(PAD);
-    write_partial(PAD);
-    write_partial(PAD);
-    close_blob();
-
-    read_all();
-
-    write_blob("Buffer Fill 1" PAD);
-    write_blob("Buffer Fill 2" PAD);
-    write_blob("Buffer Fill 3" PAD);
-    open_blob();
-    write_partial(PAD);
-    read_one();
-    write_partial(PAD);
-    read_one();
-    write_partial(PAD);
-    read_one();
-    write_blob(PAD);
-    read_one();
-    close_blob();
-    read_all();
-
-}
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (128)
+
+static cbuf_t cbuf;
+static _Alignas(64) uint8_t mbuf[MESSAGE_Q_LEN];
+
+static _Alignas(64) uint8_t large_mbuf[MESSAGE_Q_LEN * 2];
+
+//Things that went wrong on the way through the demo, as opposed to writes it expects to be refused
+static uint32_t errors;
+
+static void init(void)
+{
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+#if defined(CBUF_ALIGN)
+    if (!cbuf_set_align(&cbuf, 8))
+    {
+        printf("Failed to align the buffer\n");
+        errors++;
+    }
+#endif
+}
+
+//Write a string that ends in a NULL
+void write_blob(const char* msg)
+{
+    uint32_t count_overwrite = 0;
+    if (cbuf_write(&cbuf, msg, strlen(msg) + 1, true, &count_overwrite))
+    {
+        printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
+    }
+    else
+    {
+        printf("Failed to enqueue a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
+    }
+
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+//Write a string that doesn't end in a NULL
+void write_partial(const char* msg)
+{
+    uint32_t count_overwrite = 0;
+    if (cbuf_write(&cbuf, msg, strlen(msg), true, &count_overwrite))
+    {
+        printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg), count_overwrite);
+    }
+    else
+    {
+        printf("Failed to enqueue a message of %lu bytes (overwrote %d)\n", strlen(msg), count_overwrite);
+    }
+
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+void open_blob()
+{
+    uint32_t count_overwrite = 0;
+    cbuf_open(&cbuf, true, &count_overwrite);
+
+    printf("Opened a new message (overwrote %d)\n", count_overwrite);
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+void close_blob()
+{
+    cbuf_close(&cbuf);
+    printf("Closed\n");
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+void read_one(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    uint32_t len;
+    if (cbuf_peek_len(&cbuf, &len) > 0)
+    {
+        printf("Length to read: %d\n", len);
+        errors += (cbuf_read(&cbuf, msg) == 0);
+        printf("%s\n", msg);
+        cbuf_viz(&cbuf); printf("\n");
+    }
+    else
+    {
+        printf("Nothing to read\n");
+    }
+}
+
+void read_all(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    uint32_t len;
+    while(cbuf_peek_len(&cbuf, &len))
+    {
+        printf("Length to read: %d\n", len);
+        errors += (cbuf_read(&cbuf, msg) == 0);
+        printf("%s\n", msg);
+        cbuf_viz(&cbuf); printf("\n");
+    }
+}
+
+//Feed a stream of lines in chunks that don't line up with them, as a UART or socket would deliver it
+void ingest(const char *stream, uint32_t chunk)
+{
+    uint32_t len = strlen(stream);
+    for (uint32_t at = 0; at < len; at += chunk)
+    {
+        uint32_t n = ((len - at) < chunk) ? (len - at) : chunk;
+        uint32_t count_overwrite = 0;
+        uint32_t taken = cbuf_ingest(&cbuf, &stream[at], n, '\n', true, &count_overwrite);
+        printf("Ingested %u of %u bytes, %u lines queued (overwrote %d)\n", taken, n, cbuf_count(&cbuf), count_overwrite);
+    }
+    cbuf_viz(&cbuf); printf("\n");
+}
+
+//Read lines, which end in their delimiter rather than a NULL
+void read_lines(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    uint32_t len;
+    while(cbuf_peek_len(&cbuf, &len))
+    {
+        errors += (cbuf_read(&cbuf, msg) == 0) || (msg[len - 1] != '\n');
+        printf("Line of %d bytes: %.*s", len, (int)len, msg);
+    }
+}
+
+#if defined(CBUF_STATS)
+void print_stats(void)
+{
+    cbuf_stats_t stats;
+    cbuf_stats(&cbuf, &stats);
+    printf("Written %lu blobs / %lu bytes, read %lu blobs / %lu bytes, evicted %lu blobs / %lu bytes\n",
+           stats.blobs_written, stats.bytes_written, stats.blobs_read, stats.bytes_read,
+           stats.blobs_evicted, stats.bytes_evicted);
+    printf("Rejected %lu too large, %lu without room. High water %u of %u bytes\n",
+           stats.rejected_too_large, stats.rejected_no_room, stats.high_water, MESSAGE_Q_LEN);
+    printf("Blob sizes:");
+    for (uint32_t b = 0; b < CBUF_STATS_BUCKETS; b++)
+    {
+        if (stats.size_hist[b])
+        {
+            printf(" <%u: %lu", 1u << b, stats.size_hist[b]);
+        }
+    }
+    printf("\n");
+}
+
+#define SIZED_LEN (256)
+
+//Fill a buffer to about used bytes without overwriting, then empty it, so its high-water mark for
+//the period is about used
+static void use_bytes(cbuf_t *sized, uint32_t used)
+{
+    uint8_t blob[16] = {0};
+    while ((sized->stats.high_water + sizeof(blob)) < used)
+    {
+        if (!cbuf_write(sized, blob, sizeof(blob), false, NULL))
+        {
+            break;
+        }
+    }
+    cbuf_consume(sized, SIZED_LEN);
+}
+
+//The suggested length follows the high-water mark of each period between calls
+static uint32_t suggest_test(void)
+{
+    static _Alignas(64) uint8_t sized_mbuf[SIZED_LEN];
+    cbuf_t sized;
+    uint32_t errors = 0;
+    cbuf_init(&sized, sized_mbuf, SIZED_LEN);
+
+    //Nearly full: double
+    use_bytes(&sized, SIZED_LEN);
+    errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN * 2);
+
+    //Between a quarter and three quarters: keep the length
+    use_bytes(&sized, SIZED_LEN / 2);
+    errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN);
+
+    //Below a quarter, period after period: halve each time
+    for (uint32_t period = 0; period < 3; period++)
+    {
+        use_bytes(&sized, SIZED_LEN / 8);
+        errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN / 2);
+    }
+
+    //Kept within the limits
+    use_bytes(&sized, SIZED_LEN);
+    errors += (cbuf_suggest_len(&sized, 64, 384) != 384);
+    use_bytes(&sized, SIZED_LEN / 8);
+    errors += (cbuf_suggest_len(&sized, 200, 1024) != 200);
+    use_bytes(&sized, SIZED_LEN / 2);
+    errors += (cbuf_suggest_len(&sized, 512, 1024) != 512);
+
+    //The mark restarts from what is still queued
+    uint8_t queued[SIZED_LEN / 2 - 28] = {0};
+    cbuf_write(&sized, queued, sizeof(queued), false, NULL);
+    errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN);
+    errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN);
+    cbuf_consume(&sized, 1);
+    errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN);
+    errors += (cbuf_suggest_len(&sized, 64, 1024) != SIZED_LEN / 2);
+    return errors;
+}
+#endif
+
+#define PAD "[..................]" //20 charatacters of padding
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    init();
+
+    // write_blob("bytes 0" PAD);
+    // write_blob("bytes 1 lorem ipsum dolor sit amet" PAD);
+    // write_blob("bytes 2" PAD);
+    // write_blob("bytes 3 but also something longer" PAD);
+    // write_blob("bytes 4" PAD);
+    // write_blob("bytes 6" PAD);
+    // write_blob("bytes 7 and some stuff" PAD);
+    // write_blob("bytes 8 but why" PAD);
+    // write_blob("bytes 9" PAD);
+
+    write_blob("Buffer Fill 1" PAD);
+    write_blob("Buffer Fill 2" PAD);
+    write_blob("Buffer Fill 3" PAD);
+
+    open_blob();
+    write_partial(PAD);
+    write_partial(PAD);
+    write_partial("hello ");
+    write_blob("world!");
+    write_partial(PAD);
+    write_partial(PAD);
+    write_partial(PAD);
+    write_partial(PAD);
+    write_partial(PAD);
+    close_blob();
+
+    read_all();
+
+    write_blob("Buffer Fill 1" PAD);
+    write_blob("Buffer Fill 2" PAD);
+    write_blob("Buffer Fill 3" PAD);
+    open_blob();
+    write_partial(PAD);
+    read_one();
+    write_partial(PAD);
+    read_one();
+    write_partial(PAD);
+    read_one();
+    write_blob(PAD);
+    read_one();
+    close_blob();
+    read_all();
+
+    //Grow the buffer while a blob is open, and finish the blob in the new memory
+    write_blob("Buffer Fill 1" PAD);
+    open_blob();
+    write_partial("growing ");
+    bool resized = cbuf_resize(&cbuf, large_mbuf, sizeof(large_mbuf), NULL);
+    printf("Resized to %lu bytes: %s\n", sizeof(large_mbuf), resized ? "ok" : "failed");
+    errors += !resized;
+    cbuf_viz(&cbuf); printf("\n");
+    write_partial(PAD);
+    write_blob("done");
+    close_blob();
+    read_all();
+
+    ingest("$GPGGA,123519,4807.038,N\n$GPGSA,A,3,04,05\n$GPRMC,1235", 7);
+    read_lines();
+    ingest("19,A,4807\n\nshort\n", 5);
+    read_lines();
+
+#if defined(CBUF_STATS)
+    print_stats();
+#endif
+
+    test_report("Demo", errors + (cbuf_count(&cbuf) != 0));
+#if defined(CBUF_STATS)
+    test_report("Suggested lengths", suggest_test());
+#endif
+    return test_result();
+}
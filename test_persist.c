@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (256)
+#define FILE_PATH "test_persist.cbuf"
+
+static cbuf_t *cbuf;
+
+//Reopens and recoveries that didn't find what was left in the file
+static uint32_t errors;
+
+static void open_file(uint32_t expect_count, bool expect_clean)
+{
+    bool clean = false;
+    cbuf = cbuf_open_file(FILE_PATH, MESSAGE_Q_LEN, &clean);
+    printf("Opened %s (%s), %d messages\n", FILE_PATH, clean ? "clean" : "recovered", cbuf_count(cbuf));
+    cbuf_viz(cbuf); printf("\n");
+    errors += (cbuf_count(cbuf) != expect_count) || (clean != expect_clean);
+}
+
+static void close_file(void)
+{
+    cbuf_close_file(cbuf);
+    printf("Closed %s\n\n", FILE_PATH);
+}
+
+//Write a string that ends in a NULL
+void write_blob(const char* msg)
+{
+    uint32_t count_overwrite = 0;
+    cbuf_write(cbuf, msg, strlen(msg) + 1, true, &count_overwrite);
+    printf("Enqueued a message of %lu bytes (overwrote %d)\n", strlen(msg) + 1, count_overwrite);
+}
+
+//Write a string that doesn't end in a NULL
+void write_partial(const char* msg)
+{
+    uint32_t count_overwrite = 0;
+    cbuf_write(cbuf, msg, strlen(msg), true, &count_overwrite);
+    printf("Appended %lu bytes (overwrote %d)\n", strlen(msg), count_overwrite);
+}
+
+void read_all(void)
+{
+    char msg[MESSAGE_Q_LEN];
+    uint32_t len;
+    while(cbuf_peek_len(cbuf, &len))
+    {
+        errors += (cbuf_read(cbuf, msg) == 0);
+        printf("Read %d bytes: %.*s\n", len, (int)len, msg);
+    }
+    cbuf_viz(cbuf); printf("\n");
+}
+
+//Run some writes in a child process that dies without closing the file
+static void crash_after(void (*writes)(void))
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        cbuf = cbuf_open_file(FILE_PATH, MESSAGE_Q_LEN, NULL);
+        writes();
+        printf("Crashed\n\n");
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+#define PAD "[..................]" //20 charatacters of padding
+
+static void crash_open_blob(void)
+{
+    write_blob("Crash 1" PAD);
+    cbuf_open(cbuf, true, NULL);
+    write_partial("half a line");
+    write_partial(" and a bit more");
+}
+
+static void crash_bad_index(void)
+{
+    write_blob("Crash 2" PAD);
+    write_blob("Crash 3" PAD);
+    //Leave the write index pointing into the middle of the last blob, as if it were corrupted
+    cbuf->widx = (cbuf->widx + MESSAGE_Q_LEN - 10) % MESSAGE_Q_LEN;
+}
+
+#if defined(CBUF_TIMESTAMP)
+//A clock far ahead of the monotonic clock, as the one of the boot that wrote a file would be
+static uint64_t last_boot(void)
+{
+    return 1ull << 62;
+}
+
+//A clock far behind the monotonic clock
+static uint64_t early(void)
+{
+    return 1000;
+}
+
+//Stamps must keep going forward across a reboot and a change of clock, or expiry and range
+//lookups would lose track of the newest blobs
+static void reboot_test(void)
+{
+    uint32_t errors = 0;
+    uint64_t ts[4];
+
+    open_file(0, true);
+    cbuf_set_clock(cbuf, last_boot);
+    write_blob("Before reboot 1");
+    write_blob("Before reboot 2");
+    close_file();
+
+    //Reopening drops the clock function, so the monotonic clock stamps the next blob
+    open_file(2, true);
+    write_blob("After reboot");
+    cbuf_set_clock(cbuf, early);
+    write_blob("Early clock");
+    for (uint32_t n = 0; n < 4; n++)
+    {
+        errors += !cbuf_peek_ts(cbuf, n, &ts[n]);
+    }
+    errors += (ts[0] > ts[1]) || (ts[1] > ts[2]) || (ts[2] > ts[3]);
+
+    //Blobs from before the reboot expire first
+    errors += (cbuf_expire_older_than(cbuf, ts[2]) != 2) || (cbuf_count(cbuf) != 2);
+    read_all();
+    close_file();
+    unlink(FILE_PATH);
+    test_report("Stamps go forward after a reboot", errors);
+}
+#endif
+
+#if defined(CBUF_READERS)
+//Readers attached by an earlier process
+static void attach_readers(void)
+{
+    //Mapped only in the child, so the parent can't read the cursors by luck
+    cbuf_reader_t *gone = mmap(NULL, 2 * sizeof(cbuf_reader_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    cbuf_init_readers(cbuf, gone, 2);
+    write_blob("Seen by the old readers 1");
+    write_blob("Seen by the old readers 2");
+    cbuf_close_file(cbuf);
+}
+
+//Reader cursors live in the memory of the process that attached them, so a reopened buffer starts
+//with none and takes new ones
+static void readers_test(void)
+{
+    static cbuf_reader_t readers[2];
+    char msg[MESSAGE_Q_LEN];
+    cbuf_view_t view;
+    uint32_t errors = 0;
+
+    crash_after(attach_readers);
+    open_file(2, true);
+    errors += (cbuf_read(cbuf, msg) == 0) || (strcmp(msg, "Seen by the old readers 1") != 0);
+    errors += !cbuf_init_readers(cbuf, readers, 2);
+    for (uint32_t r = 0; r < 2; r++)
+    {
+        errors += (cbuf_reader_peek_view(cbuf, r, &view) == 0) || (cbuf_reader_read(cbuf, r, msg) == 0);
+        errors += (strcmp(msg, "Seen by the old readers 2") != 0);
+    }
+    errors += (cbuf_count(cbuf) != 0);
+    close_file();
+    unlink(FILE_PATH);
+    test_report("Readers after reopening", errors);
+}
+#endif
+
+int main(void)
+{
+    unlink(FILE_PATH);
+
+    open_file(0, true);
+    write_blob("Persisted 1" PAD);
+    write_blob("Persisted 2" PAD);
+    close_file();
+
+    open_file(2, true);
+    read_all();
+    close_file();
+
+    //The open blob is kept, closed, up to what was written before the crash
+    crash_after(crash_open_blob);
+    open_file(2, false);
+    read_all();
+    close_file();
+
+    //Recovery drops the blob that the damaged write index points into
+    crash_after(crash_bad_index);
+    open_file(1, false);
+    read_all();
+    close_file();
+
+    unlink(FILE_PATH);
+    test_report("Reopen and recover", errors);
+#if defined(CBUF_TIMESTAMP)
+    reboot_test();
+#endif
+#if defined(CBUF_READERS)
+    readers_test();
+#endif
+    return test_result();
+}
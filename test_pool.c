@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define RINGS (20000)
+#define RING_LEN (256)
+#define MESSAGE_MAX_LEN (40)
+#define MESSAGE_COUNT (1000000)
+#define SWEEP_EVERY (3000)      //Writes between sweeps. Few enough that no ring fills up
+#define CHURN_EVERY (997)       //Writes between freeing and reallocating a ring
+
+static cbuf_pool_t pool;
+static uint32_t next_seq[RINGS];   //Sequence number of the next message written to each ring
+static uint32_t read_seq[RINGS];   //Sequence number of the next message read from each ring
+static bool written[RINGS];        //Rings written since the last sweep
+
+//Drain every ready ring, checking that each holds its messages in order, and that the sweep visits
+//exactly the rings that were written
+static uint32_t sweep(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint8_t expect[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t visited = 0;
+
+    for (uint32_t id = 0; cbuf_pool_next_ready(&pool, &id); id++)
+    {
+        cbuf_t *ring = cbuf_pool_ring(&pool, id);
+        uint32_t len;
+        errors += !written[id];
+        written[id] = false;
+        visited++;
+        while (cbuf_peek_len(ring, &len))
+        {
+            cbuf_read(ring, msg);
+            errors += (test_tagged_message(expect, id, read_seq[id], MESSAGE_MAX_LEN) != len) || (memcmp(msg, expect, len) != 0);
+            read_seq[id]++;
+        }
+        errors += (read_seq[id] != next_seq[id]);
+    }
+    for (uint32_t id = 0; id < RINGS; id++)
+    {
+        errors += written[id];
+    }
+    return errors + (visited == 0);
+}
+
+static uint32_t run(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t id;
+    uint32_t rng = 1;
+
+    uint64_t size = cbuf_pool_size(RINGS, RING_LEN);
+    void *arena = aligned_alloc(CBUF_POOL_ALIGN, (size_t)size);
+    errors += !cbuf_pool_init(&pool, arena, RINGS, RING_LEN);
+    printf("  %u rings of %u bytes in a %lu byte arena\n", RINGS, RING_LEN, (unsigned long)size);
+
+    //Every ring can be allocated once, lowest id first
+    for (uint32_t i = 0; i < RINGS; i++)
+    {
+        errors += (cbuf_pool_alloc(&pool, &id) == NULL) || (id != i);
+    }
+    errors += (cbuf_pool_alloc(&pool, &id) != NULL);
+
+    //Write to rings picked at random, sweep now and then, and churn a ring now and then
+    for (uint32_t i = 1; i <= MESSAGE_COUNT; i++)
+    {
+        rng = rng * 1103515245u + 12345u;
+        id = (rng >> 8) % RINGS;
+        errors += !cbuf_pool_write(&pool, id, msg, test_tagged_message(msg, id, next_seq[id], MESSAGE_MAX_LEN), false, NULL);
+        next_seq[id]++;
+        written[id] = true;
+
+        if ((i % CHURN_EVERY) == 0)
+        {
+            //A freed ring comes back empty and unmarked, with the same id
+            uint32_t again;
+            errors += !cbuf_pool_free(&pool, id);
+            cbuf_t *ring = cbuf_pool_alloc(&pool, &again);
+            errors += (ring == NULL) || (again != id) || (cbuf_count(ring) != 0);
+            next_seq[id] = 0;
+            read_seq[id] = 0;
+            written[id] = false;
+        }
+        if ((i % SWEEP_EVERY) == 0)
+        {
+            errors += sweep();
+        }
+    }
+    errors += sweep();
+
+    //Nothing is left marked
+    id = 0;
+    errors += cbuf_pool_next_ready(&pool, &id);
+
+    //Freeing a ring twice, or one that doesn't exist, is refused, so each free ring is handed out once
+    uint32_t first;
+    uint32_t second;
+    errors += !cbuf_pool_free(&pool, 7) || cbuf_pool_free(&pool, 7) || cbuf_pool_free(&pool, RINGS);
+    errors += (cbuf_pool_alloc(&pool, &first) == NULL) || (first != 7);
+    errors += (cbuf_pool_alloc(&pool, &second) != NULL);
+    errors += !cbuf_pool_free(&pool, 3) || !cbuf_pool_free(&pool, 7) || cbuf_pool_free(&pool, 3);
+    errors += (cbuf_pool_alloc(&pool, &first) == NULL) || (cbuf_pool_alloc(&pool, &second) == NULL) || (first == second);
+    errors += (cbuf_pool_alloc(&pool, &id) != NULL);
+    free(arena);
+    return errors;
+}
+
+int main(void)
+{
+    test_report("Pooled rings", run());
+    return test_result();
+}
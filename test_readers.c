@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (1000)
+#define MESSAGE_MAX_LEN (100)
+#define MESSAGE_COUNT (100000)
+#define READERS (3)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN];
+static cbuf_reader_t readers[READERS];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t offsets[MESSAGE_Q_LEN / 4];
+#endif
+
+//Feed a sender, a logger and a sampler from one buffer. Reader r reads one blob every r + 1 writes,
+//so the slower ones fall behind and, with overwrite, lose blobs.
+static uint32_t fan_out(bool allow_overwrite)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t next[READERS] = {0};
+    uint32_t lost[READERS] = {0};
+    uint32_t errors = 0;
+    uint32_t seq = 0;
+
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+    cbuf_init_readers(&cbuf, readers, READERS);
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&cbuf, offsets, MESSAGE_Q_LEN / 4);
+#endif
+
+    for (uint32_t round = 0; (seq < MESSAGE_COUNT) || (cbuf_count(&cbuf) > 0); round++)
+    {
+        if (seq < MESSAGE_COUNT)
+        {
+            if (cbuf_write(&cbuf, msg, test_message(msg, seq, MESSAGE_MAX_LEN), allow_overwrite, NULL))
+            {
+                seq++;
+            }
+        }
+
+        for (uint32_t r = 0; r < READERS; r++)
+        {
+            //Without overwrite, the slowest reader is the one that has to catch up
+            bool turn = ((round % (r + 1)) == 0) || (seq == MESSAGE_COUNT) || (!allow_overwrite && (r == READERS - 1));
+            cbuf_view_t view;
+            if (!turn || !cbuf_reader_peek_view(&cbuf, r, &view))
+            {
+                continue;
+            }
+
+            //Blobs this reader lost were skipped over
+            uint32_t skipped = cbuf_reader_lost(&cbuf, r);
+            next[r] += skipped;
+            lost[r] += skipped;
+
+            uint32_t len = view.len[0] + view.len[1];
+            cbuf_reader_read(&cbuf, r, msg);
+            errors += test_check_message(msg, len, next[r], MESSAGE_MAX_LEN);
+            next[r]++;
+        }
+    }
+
+    for (uint32_t r = 0; r < READERS; r++)
+    {
+        next[r] += cbuf_reader_lost(&cbuf, r);
+        printf("  reader %u: read %u, lost %u\n", r, next[r] - lost[r], lost[r]);
+        errors += (next[r] != MESSAGE_COUNT);
+        errors += (!allow_overwrite && (lost[r] != 0));
+    }
+    return errors;
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes, %u readers\n", sizeof(mbuf), READERS);
+    test_report("Evict past slow readers", fan_out(true));
+    test_report("Hold the writer back", fan_out(false));
+    return test_result();
+}
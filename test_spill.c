@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (512)
+#define MESSAGE_MAX_LEN (100)
+#define MESSAGE_COUNT (50000)
+#define STAGE_LEN (4096)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN];
+static uint8_t stage[STAGE_LEN];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t offsets[MESSAGE_Q_LEN / 4];
+#endif
+
+//Replay one blob and check that it is the next one, allowing for blobs that were lost
+static uint32_t replay_one(uint32_t *next, uint32_t *lost)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t len;
+    uint32_t seq;
+    if (!cbuf_read_replay(&cbuf, msg, &len))
+    {
+        return 0;
+    }
+    memcpy(&seq, msg, sizeof(seq));
+    if (seq < *next)
+    {
+        return 1;
+    }
+    *lost += seq - *next;
+    *next = seq + 1;
+    return test_check_message(msg, len, seq, MESSAGE_MAX_LEN);
+}
+
+//Write bursts far larger than the buffer, flushing every flush_every writes and replaying a few
+//blobs now and then. The buffer erases blobs all the time, but with a stage large enough for what
+//is erased between flushes, none are lost.
+static uint32_t burst(uint32_t stage_len, uint32_t flush_every, bool expect_loss)
+{
+    char path[] = "/tmp/cbuf_spill_XXXXXX";
+    int fd = mkstemp(path);
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t next = 0;
+    uint32_t lost = 0;
+    uint32_t errors = 0;
+    uint32_t erased = 0;
+
+    unlink(path);
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&cbuf, offsets, MESSAGE_Q_LEN / 4);
+#endif
+    errors += !cbuf_init_spill(&cbuf, fd, stage, stage_len);
+
+    for (uint32_t seq = 0; seq < MESSAGE_COUNT; seq++)
+    {
+        uint32_t count_overwrite = 0;
+        errors += !cbuf_write(&cbuf, msg, test_message(msg, seq, MESSAGE_MAX_LEN), true, &count_overwrite);
+        erased += count_overwrite;
+        if ((seq % flush_every) == 0)
+        {
+            errors += (cbuf_spill_flush(&cbuf) < 0);
+        }
+        if ((seq % 7) == 0)
+        {
+            errors += replay_one(&next, &lost);
+        }
+    }
+    uint32_t lost_staging = cbuf_spill_lost(&cbuf);
+    errors += (cbuf_spill_flush(&cbuf) < 0);
+    while (next < MESSAGE_COUNT)
+    {
+        uint32_t was = next;
+        errors += replay_one(&next, &lost);
+        if (next == was)
+        {
+            break;
+        }
+    }
+
+    printf("  stage %u bytes, flush every %u writes: erased %u, lost %u\n", stage_len, flush_every, erased, lost);
+    errors += (next != MESSAGE_COUNT) || (lost != lost_staging);
+    errors += expect_loss ? (lost == 0) : (lost != 0);
+    close(fd);
+    return errors;
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    test_report("Spill everything", burst(STAGE_LEN, 16, false));
+    test_report("Overflow the stage", burst(256, 64, true));
+    return test_result();
+}
@@ -0,0 +1,152 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(CBUF_WAIT)
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (1024)
+#define MESSAGE_MAX_LEN (200)
+#define MESSAGE_COUNT (1000000)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN];
+
+//How each side waits when it can't make progress
+typedef enum {
+    WAIT_SPIN,      //sched_yield and retry
+    WAIT_FUTEX,     //cbuf_wait_readable/cbuf_wait_writable
+    WAIT_EVENTFD,   //poll on cbuf_eventfd, and cbuf_wait_writable
+} wait_mode_t;
+
+static const char *wait_names[] = {"spin", "futex", "eventfd"};
+
+static bool overwrite;
+static wait_mode_t mode;
+static uint32_t total_overwritten;
+static atomic_bool done;
+
+static void *producer(void *arg)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    (void)arg;
+    for (uint32_t seq = 0; seq < MESSAGE_COUNT; seq++)
+    {
+        uint32_t len = test_message(msg, seq, MESSAGE_MAX_LEN);
+        uint32_t count_overwrite = 0;
+        while (!cbuf_write(&cbuf, msg, len, overwrite, &count_overwrite))
+        {
+            //Full; wait for the consumer
+#if defined(CBUF_WAIT)
+            if (mode != WAIT_SPIN)
+            {
+                cbuf_wait_writable(&cbuf, len, -1);
+                continue;
+            }
+#endif
+            sched_yield();
+        }
+        total_overwritten += count_overwrite;
+    }
+    atomic_store(&done, true);
+    return NULL;
+}
+
+//Wait for something to read, briefly so the consumer notices when the producer is done
+static void wait_readable(void)
+{
+#if defined(CBUF_WAIT)
+    if (mode == WAIT_FUTEX)
+    {
+        cbuf_wait_readable(&cbuf, 10);
+        return;
+    }
+    if (mode == WAIT_EVENTFD)
+    {
+        //Clear the eventfd before the caller drains the buffer, so no signal is lost
+        struct pollfd pfd = {.fd = cbuf_eventfd(&cbuf), .events = POLLIN};
+        uint64_t signals;
+        if (poll(&pfd, 1, 10) > 0)
+        {
+            (void)!read(pfd.fd, &signals, sizeof(signals));
+        }
+        return;
+    }
+#endif
+    sched_yield();
+}
+
+static void run(bool allow_overwrite, wait_mode_t wait_mode)
+{
+    pthread_t thread;
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint8_t expect[MESSAGE_MAX_LEN];
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    int64_t last = -1;
+
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+    overwrite = allow_overwrite;
+    mode = wait_mode;
+#if defined(CBUF_WAIT)
+    if (mode == WAIT_EVENTFD)
+    {
+        cbuf_eventfd(&cbuf);
+    }
+#endif
+    total_overwritten = 0;
+    atomic_store(&done, false);
+    pthread_create(&thread, NULL, producer, NULL);
+
+    while (1)
+    {
+        bool finished = atomic_load(&done);
+        if (cbuf_read(&cbuf, msg) == 0)
+        {
+            if (finished) break;
+            wait_readable();
+            continue;
+        }
+
+        //Messages must arrive intact and in order. Gaps are only allowed when overwriting.
+        uint32_t seq;
+        memcpy(&seq, msg, sizeof(seq));
+        uint32_t len = test_message(expect, seq, MESSAGE_MAX_LEN);
+        if ((seq >= MESSAGE_COUNT) || ((int64_t)seq <= last) || memcmp(msg, expect, len) ||
+            (!allow_overwrite && ((int64_t)seq != last + 1)))
+        {
+            errors++;
+        }
+        last = seq;
+        received++;
+    }
+    pthread_join(thread, NULL);
+#if defined(CBUF_WAIT)
+    cbuf_deinit_wait(&cbuf);
+#endif
+
+    char name[96];
+    snprintf(name, sizeof(name), "%s, %s wait: sent %d, received %d, overwrote %d",
+             allow_overwrite ? "Overwrite" : "No overwrite", wait_names[mode], MESSAGE_COUNT, received, total_overwritten);
+    test_report(name, errors + (received + total_overwritten != MESSAGE_COUNT));
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    run(false, WAIT_SPIN);
+    run(true, WAIT_SPIN);
+#if defined(CBUF_WAIT)
+    run(false, WAIT_FUTEX);
+    run(false, WAIT_EVENTFD);
+    run(true, WAIT_FUTEX);
+#endif
+    return test_result();
+}
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cbuf.h"
+#include "test_util.h"
+
+#define MESSAGE_Q_LEN (1000)
+#define MESSAGE_MAX_LEN (100)
+#define MESSAGE_COUNT (50000)
+#define MAX_BLOBS (MESSAGE_Q_LEN / 4)
+#define MAX_AGE (20)
+
+static cbuf_t cbuf;
+static uint8_t mbuf[MESSAGE_Q_LEN];
+#if defined(CBUF_BLOB_INDEX)
+static uint32_t offsets[MAX_BLOBS];
+#endif
+
+//A clock the test moves by hand, so that blobs share timestamps and the ranges are repeatable
+static uint64_t now;
+static uint64_t test_clock(void)
+{
+    return now;
+}
+
+//Sequence number of the blob a view shows
+static uint32_t view_seq(const cbuf_view_t *view)
+{
+    uint32_t seq;
+    uint32_t first = (view->len[0] < sizeof(seq)) ? view->len[0] : sizeof(seq);
+    memcpy(&seq, view->seg[0], first);
+    memcpy((uint8_t*)&seq + first, view->seg[1], sizeof(seq) - first);
+    return seq;
+}
+
+//Check a range query against a walk over every blob
+static uint32_t check_range(uint64_t t0, uint64_t t1)
+{
+    uint32_t expect[MAX_BLOBS];
+    uint32_t n = 0;
+    uint32_t errors = 0;
+    cbuf_iter_t it;
+    cbuf_view_t view;
+
+    cbuf_iter_begin(&cbuf, &it);
+    for (uint32_t i = 0; cbuf_iter_next(&cbuf, &it, &view); i++)
+    {
+        uint64_t ts;
+        errors += !cbuf_peek_ts(&cbuf, i, &ts);
+        if ((ts >= t0) && (ts < t1))
+        {
+            expect[n++] = view_seq(&view);
+        }
+    }
+
+    uint32_t found = cbuf_iter_range(&cbuf, t0, t1, &it);
+    errors += (found != n);
+    for (uint32_t i = 0; cbuf_iter_next(&cbuf, &it, &view); i++)
+    {
+        errors += (i >= n) || (view_seq(&view) != expect[i]);
+    }
+    return errors;
+}
+
+//Write with the clock ticking at uneven steps, query ranges around the current time, and expire
+//old blobs now and then. Some blobs are written in batches or built up in pieces.
+static uint32_t run(void)
+{
+    uint8_t msg[MESSAGE_MAX_LEN];
+    uint32_t errors = 0;
+    uint32_t expired = 0;
+
+    cbuf_init(&cbuf, mbuf, MESSAGE_Q_LEN);
+#if defined(CBUF_BLOB_INDEX)
+    cbuf_init_index(&cbuf, offsets, MAX_BLOBS);
+#endif
+    cbuf_set_clock(&cbuf, test_clock);
+    now = 1000;
+
+    for (uint32_t seq = 0; seq < MESSAGE_COUNT; seq++)
+    {
+        uint32_t len = test_message(msg, seq, MESSAGE_MAX_LEN);
+        now += (seq * 13) % 5;
+#if defined(CBUF_ALLOW_PARTIAL)
+        if ((seq % 11) == 0)
+        {
+            //Opened now, but stamped when it's closed
+            errors += !cbuf_open(&cbuf, true, NULL);
+            errors += !cbuf_write(&cbuf, msg, len / 2, true, NULL);
+            now += 3;
+            errors += !cbuf_write(&cbuf, msg + len / 2, len - len / 2, true, NULL);
+            errors += !cbuf_close(&cbuf);
+            uint64_t ts;
+            errors += !cbuf_peek_ts(&cbuf, cbuf_count(&cbuf) - 1, &ts) || (ts != now);
+            continue;
+        }
+#endif
+        if ((seq % 5) == 0)
+        {
+            uint8_t msg2[MESSAGE_MAX_LEN];
+            cbuf_blob_t blobs[2] = {{msg, len}, {msg2, test_message(msg2, seq + 1, MESSAGE_MAX_LEN)}};
+            errors += (cbuf_write_batch(&cbuf, blobs, 2, true, NULL) != 2);
+            seq++;
+        }
+        else
+        {
+            errors += !cbuf_write(&cbuf, msg, len, true, NULL);
+        }
+
+        if ((seq % 7) == 0)
+        {
+            errors += check_range(now - (seq % 50), now - (seq % 50) + (seq % 23));
+            errors += check_range(now - 10, now + 1);
+            errors += check_range(0, now + 1);
+            errors += check_range(now, now);
+        }
+        if ((seq % 97) == 0)
+        {
+            //Everything older than MAX_AGE goes, and nothing newer
+            uint64_t ts;
+            cbuf_iter_t it;
+            uint32_t stale = cbuf_iter_range(&cbuf, 0, now - MAX_AGE, &it);
+            uint32_t n = cbuf_expire_older_than(&cbuf, now - MAX_AGE);
+            errors += (n != stale) || (cbuf_peek_ts(&cbuf, 0, &ts) && (ts < (now - MAX_AGE)));
+            expired += n;
+        }
+    }
+
+    //Expire everything, then check the buffer still works
+    expired += cbuf_expire_older_than(&cbuf, now + 1);
+    errors += (cbuf_count(&cbuf) != 0);
+    errors += !cbuf_write(&cbuf, msg, test_message(msg, 0, MESSAGE_MAX_LEN), false, NULL) || (cbuf_read(&cbuf, msg) == 0);
+    printf("  expired %u blobs\n", expired);
+    return errors + (expired == 0);
+}
+
+int main(void)
+{
+    printf("Message queue is %lu bytes\n", sizeof(mbuf));
+    test_report("Ranges and expiry", run());
+    return test_result();
+}
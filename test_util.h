@@ -0,0 +1,62 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+//Shared by the test programs. Each check prints one PASS/FAIL line through test_report, and main
+//returns test_result() so that build.sh stops at the first program with a failing check.
+
+static uint32_t test_failures;
+
+static inline void test_report(const char *name, uint32_t errors)
+{
+    printf("%s: errors %u -> %s\n", name, errors, (errors == 0) ? "PASS" : "FAIL");
+    test_failures += (errors != 0);
+}
+
+static inline int test_result(void)
+{
+    return (test_failures == 0) ? 0 : 1;
+}
+
+//Each test message is a tag and a sequence number, followed by a length that varies with them up to
+//max_len, filled with the low byte of their sum. The reader knows the length of a message from its
+//tag and sequence number. Tagless messages start with the sequence number alone.
+static inline uint32_t test_message_len(uint32_t tag_len, uint32_t tag, uint32_t seq, uint32_t max_len)
+{
+    uint32_t head = tag_len + sizeof(seq);
+    return head + (tag + seq * 7) % (max_len - head);
+}
+
+static inline uint32_t test_tagged_message(uint8_t *msg, uint32_t tag, uint32_t seq, uint32_t max_len)
+{
+    uint32_t len = test_message_len(sizeof(tag), tag, seq, max_len);
+    memcpy(msg, &tag, sizeof(tag));
+    memcpy(msg + sizeof(tag), &seq, sizeof(seq));
+    memset(msg + sizeof(tag) + sizeof(seq), (uint8_t)(tag + seq), len - sizeof(tag) - sizeof(seq));
+    return len;
+}
+
+static inline uint32_t test_message(uint8_t *msg, uint32_t seq, uint32_t max_len)
+{
+    uint32_t len = test_message_len(0, 0, seq, max_len);
+    memcpy(msg, &seq, sizeof(seq));
+    memset(msg + sizeof(seq), (uint8_t)seq, len - sizeof(seq));
+    return len;
+}
+
+//Count 1 unless msg is exactly the message test_message makes for seq
+static inline uint32_t test_check_message(const uint8_t *msg, uint32_t len, uint32_t seq, uint32_t max_len)
+{
+    uint32_t errors = (len != test_message_len(0, 0, seq, max_len)) || (memcmp(msg, &seq, sizeof(seq)) != 0);
+    for (uint32_t i = sizeof(seq); (errors == 0) && (i < len); i++)
+    {
+        errors = (msg[i] != (uint8_t)seq);
+    }
+    return errors;
+}
+
+#endif